@@ -11,145 +11,497 @@
  */
 
 #define _GNU_SOURCE
+#define GL_GLEXT_PROTOTYPES
 #include "ctx-stack.h"
+#include <EGL/eglext.h>
+#include "gl-error.h"
+#include "gl-render.h"
+#include "gl-state.h"
+#include "gl-upload.h"
 #include "globals.h"
+#include "lock-profiler.h"
 #include <assert.h>
+#include <string.h>
 #include "vdpau-trace.h"
-#include <sys/syscall.h>
-#include <unistd.h>
 
 static __thread Display *glx_ctx_stack_display;
 static __thread Drawable glx_ctx_stack_wnd;
 static __thread GLXContext glx_ctx_stack_glc;
+static __thread EGLDisplay egl_ctx_stack_display;
+static __thread EGLSurface egl_ctx_stack_draw;
+static __thread EGLSurface egl_ctx_stack_read;
+static __thread EGLContext egl_ctx_stack_ctx;
+static __thread EGLenum egl_ctx_stack_api;
 static __thread int glx_ctx_stack_same;
 static __thread int glx_ctx_stack_element_count = 0;
-GHashTable     *glc_hash_table = NULL;
-int             glc_hash_table_ref_count = 0;
+static __thread Display *glx_ctx_sticky_display;    ///< display of context left current
+
+#define THREAD_CONTEXT_POOL_SIZE    4
+
+/** @brief GL context owned by a thread */
+struct thread_context {
+    void                   *glc;        ///< GLXContext or EGLContext, depending on backend
+    Display                *dpy;        ///< display context was created on
+    int                     generation; ///< value of glc_generation at the moment of creation
+    GLState                 gl_state;   ///< shadow copy of glc state
+    GLErrorLog              error_log;  ///< errors reported by glc debug output
+    struct thread_context  *prev;       ///< links in thread_context_list, protected by GLX lock
+    struct thread_context  *next;
+};
+
+static __thread struct thread_context thread_ctx;
+static pthread_key_t    thread_ctx_key;     ///< used for destructor call on thread exit only
+static pthread_once_t   thread_ctx_key_once = PTHREAD_ONCE_INIT;
+static struct thread_context *thread_context_list = NULL;  ///< contexts of live threads
+static void            *idle_contexts[THREAD_CONTEXT_POOL_SIZE];  ///< left by exited threads
+static int              idle_context_count = 0;
+static int              glc_ref_count = 0;
+static int              glc_generation = 0; ///< incremented each time contexts are recreated or
+                                            ///< destroyed, invalidating thread_ctx of all threads
 GLXContext      root_glc;
 XVisualInfo    *root_vi;
+static uint64_t glx_ctx_lock_acquired_at;   ///< for lock profiler, accessed by lock holder only
+
+static int          use_egl = 0;            ///< backend of current contexts, fixed while
+                                            ///< glc_ref_count > 0
+static EGLDisplay   egl_dpy = EGL_NO_DISPLAY;
+static EGLConfig    egl_config;
+static EGLContext   egl_root_ctx = EGL_NO_CONTEXT;
+static int          egl_can_present;        ///< egl_dpy is on X11 platform, so window surfaces
+                                            ///< can be created
+
+// GLX context mutex guards context table and calls to GLX functions that talk to X server.
+// GL commands issued between push and pop run without it, so threads with different contexts
+// proceed in parallel. Data shared between contexts is synchronized with fences, see
+// glx_context_fence_insert() and glx_context_fence_wait().
+//
+// With EGL quirk offscreen contexts are EGL ones made current without any surface, so
+// making them current doesn't involve X server at all. Drawables are only touched by
+// presentation queue targets, which get EGL window surfaces.
+
+static
+int
+has_extension(const char *extensions, const char *name)
+{
+    const size_t len = strlen(name);
+    const char *ptr = extensions;
+    while (ptr && (ptr = strstr(ptr, name)) != NULL) {
+        if ((ptr == extensions || ptr[-1] == ' ') && (ptr[len] == ' ' || ptr[len] == 0))
+            return 1;
+        ptr += len;
+    }
+    return 0;
+}
 
+static
+void *
+current_context(void)
+{
+    if (use_egl)
+        return eglGetCurrentContext();
+    return glXGetCurrentContext();
+}
+
+/** @brief creates context sharing objects with root one. Must be called with GLX lock held */
+static
+void *
+create_shared_context(Display *dpy)
+{
+    if (use_egl) {
+        eglBindAPI(EGL_OPENGL_API);
+        return eglCreateContext(egl_dpy, egl_config, egl_root_ctx, NULL);
+    }
+    return glXCreateContext(dpy, root_vi, root_glc, GL_TRUE);
+}
+
+static
 void
-glx_context_push_global(Display *dpy, Drawable wnd, GLXContext glc)
+destroy_context(Display *dpy, void *ctx)
 {
-    pthread_mutex_lock(&global.glx_ctx_stack_mutex);
-    assert(0 == glx_ctx_stack_element_count);
+    if (use_egl)
+        eglDestroyContext(egl_dpy, ctx);
+    else
+        glXDestroyContext(dpy, ctx);
+}
 
+/** @brief saves contexts current in calling thread, so they can be restored by pop */
+static
+void
+save_current_contexts(void)
+{
     glx_ctx_stack_display = glXGetCurrentDisplay();
     glx_ctx_stack_wnd =     glXGetCurrentDrawable();
     glx_ctx_stack_glc =     glXGetCurrentContext();
-    glx_ctx_stack_same =    0;
-    glx_ctx_stack_element_count ++;
+    if (use_egl) {
+        egl_ctx_stack_display = eglGetCurrentDisplay();
+        egl_ctx_stack_draw =    eglGetCurrentSurface(EGL_DRAW);
+        egl_ctx_stack_read =    eglGetCurrentSurface(EGL_READ);
+        egl_ctx_stack_ctx =     eglGetCurrentContext();
+        egl_ctx_stack_api =     eglQueryAPI();
+    }
+}
 
-    if (dpy == glx_ctx_stack_display && wnd == glx_ctx_stack_wnd && glc == glx_ctx_stack_glc) {
-        // Same context. Don't call MakeCurrent.
-        glx_ctx_stack_same = 1;
+/** @brief makes own EGL context current. Must be called with GLX lock held
+
+    Application's GLX context, if any, is released first, as a thread can't have current
+    contexts of both APIs at once.
+*/
+static
+void
+egl_make_current(EGLSurface surface, EGLContext ctx)
+{
+    if (glx_ctx_stack_glc)
+        glXMakeCurrent(glx_ctx_stack_display, None, NULL);
+    eglBindAPI(EGL_OPENGL_API);
+    eglMakeCurrent(egl_dpy, surface, surface, ctx);
+}
+
+/** @brief restores contexts saved by save_current_contexts(). Must be called with GLX lock held
+*/
+static
+void
+restore_saved_contexts(void)
+{
+    if (use_egl) {
+        if (egl_ctx_stack_ctx != EGL_NO_CONTEXT) {
+            eglBindAPI(egl_ctx_stack_api);
+            eglMakeCurrent(egl_ctx_stack_display, egl_ctx_stack_draw, egl_ctx_stack_read,
+                           egl_ctx_stack_ctx);
+        } else {
+            eglMakeCurrent(egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        }
+        if (glx_ctx_stack_glc)
+            glXMakeCurrent(glx_ctx_stack_display, glx_ctx_stack_wnd, glx_ctx_stack_glc);
+        return;
+    }
+
+    if (glx_ctx_stack_display)
+        glXMakeCurrent(glx_ctx_stack_display, glx_ctx_stack_wnd, glx_ctx_stack_glc);
+}
+
+/** @brief checks whether contexts saved by save_current_contexts() belong to application */
+static
+int
+saved_contexts_foreign(void)
+{
+    if (glx_ctx_stack_glc && glx_ctx_stack_glc != thread_ctx.glc)
+        return 1;
+    if (use_egl && egl_ctx_stack_ctx != EGL_NO_CONTEXT && egl_ctx_stack_ctx != thread_ctx.glc)
+        return 1;
+    return 0;
+}
+
+static
+void
+thread_context_destructor(void *param)
+{
+    struct thread_context *tc = param;
+
+    glx_context_lock();
+    if (tc->glc && tc->generation == glc_generation) {
+        if (current_context() == tc->glc) {
+            if (use_egl)
+                eglMakeCurrent(egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            else
+                glXMakeCurrent(tc->dpy, None, NULL);
+        }
+
+        if (tc->prev)
+            tc->prev->next = tc->next;
+        else
+            thread_context_list = tc->next;
+        if (tc->next)
+            tc->next->prev = tc->prev;
+
+        if (idle_context_count < THREAD_CONTEXT_POOL_SIZE) {
+            idle_contexts[idle_context_count ++] = tc->glc;
+        } else {
+            destroy_context(tc->dpy, tc->glc);
+        }
+    }
+    tc->glc = NULL;
+    glx_context_unlock();
+}
+
+static
+void
+thread_context_create_key(void)
+{
+    pthread_key_create(&thread_ctx_key, thread_context_destructor);
+}
+
+/** @brief gives calling thread a GL context, either from idle pool or newly created one
+ *
+ *  Must be called with GLX lock held.
+ */
+static
+void
+thread_context_attach(Display *dpy)
+{
+    void *glc;
+    if (idle_context_count > 0) {
+        glc = idle_contexts[-- idle_context_count];
     } else {
-        glx_ctx_stack_same = 0;
-        glXMakeCurrent(dpy, wnd, glc);
+        glc = create_shared_context(dpy);
+        assert(glc);
     }
+
+    thread_ctx.glc = glc;
+    thread_ctx.dpy = dpy;
+    thread_ctx.generation = glc_generation;
+    gl_state_reset(&thread_ctx.gl_state);
+    gl_error_reset(&thread_ctx.error_log);
+    thread_ctx.prev = NULL;
+    thread_ctx.next = thread_context_list;
+    if (thread_context_list)
+        thread_context_list->prev = &thread_ctx;
+    thread_context_list = &thread_ctx;
+
+    // destructor is called for non-NULL values only
+    pthread_setspecific(thread_ctx_key, &thread_ctx);
 }
 
 void
 glx_context_push_thread_local(VdpDeviceData *deviceData)
 {
-    pthread_mutex_lock(&global.glx_ctx_stack_mutex);
+    assert(0 == glx_ctx_stack_element_count);
     Display *dpy = deviceData->display;
     const Window wnd = deviceData->root;
-    const gint thread_id = (gint) syscall(__NR_gettid);
 
-    GLXContext glc = g_hash_table_lookup(glc_hash_table, GINT_TO_POINTER(thread_id));
-    if (!glc) {
-        glc = glXCreateContext(dpy, root_vi, root_glc, GL_TRUE);
-        assert(glc);
-        g_hash_table_insert(glc_hash_table, GINT_TO_POINTER(thread_id), glc);
+    if (global.quirks.sticky_context && thread_ctx.glc && dpy == glx_ctx_sticky_display &&
+        thread_ctx.generation == __atomic_load_n(&glc_generation, __ATOMIC_ACQUIRE) &&
+        thread_ctx.glc == current_context())
+    {
+        // Our context is still current since previous call. Nothing to look up or switch.
+        glx_ctx_stack_same = 1;
+        glx_ctx_stack_element_count ++;
+        gl_state_set_current(&thread_ctx.gl_state);
+        gl_error_set_current(&thread_ctx.error_log);
+        return;
     }
 
-    glx_ctx_stack_display = glXGetCurrentDisplay();
-    glx_ctx_stack_wnd =     glXGetCurrentDrawable();
-    glx_ctx_stack_glc =     glXGetCurrentContext();
+    glx_context_lock();
+    save_current_contexts();
     glx_ctx_stack_element_count ++;
 
-    if (dpy == glx_ctx_stack_display && wnd == glx_ctx_stack_wnd && glc == glx_ctx_stack_glc) {
+    if (NULL == thread_ctx.glc || thread_ctx.generation != glc_generation) {
+        if (thread_ctx.glc && current_context() == thread_ctx.glc) {
+            // context was destroyed along with the last device, there is nothing to restore
+            glx_ctx_stack_display = NULL;
+            glx_ctx_stack_glc = NULL;
+            egl_ctx_stack_ctx = EGL_NO_CONTEXT;
+        }
+        thread_context_attach(dpy);
+    }
+    void *glc = thread_ctx.glc;
+
+    if (use_egl) {
+        if (egl_ctx_stack_ctx == glc && egl_ctx_stack_draw == EGL_NO_SURFACE) {
+            glx_ctx_stack_same = 1;
+        } else {
+            glx_ctx_stack_same = 0;
+            egl_make_current(EGL_NO_SURFACE, glc);
+        }
+    } else if (dpy == glx_ctx_stack_display && wnd == glx_ctx_stack_wnd &&
+               glc == glx_ctx_stack_glc)
+    {
         // Same context. Don't call MakeCurrent.
         glx_ctx_stack_same = 1;
     } else {
         glx_ctx_stack_same = 0;
         glXMakeCurrent(dpy, wnd, glc);
     }
+
+    if (global.quirks.sticky_context)
+        glx_ctx_sticky_display = dpy;
+    glx_context_unlock();
+    gl_state_set_current(&thread_ctx.gl_state);
+    gl_error_set_current(&thread_ctx.error_log);
 }
 
 void
 glx_context_pop()
 {
     assert(1 == glx_ctx_stack_element_count);
+    gl_state_set_current(NULL);
+    gl_error_set_current(NULL);
 
-    if (!glx_ctx_stack_same) {
-        if (glx_ctx_stack_display)
-            glXMakeCurrent(glx_ctx_stack_display, glx_ctx_stack_wnd, glx_ctx_stack_glc);
+    // In sticky mode context stays current, saving MakeCurrent pair on the next call.
+    // Application's own context is always brought back though, it may be rendering with it.
+    if (!glx_ctx_stack_same && (!global.quirks.sticky_context || saved_contexts_foreign())) {
+        glx_context_lock();
+        restore_saved_contexts();
+        glx_context_unlock();
     }
 
     glx_ctx_stack_element_count --;
-
-    pthread_mutex_unlock(&global.glx_ctx_stack_mutex);
 }
 
 void
 glx_context_lock(void)
 {
-    pthread_mutex_lock(&global.glx_ctx_stack_mutex);
+    uint64_t acquired_at = lockprof_mutex_lock(&global.glx_ctx_stack_mutex, LOCK_CLASS_GLX_CTX);
+    glx_ctx_lock_acquired_at = acquired_at;
 }
 
 void
 glx_context_unlock(void)
 {
-    pthread_mutex_unlock(&global.glx_ctx_stack_mutex);
+    lockprof_mutex_unlock(&global.glx_ctx_stack_mutex, LOCK_CLASS_GLX_CTX,
+                          glx_ctx_lock_acquired_at);
+}
+
+/** @brief initializes EGL display and root context. Must be called with GLX lock held
+
+    X11 platform is preferred, as contexts on it can draw to presentation queue targets.
+    If it's unavailable, Mesa's surfaceless platform is tried, which needs no X server at
+    all, but can't display anything.
+
+    @return 0 on success, -1 on failure
+*/
+static
+int
+egl_initialize(Display *dpy)
+{
+    const char *client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (NULL == client_extensions || NULL == get_platform_display) {
+        traceError("error (egl_initialize): EGL_EXT_platform_base is not supported\n");
+        return -1;
+    }
+
+    egl_dpy = EGL_NO_DISPLAY;
+    egl_can_present = 0;
+    if (has_extension(client_extensions, "EGL_KHR_platform_x11") ||
+        has_extension(client_extensions, "EGL_EXT_platform_x11"))
+    {
+        egl_dpy = get_platform_display(EGL_PLATFORM_X11_KHR, dpy, NULL);
+        if (egl_dpy != EGL_NO_DISPLAY && eglInitialize(egl_dpy, NULL, NULL)) {
+            egl_can_present = 1;
+        } else {
+            egl_dpy = EGL_NO_DISPLAY;
+        }
+    }
+    if (EGL_NO_DISPLAY == egl_dpy &&
+        has_extension(client_extensions, "EGL_MESA_platform_surfaceless"))
+    {
+        egl_dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (egl_dpy != EGL_NO_DISPLAY && !eglInitialize(egl_dpy, NULL, NULL))
+            egl_dpy = EGL_NO_DISPLAY;
+        if (egl_dpy != EGL_NO_DISPLAY)
+            traceInfo("warning: EGL uses surfaceless platform, presentation is unavailable\n");
+    }
+    if (EGL_NO_DISPLAY == egl_dpy) {
+        traceError("error (egl_initialize): no suitable EGL platform\n");
+        return -1;
+    }
+
+    if (!has_extension(eglQueryString(egl_dpy, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+        traceError("error (egl_initialize): EGL_KHR_surfaceless_context is not supported\n");
+        goto err;
+    }
+
+    const EGLint config_attrs[] = {
+        EGL_SURFACE_TYPE,       egl_can_present ? EGL_WINDOW_BIT : 0,
+        EGL_RENDERABLE_TYPE,    EGL_OPENGL_BIT,
+        EGL_RED_SIZE,           8,
+        EGL_GREEN_SIZE,         8,
+        EGL_BLUE_SIZE,          8,
+        EGL_ALPHA_SIZE,         8,
+        EGL_NONE
+    };
+    EGLint config_count = 0;
+    if (!eglChooseConfig(egl_dpy, config_attrs, &egl_config, 1, &config_count) ||
+        config_count < 1)
+    {
+        traceError("error (egl_initialize): eglChooseConfig failed\n");
+        goto err;
+    }
+
+    eglBindAPI(EGL_OPENGL_API);
+    egl_root_ctx = eglCreateContext(egl_dpy, egl_config, EGL_NO_CONTEXT, NULL);
+    if (EGL_NO_CONTEXT == egl_root_ctx) {
+        traceError("error (egl_initialize): eglCreateContext failed\n");
+        goto err;
+    }
+    return 0;
+
+err:
+    eglTerminate(egl_dpy);
+    egl_dpy = EGL_NO_DISPLAY;
+    return -1;
 }
 
 void
-glx_context_ref_glc_hash_table(Display *dpy, int screen)
+glx_context_ref_contexts(Display *dpy, int screen)
 {
-    pthread_mutex_lock(&global.glx_ctx_stack_mutex);
-    if (0 == glc_hash_table_ref_count) {
-        glc_hash_table = g_hash_table_new(g_direct_hash, g_direct_equal);
-        glc_hash_table_ref_count = 1;
+    pthread_once(&thread_ctx_key_once, thread_context_create_key);
+
+    glx_context_lock();
+    if (0 == glc_ref_count) {
+        glc_ref_count = 1;
+        __atomic_add_fetch(&glc_generation, 1, __ATOMIC_RELEASE);
+
+        use_egl = 0;
+        root_glc = NULL;
+        root_vi = NULL;
+        if (global.quirks.egl) {
+            if (0 == egl_initialize(dpy)) {
+                use_egl = 1;
+                glx_context_unlock();
+                return;
+            }
+            traceInfo("warning: EGL initialization failed, falling back to GLX\n");
+        }
 
         GLint att[] = { GLX_RGBA, GLX_DEPTH_SIZE, 24, GLX_DOUBLEBUFFER, None };
         root_vi = glXChooseVisual(dpy, screen, att);
         if (NULL == root_vi) {
-            traceError("error (glx_context_ref_glc_hash_table): glXChooseVisual failed\n");
+            traceError("error (glx_context_ref_contexts): glXChooseVisual failed\n");
+            glx_context_unlock();
             return;
         }
         root_glc = glXCreateContext(dpy, root_vi, NULL, GL_TRUE);
     } else {
-        glc_hash_table_ref_count ++;
+        glc_ref_count ++;
     }
-    pthread_mutex_unlock(&global.glx_ctx_stack_mutex);
+    glx_context_unlock();
 }
 
-static
 void
-glc_hash_destroy_func(gpointer key, gpointer value, gpointer user_data)
+glx_context_unref_contexts(Display *dpy)
 {
-    (void)key;
-    GLXContext glc = value;
-    Display *dpy = user_data;
-    glXDestroyContext(dpy, glc);
-}
+    glx_context_lock();
+    glc_ref_count --;
+    if (0 == glc_ref_count) {
+        // Contexts of live threads are destroyed too. Their thread_ctx become stale after
+        // generation change and are never touched by other threads again.
+        for (struct thread_context *tc = thread_context_list; tc != NULL; tc = tc->next)
+            destroy_context(dpy, tc->glc);
+        thread_context_list = NULL;
 
-void
-glx_context_unref_glc_hash_table(Display *dpy)
-{
-    pthread_mutex_lock(&global.glx_ctx_stack_mutex);
-    glc_hash_table_ref_count --;
-    if (0 == glc_hash_table_ref_count) {
-        g_hash_table_foreach(glc_hash_table, glc_hash_destroy_func, dpy);
-        g_hash_table_unref(glc_hash_table);
-        glc_hash_table = NULL;
+        for (int k = 0; k < idle_context_count; k ++)
+            destroy_context(dpy, idle_contexts[k]);
+        idle_context_count = 0;
+
+        __atomic_add_fetch(&glc_generation, 1, __ATOMIC_RELEASE);
+        // shared objects are gone along with the last context
+        gl_upload_forget();
+        gl_render_forget();
 
-        glXDestroyContext(dpy, root_glc);
-        XFree(root_vi);
+        if (use_egl) {
+            eglDestroyContext(egl_dpy, egl_root_ctx);
+            egl_root_ctx = EGL_NO_CONTEXT;
+            // display is terminated before X connection it was created on gets closed
+            eglTerminate(egl_dpy);
+            egl_dpy = EGL_NO_DISPLAY;
+        } else {
+            glXDestroyContext(dpy, root_glc);
+            XFree(root_vi);
+        }
     }
-    pthread_mutex_unlock(&global.glx_ctx_stack_mutex);
+    glx_context_unlock();
 }
 
 GLXContext
@@ -157,3 +509,182 @@ glx_context_get_root_context(void)
 {
     return root_glc;
 }
+
+int
+glx_context_uses_egl(void)
+{
+    return use_egl;
+}
+
+void
+glx_context_release_current(Display *dpy)
+{
+    glx_context_lock();
+    if (use_egl)
+        eglMakeCurrent(egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    else
+        glXMakeCurrent(dpy, None, NULL);
+    glx_context_unlock();
+}
+
+int
+glx_context_create_target(VdpDeviceData *deviceData, VdpPresentationQueueTargetData *target)
+{
+    glx_context_lock();
+    if (use_egl) {
+        if (!egl_can_present) {
+            traceError("error (glx_context_create_target): EGL display can't present\n");
+            goto err;
+        }
+        // created on application's drawable, so each target gets its own surface
+        target->egl_surface = eglCreateWindowSurface(egl_dpy, egl_config,
+                                                     (EGLNativeWindowType)target->drawable,
+                                                     NULL);
+        if (EGL_NO_SURFACE == target->egl_surface) {
+            traceError("error (glx_context_create_target): eglCreateWindowSurface failed\n");
+            goto err;
+        }
+        eglBindAPI(EGL_OPENGL_API);
+        target->egl_ctx = eglCreateContext(egl_dpy, egl_config, egl_root_ctx, NULL);
+        if (EGL_NO_CONTEXT == target->egl_ctx) {
+            traceError("error (glx_context_create_target): eglCreateContext failed\n");
+            eglDestroySurface(egl_dpy, target->egl_surface);
+            goto err;
+        }
+    } else {
+        GLint att[] = { GLX_RGBA, GLX_DEPTH_SIZE, 24, GLX_DOUBLEBUFFER, None };
+        XVisualInfo *vi;
+        vi = glXChooseVisual(deviceData->display, deviceData->screen, att);
+        if (NULL == vi) {
+            traceError("error (glx_context_create_target): glXChooseVisual failed\n");
+            goto err;
+        }
+
+        // create context for dislaying result (can share display lists with root context)
+        target->glc = glXCreateContext(deviceData->display, vi, root_glc, GL_TRUE);
+        XFree(vi);
+    }
+    gl_state_reset(&target->gl_state);
+    gl_error_reset(&target->error_log);
+    glx_context_unlock();
+    return 0;
+
+err:
+    glx_context_unlock();
+    return -1;
+}
+
+void
+glx_context_destroy_target(VdpDeviceData *deviceData, VdpPresentationQueueTargetData *target)
+{
+    glx_context_lock();
+    if (use_egl) {
+        eglDestroyContext(egl_dpy, target->egl_ctx);
+        eglDestroySurface(egl_dpy, target->egl_surface);
+    } else {
+        glXDestroyContext(deviceData->display, target->glc);
+    }
+    glx_context_unlock();
+}
+
+void
+glx_context_push_target(VdpDeviceData *deviceData, VdpPresentationQueueTargetData *target)
+{
+    assert(0 == glx_ctx_stack_element_count);
+    glx_context_lock();
+    save_current_contexts();
+    glx_ctx_stack_element_count ++;
+
+    if (use_egl) {
+        if (egl_ctx_stack_ctx == target->egl_ctx && egl_ctx_stack_draw == target->egl_surface) {
+            glx_ctx_stack_same = 1;
+        } else {
+            glx_ctx_stack_same = 0;
+            egl_make_current(target->egl_surface, target->egl_ctx);
+        }
+    } else if (deviceData->display == glx_ctx_stack_display &&
+               target->drawable == glx_ctx_stack_wnd && target->glc == glx_ctx_stack_glc)
+    {
+        // Same context. Don't call MakeCurrent.
+        glx_ctx_stack_same = 1;
+    } else {
+        glx_ctx_stack_same = 0;
+        glXMakeCurrent(deviceData->display, target->drawable, target->glc);
+    }
+    glx_context_unlock();
+    gl_state_set_current(&target->gl_state);
+    gl_error_set_current(&target->error_log);
+}
+
+void
+glx_context_swap_buffers(VdpDeviceData *deviceData, VdpPresentationQueueTargetData *target)
+{
+    glx_context_lock();
+    if (use_egl)
+        eglSwapBuffers(egl_dpy, target->egl_surface);
+    else
+        glXSwapBuffers(deviceData->display, target->drawable);
+    glx_context_unlock();
+}
+
+void
+glx_context_detect_caps(void)
+{
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    if (NULL == extensions)
+        extensions = "";
+
+    global.gl_caps.arb_sync = has_extension(extensions, "GL_ARB_sync");
+    if (!global.gl_caps.arb_sync)
+        traceInfo("warning: GL_ARB_sync is not available, falling back to glFinish\n");
+
+    global.gl_caps.arb_pixel_buffer_object =
+        has_extension(extensions, "GL_ARB_pixel_buffer_object");
+    global.gl_caps.khr_debug = has_extension(extensions, "GL_KHR_debug");
+
+    // persistent mappings need fences to synchronize with GPU
+    global.gl_caps.arb_buffer_storage = global.gl_caps.arb_sync &&
+                                        global.gl_caps.arb_pixel_buffer_object &&
+                                        has_extension(extensions, "GL_ARB_buffer_storage");
+}
+
+void
+glx_context_fence_insert(GLsync *fence)
+{
+    if (!global.gl_caps.arb_sync) {
+        glFinish();
+        return;
+    }
+
+    if (*fence)
+        glDeleteSync(*fence);
+    *fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // fence may be waited for in other context, it will never signal if not submitted
+    glFlush();
+}
+
+void
+glx_context_fence_wait(GLsync *fence)
+{
+    if (*fence)
+        glWaitSync(*fence, 0, GL_TIMEOUT_IGNORED);
+}
+
+/** @brief blocks until GPU passes the fence. Fence is released then, as it's signaled anyway */
+void
+glx_context_fence_client_wait(GLsync *fence)
+{
+    if (*fence) {
+        glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(*fence);
+    }
+    *fence = NULL;
+}
+
+void
+glx_context_fence_release(GLsync *fence)
+{
+    if (*fence)
+        glDeleteSync(*fence);
+    *fence = NULL;
+}
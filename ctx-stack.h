@@ -11,14 +11,26 @@
 
 #include "vdpau-soft.h"
 
-void glx_context_push_global(Display *dpy, Drawable wnd, GLXContext glc);
 void glx_context_push_thread_local(VdpDeviceData *deviceData);
 void glx_context_pop(void);
-void glx_context_ref_glc_hash_table(Display *dpy, int screen);
-void glx_context_unref_glc_hash_table(Display *dpy);
+void glx_context_ref_contexts(Display *dpy, int screen);
+void glx_context_unref_contexts(Display *dpy);
 GLXContext  glx_context_get_root_context(void);
+int  glx_context_uses_egl(void);
+void glx_context_release_current(Display *dpy);
+
+int  glx_context_create_target(VdpDeviceData *deviceData, VdpPresentationQueueTargetData *target);
+void glx_context_destroy_target(VdpDeviceData *deviceData, VdpPresentationQueueTargetData *target);
+void glx_context_push_target(VdpDeviceData *deviceData, VdpPresentationQueueTargetData *target);
+void glx_context_swap_buffers(VdpDeviceData *deviceData, VdpPresentationQueueTargetData *target);
 
 void glx_context_lock(void);
 void glx_context_unlock(void);
 
+void glx_context_detect_caps(void);
+void glx_context_fence_insert(GLsync *fence);
+void glx_context_fence_wait(GLsync *fence);
+void glx_context_fence_client_wait(GLsync *fence);
+void glx_context_fence_release(GLsync *fence);
+
 #endif /* __CTX_STACK_H */
@@ -0,0 +1,264 @@
+/*
+ * Copyright 2013  Rinat Ibragimov
+ *
+ * This file is part of libvdpau-va-gl
+ *
+ * libvdpau-va-gl is distributed under the terms of the LGPLv3. See COPYING for details.
+ */
+
+/*
+ *  Texture atlas for small images. OSD code creates lots of tiny bitmaps, glyphs mostly.
+ *  Instead of a texture object each, they get a region of a shared page texture.
+ *
+ *  Pages are filled by shelves: rows of images, with height of the tallest one. New image
+ *  goes to the shelf with the least height excess, or opens a new one. Freed space is not
+ *  reused separately, page is reset as a whole when its last image is freed. Number of pages
+ *  is limited, when all are full, caller falls back to a dedicated texture.
+ *
+ *  Each image is surrounded by a border, so filtering doesn't pull in neighbours. Users fill
+ *  it with copies of image edge texels, which makes linear filtering at the edges behave
+ *  like clamp-to-edge of a dedicated texture.
+ */
+
+#define GL_GLEXT_PROTOTYPES
+#include "gl-atlas.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include "ctx-stack.h"
+#include "gl-state.h"
+
+#define ATLAS_MAX_PAGES         16
+#define ATLAS_PADDING           1
+#define ATLAS_SHELF_ALIGNMENT   8       ///< shelf heights are rounded up to that
+#define ATLAS_MAX_SHELVES       (GL_ATLAS_PAGE_SIZE / ATLAS_SHELF_ALIGNMENT)
+
+typedef struct {
+    uint32_t    y;
+    uint32_t    height;
+    uint32_t    used_width;
+} GLAtlasShelf;
+
+struct GLAtlasPage {
+    GLuint          tex_id;
+    GLsync          fence;          ///< last access to freed images, passed before reuse
+    int             image_count;    ///< images allocated on the page
+    int             needs_clear;    ///< page was reset, old images are still there
+    int             shelf_count;
+    uint32_t        shelves_bottom; ///< y where the next shelf starts
+    GLAtlasShelf    shelves[ATLAS_MAX_SHELVES];
+};
+
+struct GLAtlas {
+    pthread_mutex_t lock;
+    GLenum          internal_format;
+    GLenum          format;
+    GLenum          type;
+    unsigned int    bytes_per_pixel;
+    int             red_as_alpha;   ///< single channel texture, sampled as alpha
+    int             page_count;
+    GLAtlasPage     pages[ATLAS_MAX_PAGES];
+};
+
+/** @brief creates atlas for images in given texture format. Pages are created on demand
+
+    @param red_as_alpha     red channel is sampled as alpha, others read as ones
+*/
+GLAtlas *
+gl_atlas_create(GLenum internal_format, GLenum format, GLenum type, unsigned int bytes_per_pixel,
+                int red_as_alpha)
+{
+    GLAtlas *atlas = calloc(1, sizeof(GLAtlas));
+    if (NULL == atlas)
+        return NULL;
+    pthread_mutex_init(&atlas->lock, NULL);
+    atlas->internal_format = internal_format;
+    atlas->format = format;
+    atlas->type = type;
+    atlas->bytes_per_pixel = bytes_per_pixel;
+    atlas->red_as_alpha = red_as_alpha;
+    atlas->page_count = 0;
+    return atlas;
+}
+
+/** @brief frees atlas with all its pages. Must be called with GL context pushed */
+void
+gl_atlas_destroy(GLAtlas *atlas)
+{
+    if (NULL == atlas)
+        return;
+    for (int k = 0; k < atlas->page_count; k ++) {
+        gl_state_delete_texture(atlas->pages[k].tex_id);
+        glx_context_fence_release(&atlas->pages[k].fence);
+    }
+    pthread_mutex_destroy(&atlas->lock);
+    free(atlas);
+}
+
+/** @brief (re)specifies page texture image, filling it with zeros
+
+    Leaves page texture bound.
+*/
+static
+int
+clear_page(GLAtlas *atlas, GLAtlasPage *page)
+{
+    void *zeros = calloc((size_t)GL_ATLAS_PAGE_SIZE * GL_ATLAS_PAGE_SIZE, atlas->bytes_per_pixel);
+    if (NULL == zeros)
+        return 0;
+    gl_state_bind_texture(page->tex_id);
+    if (4 != atlas->bytes_per_pixel)
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, atlas->internal_format, GL_ATLAS_PAGE_SIZE,
+                 GL_ATLAS_PAGE_SIZE, 0, atlas->format, atlas->type, zeros);
+    if (4 != atlas->bytes_per_pixel)
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    free(zeros);
+    page->needs_clear = 0;
+    return 1;
+}
+
+static
+GLAtlasPage *
+add_page(GLAtlas *atlas)
+{
+    if (ATLAS_MAX_PAGES == atlas->page_count)
+        return NULL;
+
+    GLAtlasPage *page = &atlas->pages[atlas->page_count];
+    glGenTextures(1, &page->tex_id);
+    gl_state_bind_texture(page->tex_id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if (atlas->red_as_alpha) {
+        GLint swizzle_mask[] = {GL_ONE, GL_ONE, GL_ONE, GL_RED};
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle_mask);
+    }
+    if (!clear_page(atlas, page)) {
+        gl_state_delete_texture(page->tex_id);
+        return NULL;
+    }
+
+    page->fence = NULL;
+    page->image_count = 0;
+    page->shelf_count = 0;
+    page->shelves_bottom = 0;
+    atlas->page_count ++;
+    return page;
+}
+
+/** @brief finds place for width x height block on the page, returns 0 if there is none */
+static
+int
+page_place(GLAtlasPage *page, uint32_t width, uint32_t height, uint32_t *x, uint32_t *y)
+{
+    GLAtlasShelf *best = NULL;
+    for (int k = 0; k < page->shelf_count; k ++) {
+        GLAtlasShelf *shelf = &page->shelves[k];
+        if (shelf->height < height || GL_ATLAS_PAGE_SIZE - shelf->used_width < width)
+            continue;
+        if (NULL == best || shelf->height < best->height)
+            best = shelf;
+    }
+
+    // new shelf is better than one much taller than needed
+    const uint32_t shelf_height =
+        (height + ATLAS_SHELF_ALIGNMENT - 1) & ~(uint32_t)(ATLAS_SHELF_ALIGNMENT - 1);
+    if ((NULL == best || best->height > 2 * shelf_height) &&
+        GL_ATLAS_PAGE_SIZE - page->shelves_bottom >= shelf_height &&
+        page->shelf_count < ATLAS_MAX_SHELVES)
+    {
+        best = &page->shelves[page->shelf_count ++];
+        best->y = page->shelves_bottom;
+        best->height = shelf_height;
+        best->used_width = 0;
+        page->shelves_bottom += shelf_height;
+    }
+    if (NULL == best)
+        return 0;
+
+    *x = best->used_width;
+    *y = best->y;
+    best->used_width += width;
+    return 1;
+}
+
+/** @brief allocates width x height region. Must be called with GL context pushed
+
+    @return 1 on success, 0 if image is too large, or atlas is full.
+*/
+int
+gl_atlas_alloc(GLAtlas *atlas, uint32_t width, uint32_t height, GLAtlasRegion *region)
+{
+    if (width > GL_ATLAS_MAX_IMAGE_SIZE || height > GL_ATLAS_MAX_IMAGE_SIZE)
+        return 0;
+
+    const uint32_t block_width = width + 2 * ATLAS_PADDING;
+    const uint32_t block_height = height + 2 * ATLAS_PADDING;
+    uint32_t x, y;
+    GLAtlasPage *page = NULL;
+
+    pthread_mutex_lock(&atlas->lock);
+    for (int k = 0; k < atlas->page_count; k ++) {
+        if (page_place(&atlas->pages[k], block_width, block_height, &x, &y)) {
+            page = &atlas->pages[k];
+            break;
+        }
+    }
+    if (NULL == page) {
+        page = add_page(atlas);
+        if (NULL == page || !page_place(page, block_width, block_height, &x, &y)) {
+            pthread_mutex_unlock(&atlas->lock);
+            return 0;
+        }
+    }
+
+    if (page->needs_clear) {
+        // GPU may still read old images, wherever it was told to
+        glx_context_fence_client_wait(&page->fence);
+        if (!clear_page(atlas, page)) {
+            // page can't be reused now, leave it for the next try
+            page->shelf_count = 0;
+            page->shelves_bottom = 0;
+            page->needs_clear = 1;
+            pthread_mutex_unlock(&atlas->lock);
+            return 0;
+        }
+    }
+    page->image_count ++;
+    pthread_mutex_unlock(&atlas->lock);
+
+    region->page = page;
+    region->tex_id = page->tex_id;
+    region->x = x + ATLAS_PADDING;
+    region->y = y + ATLAS_PADDING;
+    return 1;
+}
+
+/** @brief returns region to the atlas. Must be called with GL context pushed
+
+    @param fence    fence placed after the last access to region contents. Atlas takes it over,
+        as space may be reused only after GPU is done with it.
+*/
+void
+gl_atlas_free(GLAtlas *atlas, GLAtlasRegion *region, GLsync *fence)
+{
+    GLAtlasPage *page = region->page;
+
+    pthread_mutex_lock(&atlas->lock);
+    // Only the latest fence is kept. Earlier ones were likely passed long ago, so waiting
+    // for them costs nothing, and then the latest one covers all images freed so far.
+    glx_context_fence_client_wait(&page->fence);
+    page->fence = *fence;
+    *fence = NULL;
+
+    page->image_count --;
+    if (0 == page->image_count) {
+        page->shelf_count = 0;
+        page->shelves_bottom = 0;
+        page->needs_clear = 1;
+    }
+    pthread_mutex_unlock(&atlas->lock);
+    region->page = NULL;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright 2013  Rinat Ibragimov
+ *
+ * This file is part of libvdpau-va-gl
+ *
+ * libvdpau-va-gl is distributed under the terms of the LGPLv3. See COPYING for details.
+ */
+
+#ifndef __GL_ATLAS_H
+#define __GL_ATLAS_H
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <stdint.h>
+
+#define GL_ATLAS_PAGE_SIZE          1024    ///< width and height of atlas textures
+#define GL_ATLAS_MAX_IMAGE_SIZE     128     ///< larger images don't go to atlas
+
+typedef struct GLAtlas GLAtlas;
+typedef struct GLAtlasPage GLAtlasPage;
+
+/** @brief part of atlas page given to a single image */
+typedef struct {
+    GLAtlasPage    *page;
+    GLuint          tex_id;     ///< page texture
+    uint32_t        x;          ///< top left corner of the image on the page
+    uint32_t        y;
+} GLAtlasRegion;
+
+GLAtlas    *gl_atlas_create(GLenum internal_format, GLenum format, GLenum type,
+                            unsigned int bytes_per_pixel, int red_as_alpha);
+void        gl_atlas_destroy(GLAtlas *atlas);
+int         gl_atlas_alloc(GLAtlas *atlas, uint32_t width, uint32_t height,
+                           GLAtlasRegion *region);
+void        gl_atlas_free(GLAtlas *atlas, GLAtlasRegion *region, GLsync *fence);
+
+#endif /* __GL_ATLAS_H */
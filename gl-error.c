@@ -0,0 +1,99 @@
+/*
+ * Copyright 2013  Rinat Ibragimov
+ *
+ * This file is part of libvdpau-va-gl
+ *
+ * libvdpau-va-gl is distributed under the terms of the LGPLv3. See COPYING for details.
+ */
+
+/*
+ *  Deferred GL error checking. glGetError makes many drivers synchronize with their command
+ *  stream, so instead errors are collected by GL_KHR_debug callback. Each checkpoint inserts
+ *  a marker with VdpFuncId of the calling function into the same message stream, and errors
+ *  received before a marker are reported as belonging to that function. Errors can't change
+ *  return value of the call then, they are only logged.
+ *
+ *  SyncGLErrors quirk, or lack of the extension, brings back synchronous glGetError.
+ */
+
+#define GL_GLEXT_PROTOTYPES
+#include "gl-error.h"
+#include <GL/glext.h>
+#include <stddef.h>
+#include <string.h>
+#include "globals.h"
+#include "reverse-constant.h"
+#include "vdpau-trace.h"
+
+static __thread GLErrorLog *current_log = NULL;
+
+static
+void APIENTRY
+debug_callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length,
+               const GLchar *message, const void *user_param)
+{
+    GLErrorLog *log = (GLErrorLog *)user_param;
+    (void)severity; (void)length;
+
+    if (GL_DEBUG_TYPE_ERROR == type) {
+        if (0 == log->pending_count ++) {
+            strncpy(log->first_message, message, sizeof(log->first_message) - 1);
+            log->first_message[sizeof(log->first_message) - 1] = 0;
+        }
+    } else if (GL_DEBUG_TYPE_MARKER == type && GL_DEBUG_SOURCE_APPLICATION == source) {
+        if (log->pending_count > 0) {
+            traceError("error (%s): %d GL error(s), first one: %s\n",
+                       reverse_func_id(id), log->pending_count, log->first_message);
+            log->pending_count = 0;
+        }
+    }
+}
+
+void
+gl_error_reset(GLErrorLog *log)
+{
+    log->installed = 0;
+    log->pending_count = 0;
+}
+
+/** @brief makes log the one of context that is now current. NULL switches to glGetError
+
+    Debug callback is installed on first use of the log.
+*/
+void
+gl_error_set_current(GLErrorLog *log)
+{
+    current_log = log;
+    if (NULL == log || log->installed)
+        return;
+
+    if (!global.gl_caps.khr_debug || global.quirks.sync_gl_errors) {
+        current_log = NULL;
+        return;
+    }
+
+    // only errors and own markers are of interest
+    glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_FALSE);
+    glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_ERROR, GL_DONT_CARE, 0, NULL, GL_TRUE);
+    glDebugMessageControl(GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_TYPE_MARKER, GL_DONT_CARE, 0,
+                          NULL, GL_TRUE);
+    glDebugMessageCallback(debug_callback, log);
+    glEnable(GL_DEBUG_OUTPUT);
+    log->installed = 1;
+}
+
+/** @brief checks for errors of GL commands issued by func_id
+
+    @return GL error code, if checked synchronously. With deferred checking always GL_NO_ERROR,
+        errors are logged later.
+*/
+GLenum
+gl_error_check(VdpFuncId func_id)
+{
+    if (NULL == current_log)
+        return glGetError();
+
+    glDebugMessageInsert(GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_TYPE_MARKER, func_id,
+                         GL_DEBUG_SEVERITY_NOTIFICATION, 0, "");
+    return GL_NO_ERROR;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright 2013  Rinat Ibragimov
+ *
+ * This file is part of libvdpau-va-gl
+ *
+ * libvdpau-va-gl is distributed under the terms of the LGPLv3. See COPYING for details.
+ */
+
+#ifndef __GL_ERROR_H
+#define __GL_ERROR_H
+
+#include <GL/gl.h>
+#include <vdpau/vdpau.h>
+
+/** @brief errors GL context reported through debug output, not yet attributed to a function
+
+    Every GL context driver owns has one. Filled by debug callback, possibly on driver's thread.
+*/
+typedef struct {
+    int         installed;          ///< debug callback is installed in the context
+    int         pending_count;      ///< errors since last marker
+    char        first_message[160]; ///< message of the first of them
+} GLErrorLog;
+
+void    gl_error_reset(GLErrorLog *log);
+void    gl_error_set_current(GLErrorLog *log);
+GLenum  gl_error_check(VdpFuncId func_id);
+
+#endif /* __GL_ERROR_H */
@@ -0,0 +1,171 @@
+/*
+ * Copyright 2013  Rinat Ibragimov
+ *
+ * This file is part of libvdpau-va-gl
+ *
+ * libvdpau-va-gl is distributed under the terms of the LGPLv3. See COPYING for details.
+ */
+
+/*
+ *  Pool of released textures along with framebuffer objects they are attached to. Creating
+ *  complete framebuffer costs texture storage allocation and completeness check, while
+ *  applications tend to destroy and create surfaces of the same size over and over again,
+ *  on window resize or OSD change.
+ *
+ *  Entries are matched by internal format and size. They are kept in order of release,
+ *  the oldest ones are deleted first when either count or memory limit is exceeded.
+ */
+
+#define GL_GLEXT_PROTOTYPES
+#include "gl-fbo-pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ctx-stack.h"
+#include "gl-state.h"
+
+typedef struct {
+    GLenum      internal_format;
+    uint32_t    width;
+    uint32_t    height;
+    size_t      bytes;
+    GLuint      tex_id;
+    GLuint      fbo_id;
+    GLsync      fence;          ///< placed after the last access before release
+} GLFboPoolEntry;
+
+struct GLFboPool {
+    pthread_mutex_t lock;
+    int             max_count;
+    size_t          max_bytes;
+    size_t          bytes;          ///< total size of kept textures
+    int             count;
+    GLFboPoolEntry *entries;        ///< oldest first
+};
+
+/** @brief creates pool keeping up to max_count entries, taking no more than max_bytes */
+GLFboPool *
+gl_fbo_pool_create(int max_count, size_t max_bytes)
+{
+    GLFboPool *pool = calloc(1, sizeof(GLFboPool));
+    if (NULL == pool)
+        return NULL;
+    pool->entries = calloc(max_count > 0 ? max_count : 1, sizeof(GLFboPoolEntry));
+    if (NULL == pool->entries) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->max_count = max_count;
+    pool->max_bytes = max_bytes;
+    pool->bytes = 0;
+    pool->count = 0;
+    return pool;
+}
+
+static
+void
+delete_objects(GLuint tex_id, GLuint fbo_id, GLsync *fence)
+{
+    gl_state_delete_texture(tex_id);
+    gl_state_delete_framebuffer(fbo_id);
+    glx_context_fence_release(fence);
+}
+
+/** @brief removes entry from the pool, without deleting its objects. Pool must be locked */
+static
+void
+remove_entry(GLFboPool *pool, int idx)
+{
+    pool->bytes -= pool->entries[idx].bytes;
+    pool->count --;
+    memmove(&pool->entries[idx], &pool->entries[idx + 1],
+            (pool->count - idx) * sizeof(GLFboPoolEntry));
+}
+
+/** @brief frees pool and all objects in it. Must be called with GL context pushed */
+void
+gl_fbo_pool_destroy(GLFboPool *pool)
+{
+    if (NULL == pool)
+        return;
+    for (int k = 0; k < pool->count; k ++) {
+        GLFboPoolEntry *entry = &pool->entries[k];
+        delete_objects(entry->tex_id, entry->fbo_id, &entry->fence);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->entries);
+    free(pool);
+}
+
+/** @brief takes texture and framebuffer of given format and size out of the pool
+
+    Texture contents are undefined.
+
+    @param fence    [out] fence to wait for before the first access, may be NULL
+    @return 1 on success, 0 if there is no matching entry
+*/
+int
+gl_fbo_pool_take(GLFboPool *pool, GLenum internal_format, uint32_t width, uint32_t height,
+                 GLuint *tex_id, GLuint *fbo_id, GLsync *fence)
+{
+    if (NULL == pool)
+        return 0;
+
+    pthread_mutex_lock(&pool->lock);
+    // latest released entries are the most likely to be already idle
+    for (int k = pool->count - 1; k >= 0; k --) {
+        GLFboPoolEntry *entry = &pool->entries[k];
+        if (entry->internal_format != internal_format || entry->width != width ||
+            entry->height != height)
+        {
+            continue;
+        }
+        *tex_id = entry->tex_id;
+        *fbo_id = entry->fbo_id;
+        *fence = entry->fence;
+        remove_entry(pool, k);
+        pthread_mutex_unlock(&pool->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/** @brief returns texture and framebuffer to the pool. Must be called with GL context pushed
+
+    Objects are deleted if they don't fit. Otherwise the oldest entries are deleted to make room.
+
+    @param bytes    memory texture takes
+    @param fence    fence placed after the last access. Pool takes it over.
+*/
+void
+gl_fbo_pool_put(GLFboPool *pool, GLenum internal_format, uint32_t width, uint32_t height,
+                size_t bytes, GLuint tex_id, GLuint fbo_id, GLsync *fence)
+{
+    if (NULL == pool || pool->max_count <= 0 || bytes > pool->max_bytes) {
+        delete_objects(tex_id, fbo_id, fence);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->count > 0 &&
+           (pool->count == pool->max_count || pool->bytes + bytes > pool->max_bytes))
+    {
+        GLFboPoolEntry *oldest = &pool->entries[0];
+        delete_objects(oldest->tex_id, oldest->fbo_id, &oldest->fence);
+        remove_entry(pool, 0);
+    }
+
+    GLFboPoolEntry *entry = &pool->entries[pool->count ++];
+    entry->internal_format = internal_format;
+    entry->width = width;
+    entry->height = height;
+    entry->bytes = bytes;
+    entry->tex_id = tex_id;
+    entry->fbo_id = fbo_id;
+    entry->fence = *fence;
+    *fence = NULL;
+    pool->bytes += bytes;
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright 2013  Rinat Ibragimov
+ *
+ * This file is part of libvdpau-va-gl
+ *
+ * libvdpau-va-gl is distributed under the terms of the LGPLv3. See COPYING for details.
+ */
+
+#ifndef __GL_FBO_POOL_H
+#define __GL_FBO_POOL_H
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct GLFboPool GLFboPool;
+
+GLFboPool  *gl_fbo_pool_create(int max_count, size_t max_bytes);
+void        gl_fbo_pool_destroy(GLFboPool *pool);
+int         gl_fbo_pool_take(GLFboPool *pool, GLenum internal_format, uint32_t width,
+                             uint32_t height, GLuint *tex_id, GLuint *fbo_id, GLsync *fence);
+void        gl_fbo_pool_put(GLFboPool *pool, GLenum internal_format, uint32_t width,
+                            uint32_t height, size_t bytes, GLuint tex_id, GLuint fbo_id,
+                            GLsync *fence);
+
+#endif /* __GL_FBO_POOL_H */
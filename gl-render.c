@@ -0,0 +1,304 @@
+/*
+ * Copyright 2013  Rinat Ibragimov
+ *
+ * This file is part of libvdpau-va-gl
+ *
+ * libvdpau-va-gl is distributed under the terms of the LGPLv3. See COPYING for details.
+ */
+
+/*
+ *  Quad renderer. All drawing is done with two tiny programs, one for textured quads, and
+ *  one for solid color ones, fed from a streaming vertex buffer. Nothing from fixed-function
+ *  pipeline is used, so the same code works in core profile contexts as well.
+ *
+ *  Programs are shared between contexts and are created once. Uniforms are per program, not
+ *  per context, so there are none besides sampler which stays at default unit 0. Positions
+ *  and texture coordinates are converted to normalized ones on CPU side instead.
+ *
+ *  Vertex array objects are not shared, so each context gets its own, along with a vertex
+ *  buffer. They are kept in GL state cache of the context.
+ */
+
+#define GL_GLEXT_PROTOTYPES
+#include "gl-render.h"
+#include <GL/glext.h>
+#include <pthread.h>
+#include <stddef.h>
+#include "gl-state.h"
+#include "vdpau-trace.h"
+
+enum {
+    ATTRIB_POSITION = 0,
+    ATTRIB_TEXCOORD = 1,
+    ATTRIB_COLOR = 2,
+};
+
+enum {
+    PROGRAM_SOLID = 0,
+    PROGRAM_TEXTURED = 1,
+    PROGRAM_COUNT
+};
+
+static const char *vertex_shader_source =
+    "#version 130\n"
+    "in vec2 position;\n"
+    "in vec2 texcoord;\n"
+    "in vec4 color;\n"
+    "out vec2 v_texcoord;\n"
+    "out vec4 v_color;\n"
+    "void main() {\n"
+    "    gl_Position = vec4(position, 0.0, 1.0);\n"
+    "    v_texcoord = texcoord;\n"
+    "    v_color = color;\n"
+    "}\n";
+
+static const char *fragment_shader_source[PROGRAM_COUNT] = {
+    [PROGRAM_SOLID] =
+        "#version 130\n"
+        "in vec2 v_texcoord;\n"
+        "in vec4 v_color;\n"
+        "out vec4 frag_color;\n"
+        "void main() {\n"
+        "    frag_color = v_color;\n"
+        "}\n",
+    [PROGRAM_TEXTURED] =
+        "#version 130\n"
+        "uniform sampler2D tex;\n"
+        "in vec2 v_texcoord;\n"
+        "in vec4 v_color;\n"
+        "out vec4 frag_color;\n"
+        "void main() {\n"
+        "    frag_color = texture(tex, v_texcoord) * v_color;\n"
+        "}\n",
+};
+
+static pthread_mutex_t  program_lock = PTHREAD_MUTEX_INITIALIZER;
+static int              programs_created = 0;
+static GLuint           programs[PROGRAM_COUNT];
+
+/** @brief what is being drawn by the calling thread, set by gl_render_set_*() */
+static __thread struct {
+    float       target_width;
+    float       target_height;
+    int         target_flip;
+    GLuint      texture;            ///< 0 for solid color quads
+    float       texture_width;
+    float       texture_height;
+} render;
+
+static
+GLuint
+compile_shader(GLenum type, const char *source)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+
+    GLint status;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (GL_TRUE != status) {
+        char log[512];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        traceError("error (%s): can't compile shader: %s\n", __func__, log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+static
+GLuint
+link_program(GLuint vertex_shader, GLuint fragment_shader)
+{
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertex_shader);
+    glAttachShader(program, fragment_shader);
+    glBindAttribLocation(program, ATTRIB_POSITION, "position");
+    glBindAttribLocation(program, ATTRIB_TEXCOORD, "texcoord");
+    glBindAttribLocation(program, ATTRIB_COLOR, "color");
+    glBindFragDataLocation(program, 0, "frag_color");
+    glLinkProgram(program);
+    // linked program doesn't need its shaders anymore
+    glDetachShader(program, vertex_shader);
+    glDetachShader(program, fragment_shader);
+
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (GL_TRUE != status) {
+        char log[512];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        traceError("error (%s): can't link program: %s\n", __func__, log);
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+/** @brief creates shared programs if they aren't yet. Must be called with GL context pushed
+
+    On failure program names are left zero. Devices are not created then, see gl_render_init().
+*/
+static
+void
+create_programs(void)
+{
+    if (__atomic_load_n(&programs_created, __ATOMIC_ACQUIRE))
+        return;
+
+    pthread_mutex_lock(&program_lock);
+    if (programs_created)
+        goto quit;
+
+    GLuint vertex_shader = compile_shader(GL_VERTEX_SHADER, vertex_shader_source);
+    for (int k = 0; k < PROGRAM_COUNT; k ++) {
+        programs[k] = 0;
+        if (0 == vertex_shader)
+            continue;
+        GLuint fragment_shader = compile_shader(GL_FRAGMENT_SHADER, fragment_shader_source[k]);
+        if (0 == fragment_shader)
+            continue;
+        programs[k] = link_program(vertex_shader, fragment_shader);
+        glDeleteShader(fragment_shader);
+    }
+    if (vertex_shader)
+        glDeleteShader(vertex_shader);
+
+    // programs are used from other contexts, their creation must be complete there
+    glFlush();
+    __atomic_store_n(&programs_created, 1, __ATOMIC_RELEASE);
+quit:
+    pthread_mutex_unlock(&program_lock);
+}
+
+/** @brief creates vertex array and buffer of the current context if they aren't yet */
+static
+void
+create_context_objects(GLState *st)
+{
+    if (st->render_vao)
+        return;
+
+    glGenVertexArrays(1, &st->render_vao);
+    glGenBuffers(1, &st->render_vbo);
+    gl_state_bind_vertex_array(st->render_vao);
+    gl_state_bind_array_buffer(st->render_vbo);
+
+    const GLsizei stride = sizeof(GLRenderVertex);
+    glVertexAttribPointer(ATTRIB_POSITION, 2, GL_FLOAT, GL_FALSE, stride,
+                          (const void *)offsetof(GLRenderVertex, x));
+    glVertexAttribPointer(ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, stride,
+                          (const void *)offsetof(GLRenderVertex, s));
+    glVertexAttribPointer(ATTRIB_COLOR, 4, GL_FLOAT, GL_FALSE, stride,
+                          (const void *)offsetof(GLRenderVertex, r));
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glEnableVertexAttribArray(ATTRIB_TEXCOORD);
+    glEnableVertexAttribArray(ATTRIB_COLOR);
+}
+
+/** @brief directs following quads to currently bound width x height framebuffer
+
+    Positions are in pixels, with origin in the top left corner if flip is set, and in the
+    bottom left one otherwise.
+*/
+void
+gl_render_set_target(uint32_t width, uint32_t height, int flip)
+{
+    render.target_width = width;
+    render.target_height = height;
+    render.target_flip = flip;
+    gl_state_viewport(width, height);
+}
+
+/** @brief makes following quads sample width x height texture. Zero tex means solid color */
+void
+gl_render_set_texture(GLuint tex, uint32_t width, uint32_t height)
+{
+    render.texture = tex;
+    render.texture_width = width;
+    render.texture_height = height;
+    if (tex)
+        gl_state_bind_texture(tex);
+}
+
+/** @brief creates shared programs. Must be called with GL context pushed
+
+    @return 1 if programs are ready, 0 if they can't be built, and nothing could be drawn
+*/
+int
+gl_render_init(void)
+{
+    create_programs();
+    for (int k = 0; k < PROGRAM_COUNT; k ++) {
+        if (0 == programs[k])
+            return 0;
+    }
+    return 1;
+}
+
+/** @brief draws count quads with current target, texture, and blending state, in one call
+
+    Corners of each quad go around it, and are drawn as two triangles, (0, 1, 2) and (0, 2, 3).
+*/
+void
+gl_render_quads(const GLRenderVertex *corners, int count)
+{
+    GLState *state = gl_state_current();
+    if (NULL == state || count <= 0)
+        return;
+
+    create_programs();
+    const GLuint program = programs[render.texture ? PROGRAM_TEXTURED : PROGRAM_SOLID];
+    if (0 == program)
+        return;
+
+    create_context_objects(state);
+    gl_state_use_program(program);
+    gl_state_bind_vertex_array(state->render_vao);
+    gl_state_bind_array_buffer(state->render_vbo);
+
+    // orphan previous contents, so draw doesn't wait for previous one to finish
+    const GLsizeiptr size = (GLsizeiptr)count * 6 * sizeof(GLRenderVertex);
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+    GLRenderVertex *dst = glMapBufferRange(GL_ARRAY_BUFFER, 0, size,
+                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (NULL == dst)
+        return;
+
+    static const int order[6] = { 0, 1, 2, 0, 2, 3 };
+    const float sx = 2.0f / render.target_width;
+    const float sy = (render.target_flip ? -2.0f : 2.0f) / render.target_height;
+    const float ty = render.target_flip ? 1.0f : -1.0f;
+    const float scale_s = render.texture ? 1.0f / render.texture_width : 0.0f;
+    const float scale_t = render.texture ? 1.0f / render.texture_height : 0.0f;
+
+    for (int q = 0; q < count; q ++) {
+        for (int k = 0; k < 6; k ++) {
+            // mapping may be write-combined memory, so vertex is built aside and stored whole
+            GLRenderVertex v = corners[q * 4 + order[k]];
+            v.x = v.x * sx - 1.0f;
+            v.y = v.y * sy + ty;
+            v.s *= scale_s;
+            v.t *= scale_t;
+            dst[q * 6 + k] = v;
+        }
+    }
+
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glDrawArrays(GL_TRIANGLES, 0, count * 6);
+}
+
+/** @brief draws single quad, see gl_render_quads() */
+void
+gl_render_quad(const GLRenderVertex corners[4])
+{
+    gl_render_quads(corners, 1);
+}
+
+/** @brief drops program names. Called after all GL contexts were destroyed along with them */
+void
+gl_render_forget(void)
+{
+    pthread_mutex_lock(&program_lock);
+    programs_created = 0;
+    pthread_mutex_unlock(&program_lock);
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright 2013  Rinat Ibragimov
+ *
+ * This file is part of libvdpau-va-gl
+ *
+ * libvdpau-va-gl is distributed under the terms of the LGPLv3. See COPYING for details.
+ */
+
+#ifndef __GL_RENDER_H
+#define __GL_RENDER_H
+
+#include <GL/gl.h>
+#include <stdint.h>
+
+/** @brief quad corner as passed to gl_render_quad() */
+typedef struct {
+    float   x, y;           ///< position, in target pixels
+    float   s, t;           ///< texture coordinates, in texels
+    float   r, g, b, a;     ///< color, multiplied with texture sample
+} GLRenderVertex;
+
+int     gl_render_init(void);
+void    gl_render_set_target(uint32_t width, uint32_t height, int flip);
+void    gl_render_set_texture(GLuint tex, uint32_t width, uint32_t height);
+void    gl_render_quad(const GLRenderVertex corners[4]);
+void    gl_render_quads(const GLRenderVertex *corners, int count);
+void    gl_render_forget(void);
+
+#endif /* __GL_RENDER_H */
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2013  Rinat Ibragimov
+ *
+ * This file is part of libvdpau-va-gl
+ *
+ * libvdpau-va-gl is distributed under the terms of the LGPLv3. See COPYING for details.
+ */
+
+/*
+ *  GL state cache. Rendering paths set up the same state over and over, mostly for the
+ *  same destination surface. Changes are compared against shadow copy of the current
+ *  context state, and only real ones are passed to GL.
+ */
+
+#define GL_GLEXT_PROTOTYPES
+#include "gl-state.h"
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <stddef.h>
+
+static __thread GLState *current_state = NULL;
+
+// Texture names are shared between contexts. After deletion the name may be reused for
+// a new object, while other contexts still have the old one bound. Framebuffer objects are
+// containers and are not shared, but they hold attached textures, and their names are freed
+// by the same deletions. Each deletion bumps the counter, and all contexts forget their
+// bindings when they see it changed.
+static int object_epoch = 0;
+
+void
+gl_state_reset(GLState *st)
+{
+    // state belongs to a fresh context now, objects of the previous one are not visible there
+    st->valid = 0;
+    st->render_vao = 0;
+    st->render_vbo = 0;
+}
+
+/** @brief makes st shadow of state of the context that is now current. NULL disables cache
+
+    Other contexts may have changed shared textures since the last call. Changes become
+    visible only after the texture, or framebuffer it is attached to, is bound again. So both
+    bindings are forgotten here, and the first bind of each call goes to GL. Binds are still
+    elided within a call.
+*/
+void
+gl_state_set_current(GLState *st)
+{
+    current_state = st;
+    if (st) {
+        st->framebuffer = (GLuint)-1;
+        st->texture = (GLuint)-1;
+    }
+}
+
+/** @brief forgets everything about current context state
+
+    Used after calls into libraries which could change state behind our back.
+*/
+void
+gl_state_invalidate(void)
+{
+    if (current_state)
+        current_state->valid = 0;
+}
+
+/** @brief returns current context to default bindings before control goes to foreign GL code
+
+    Libraries like libva draw with fixed-function pipeline and immediate mode, and would go
+    through our program, vertex array and framebuffer if they were left bound. Cache is
+    invalidated too, as such code may change state as it likes.
+*/
+void
+gl_state_unbind_for_foreign_code(void)
+{
+    glUseProgram(0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDisable(GL_BLEND);
+    gl_state_invalidate();
+}
+
+/** @brief returns shadow state of the current context, or NULL if there is none */
+GLState *
+gl_state_current(void)
+{
+    return current_state;
+}
+
+/** @brief returns shadow state which fields can be compared with, or NULL if cache is off */
+static
+GLState *
+get_state(void)
+{
+    GLState *st = current_state;
+    if (NULL == st)
+        return NULL;
+
+    if (!st->valid) {
+        // mark everything unknown. Values that are never set by GL are used for that
+        st->valid = 1;
+        st->epoch = __atomic_load_n(&object_epoch, __ATOMIC_ACQUIRE);
+        st->framebuffer = (GLuint)-1;
+        st->texture = (GLuint)-1;
+        st->blend = -1;
+        st->blend_src_rgb = GL_INVALID_ENUM;
+        st->blend_eq_rgb = GL_INVALID_ENUM;
+        st->program = (GLuint)-1;
+        st->vertex_array = (GLuint)-1;
+        st->array_buffer = (GLuint)-1;
+        st->viewport_width = 0;
+        return st;
+    }
+
+    const int epoch = __atomic_load_n(&object_epoch, __ATOMIC_ACQUIRE);
+    if (st->epoch != epoch) {
+        st->epoch = epoch;
+        st->framebuffer = (GLuint)-1;
+        st->texture = (GLuint)-1;
+    }
+    return st;
+}
+
+void
+gl_state_bind_framebuffer(GLuint fbo)
+{
+    GLState *st = get_state();
+    if (st && st->framebuffer == fbo)
+        return;
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    if (st)
+        st->framebuffer = fbo;
+}
+
+void
+gl_state_bind_texture(GLuint tex)
+{
+    GLState *st = get_state();
+    if (st && st->texture == tex)
+        return;
+    glBindTexture(GL_TEXTURE_2D, tex);
+    if (st)
+        st->texture = tex;
+}
+
+void
+gl_state_delete_texture(GLuint tex)
+{
+    glDeleteTextures(1, &tex);
+    __atomic_add_fetch(&object_epoch, 1, __ATOMIC_RELEASE);
+    // deletion unbinds texture from current context
+    GLState *st = get_state();
+    if (st && st->texture == tex)
+        st->texture = 0;
+}
+
+void
+gl_state_delete_framebuffer(GLuint fbo)
+{
+    glDeleteFramebuffers(1, &fbo);
+    __atomic_add_fetch(&object_epoch, 1, __ATOMIC_RELEASE);
+    GLState *st = get_state();
+    if (st && st->framebuffer == fbo)
+        st->framebuffer = 0;
+}
+
+void
+gl_state_enable_blend(int enable)
+{
+    GLState *st = get_state();
+    if (st && st->blend == enable)
+        return;
+    if (enable)
+        glEnable(GL_BLEND);
+    else
+        glDisable(GL_BLEND);
+    if (st)
+        st->blend = enable;
+}
+
+void
+gl_state_blend_func(GLenum src_rgb, GLenum dst_rgb, GLenum src_alpha, GLenum dst_alpha)
+{
+    GLState *st = get_state();
+    if (st && st->blend_src_rgb == src_rgb && st->blend_dst_rgb == dst_rgb &&
+        st->blend_src_alpha == src_alpha && st->blend_dst_alpha == dst_alpha)
+    {
+        return;
+    }
+    glBlendFuncSeparate(src_rgb, dst_rgb, src_alpha, dst_alpha);
+    if (st) {
+        st->blend_src_rgb = src_rgb;
+        st->blend_dst_rgb = dst_rgb;
+        st->blend_src_alpha = src_alpha;
+        st->blend_dst_alpha = dst_alpha;
+    }
+}
+
+void
+gl_state_blend_equation(GLenum eq_rgb, GLenum eq_alpha)
+{
+    GLState *st = get_state();
+    if (st && st->blend_eq_rgb == eq_rgb && st->blend_eq_alpha == eq_alpha)
+        return;
+    glBlendEquationSeparate(eq_rgb, eq_alpha);
+    if (st) {
+        st->blend_eq_rgb = eq_rgb;
+        st->blend_eq_alpha = eq_alpha;
+    }
+}
+
+void
+gl_state_use_program(GLuint program)
+{
+    GLState *st = get_state();
+    if (st && st->program == program)
+        return;
+    glUseProgram(program);
+    if (st)
+        st->program = program;
+}
+
+void
+gl_state_bind_vertex_array(GLuint vao)
+{
+    GLState *st = get_state();
+    if (st && st->vertex_array == vao)
+        return;
+    glBindVertexArray(vao);
+    if (st)
+        st->vertex_array = vao;
+}
+
+void
+gl_state_bind_array_buffer(GLuint buffer)
+{
+    GLState *st = get_state();
+    if (st && st->array_buffer == buffer)
+        return;
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    if (st)
+        st->array_buffer = buffer;
+}
+
+/** @brief sets viewport to cover whole width x height target */
+void
+gl_state_viewport(uint32_t width, uint32_t height)
+{
+    GLState *st = get_state();
+    if (st && st->viewport_width == width && st->viewport_height == height)
+        return;
+    glViewport(0, 0, width, height);
+    if (st) {
+        st->viewport_width = width;
+        st->viewport_height = height;
+    }
+}
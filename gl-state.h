@@ -0,0 +1,61 @@
+/*
+ * Copyright 2013  Rinat Ibragimov
+ *
+ * This file is part of libvdpau-va-gl
+ *
+ * libvdpau-va-gl is distributed under the terms of the LGPLv3. See COPYING for details.
+ */
+
+#ifndef __GL_STATE_H
+#define __GL_STATE_H
+
+#include <GL/gl.h>
+#include <stdint.h>
+
+/** @brief shadow copy of GL context state driver changes on its drawing paths
+
+    Every GL context driver owns has one. Fields are valid only while .valid is set,
+    otherwise actual state is unknown and next change is always passed to GL.
+*/
+typedef struct {
+    int         valid;
+    int         epoch;              ///< value of object deletion counter bindings are valid for
+    GLuint      framebuffer;        ///< GL_FRAMEBUFFER binding
+    GLuint      texture;            ///< GL_TEXTURE_2D binding
+    int         blend;              ///< GL_BLEND enable bit
+    GLenum      blend_src_rgb;
+    GLenum      blend_dst_rgb;
+    GLenum      blend_src_alpha;
+    GLenum      blend_dst_alpha;
+    GLenum      blend_eq_rgb;
+    GLenum      blend_eq_alpha;
+    GLuint      program;            ///< current program object
+    GLuint      vertex_array;       ///< vertex array object binding
+    GLuint      array_buffer;       ///< GL_ARRAY_BUFFER binding
+    uint32_t    viewport_width;
+    uint32_t    viewport_height;
+
+    // objects below are owned by the context itself, they survive invalidation
+    GLuint      render_vao;         ///< vertex array set up by gl-render, 0 if not created yet
+    GLuint      render_vbo;         ///< its streaming vertex buffer
+} GLState;
+
+void    gl_state_reset(GLState *st);
+void    gl_state_set_current(GLState *st);
+void    gl_state_invalidate(void);
+void    gl_state_unbind_for_foreign_code(void);
+GLState *gl_state_current(void);
+
+void    gl_state_bind_framebuffer(GLuint fbo);
+void    gl_state_bind_texture(GLuint tex);
+void    gl_state_delete_texture(GLuint tex);
+void    gl_state_delete_framebuffer(GLuint fbo);
+void    gl_state_enable_blend(int enable);
+void    gl_state_blend_func(GLenum src_rgb, GLenum dst_rgb, GLenum src_alpha, GLenum dst_alpha);
+void    gl_state_blend_equation(GLenum eq_rgb, GLenum eq_alpha);
+void    gl_state_use_program(GLuint program);
+void    gl_state_bind_vertex_array(GLuint vao);
+void    gl_state_bind_array_buffer(GLuint buffer);
+void    gl_state_viewport(uint32_t width, uint32_t height);
+
+#endif /* __GL_STATE_H */
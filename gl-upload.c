@@ -0,0 +1,160 @@
+/*
+ * Copyright 2013  Rinat Ibragimov
+ *
+ * This file is part of libvdpau-va-gl
+ *
+ * libvdpau-va-gl is distributed under the terms of the LGPLv3. See COPYING for details.
+ */
+
+/*
+ *  Streaming texture uploads. Client data is copied into pixel unpack buffer, and texture is
+ *  updated from there. glTexSubImage2D then returns immediately, and GPU transfer of one frame
+ *  overlaps with CPU copy of the next one.
+ *
+ *  Buffers are taken from a small ring shared by all contexts. Slot is locked from map till
+ *  texture update is issued, as buffer can't be mapped in two contexts at once. Storage is
+ *  orphaned on each map, so no wait for previous transfer from the same buffer is needed.
+ */
+
+#define GL_GLEXT_PROTOTYPES
+#include "gl-upload.h"
+#include <GL/glext.h>
+#include <pthread.h>
+#include <string.h>
+#include "globals.h"
+
+#define UPLOAD_RING_SIZE    4
+
+struct GLUploadSlot {
+    pthread_mutex_t lock;
+    GLuint          pbo;        ///< buffer name, 0 if not created yet
+};
+
+static GLUploadSlot ring[UPLOAD_RING_SIZE] = {
+    { PTHREAD_MUTEX_INITIALIZER, 0 },
+    { PTHREAD_MUTEX_INITIALIZER, 0 },
+    { PTHREAD_MUTEX_INITIALIZER, 0 },
+    { PTHREAD_MUTEX_INITIALIZER, 0 },
+};
+static unsigned int next_slot = 0;
+
+/** @brief locks free ring slot, or waits for the next one in order if all are busy */
+static
+GLUploadSlot *
+acquire_slot(void)
+{
+    const unsigned int start = __atomic_fetch_add(&next_slot, 1, __ATOMIC_RELAXED);
+    for (unsigned int k = 0; k < UPLOAD_RING_SIZE; k ++) {
+        GLUploadSlot *slot = &ring[(start + k) % UPLOAD_RING_SIZE];
+        if (0 == pthread_mutex_trylock(&slot->lock))
+            return slot;
+    }
+    GLUploadSlot *slot = &ring[start % UPLOAD_RING_SIZE];
+    pthread_mutex_lock(&slot->lock);
+    return slot;
+}
+
+/** @brief maps size bytes of upload buffer for writing. Must be called with GL context pushed
+
+    On success buffer is left bound to GL_PIXEL_UNPACK_BUFFER, and gl_upload_unmap_to_texture()
+    must follow. Mapping is aligned at least to 64 bytes (GL_MIN_MAP_BUFFER_ALIGNMENT).
+
+    @return pointer to write data to, or NULL if streaming is unavailable. Caller then
+        should upload from client memory.
+*/
+void *
+gl_upload_map(size_t size, GLUploadSlot **slot)
+{
+    if (!global.gl_caps.arb_pixel_buffer_object)
+        return NULL;
+
+    GLUploadSlot *s = acquire_slot();
+    if (0 == s->pbo)
+        glGenBuffers(1, &s->pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s->pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    void *ptr = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    if (NULL == ptr) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        pthread_mutex_unlock(&s->lock);
+        return NULL;
+    }
+    *slot = s;
+    return ptr;
+}
+
+/** @brief updates rectangle of texture bound to GL_TEXTURE_2D from mapped upload buffer
+
+    Data is expected at the very beginning of the buffer.
+    @param row_length   row length in pixels, 0 for tightly packed rows
+    @param alignment    row alignment, as for GL_UNPACK_ALIGNMENT
+*/
+void
+gl_upload_unmap_to_texture(GLUploadSlot *slot, GLint x, GLint y, GLsizei width, GLsizei height,
+                           GLenum format, GLenum type, uint32_t row_length, int alignment)
+{
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    if (row_length)
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length);
+    if (4 != alignment)
+        glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, format, type, NULL);
+    if (row_length)
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    if (4 != alignment)
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    pthread_mutex_unlock(&slot->lock);
+}
+
+/** @brief unmaps upload buffer without updating anything */
+void
+gl_upload_cancel(GLUploadSlot *slot)
+{
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    pthread_mutex_unlock(&slot->lock);
+}
+
+/** @brief updates rectangle of texture bound to GL_TEXTURE_2D from client memory
+
+    Client data is copied to upload buffer, so caller may reuse it right after return.
+    @param pitch    distance between rows of source data, in bytes
+*/
+void
+gl_upload_tex_sub_image(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format,
+                        GLenum type, const void *data, uint32_t pitch,
+                        unsigned int bytes_per_pixel)
+{
+    const size_t bytes_in_line = width * bytes_per_pixel;
+    GLUploadSlot *slot;
+    uint8_t *dst = gl_upload_map(bytes_in_line * height, &slot);
+    if (NULL == dst) {
+        // no buffers, upload directly from client memory
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch / bytes_per_pixel);
+        if (4 != bytes_per_pixel)
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, format, type, data);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        if (4 != bytes_per_pixel)
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        return;
+    }
+
+    if (pitch == bytes_in_line) {
+        memcpy(dst, data, bytes_in_line * height);
+    } else {
+        for (GLsizei k = 0; k < height; k ++)
+            memcpy(dst + k * bytes_in_line, (const uint8_t *)data + k * pitch, bytes_in_line);
+    }
+    gl_upload_unmap_to_texture(slot, x, y, width, height, format, type, 0,
+                               (4 == bytes_per_pixel) ? 4 : 1);
+}
+
+/** @brief drops buffer names. Called after all GL contexts were destroyed along with buffers */
+void
+gl_upload_forget(void)
+{
+    for (int k = 0; k < UPLOAD_RING_SIZE; k ++)
+        ring[k].pbo = 0;
+}
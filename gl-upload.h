@@ -0,0 +1,28 @@
+/*
+ * Copyright 2013  Rinat Ibragimov
+ *
+ * This file is part of libvdpau-va-gl
+ *
+ * libvdpau-va-gl is distributed under the terms of the LGPLv3. See COPYING for details.
+ */
+
+#ifndef __GL_UPLOAD_H
+#define __GL_UPLOAD_H
+
+#include <GL/gl.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct GLUploadSlot GLUploadSlot;
+
+void   *gl_upload_map(size_t size, GLUploadSlot **slot);
+void    gl_upload_unmap_to_texture(GLUploadSlot *slot, GLint x, GLint y, GLsizei width,
+                                   GLsizei height, GLenum format, GLenum type,
+                                   uint32_t row_length, int alignment);
+void    gl_upload_cancel(GLUploadSlot *slot);
+void    gl_upload_tex_sub_image(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format,
+                                GLenum type, const void *data, uint32_t pitch,
+                                unsigned int bytes_per_pixel);
+void    gl_upload_forget(void);
+
+#endif /* __GL_UPLOAD_H */
@@ -0,0 +1,203 @@
+/*
+ * Copyright 2013  Rinat Ibragimov
+ *
+ * This file is part of libvdpau-va-gl
+ *
+ * libvdpau-va-gl is distributed under the terms of the LGPLv3. See COPYING for details.
+ */
+
+/*
+ *  per-device GL command thread. API threads push commands into intrusive MPSC queue
+ *  without taking any lock, worker thread executes them in submission order.
+ */
+
+#define _GNU_SOURCE
+#include "gl-worker.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+struct GLWorker {
+    GLWorkerCommand    *head;           ///< last submitted command, producers swap it
+    GLWorkerCommand    *tail;           ///< next command to execute, worker only
+    GLWorkerCommand     stub;           ///< keeps queue non-empty
+    uint64_t            submitted;      ///< count of submitted commands (atomic)
+    uint64_t            processed;      ///< count of executed commands (atomic)
+    int                 sleeping;       ///< worker waits on work_available (atomic)
+    int                 waiters;        ///< threads waiting on work_done (atomic)
+    pthread_mutex_t     mutex;
+    pthread_cond_t      work_available;
+    pthread_cond_t      work_done;
+    pthread_t           thread;
+};
+
+static
+void
+queue_push(GLWorker *worker, GLWorkerCommand *cmd)
+{
+    __atomic_store_n(&cmd->next, NULL, __ATOMIC_RELAXED);
+    GLWorkerCommand *prev = __atomic_exchange_n(&worker->head, cmd, __ATOMIC_ACQ_REL);
+    // between exchange and this store queue is disconnected, queue_pop() sees it as empty
+    __atomic_store_n(&prev->next, cmd, __ATOMIC_RELEASE);
+}
+
+static
+GLWorkerCommand *
+queue_pop(GLWorker *worker)
+{
+    GLWorkerCommand *tail = worker->tail;
+    GLWorkerCommand *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &worker->stub) {
+        if (NULL == next)
+            return NULL;
+        worker->tail = next;
+        tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next) {
+        worker->tail = next;
+        return tail;
+    }
+
+    if (tail != __atomic_load_n(&worker->head, __ATOMIC_ACQUIRE))
+        return NULL;    // producer is in the middle of queue_push()
+
+    // tail is the last command. Put stub after it to be able to detach tail.
+    queue_push(worker, &worker->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        worker->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+static
+void *
+worker_thread(void *param)
+{
+    GLWorker *worker = param;
+
+    while (1) {
+        GLWorkerCommand *cmd = queue_pop(worker);
+        if (NULL == cmd) {
+            const uint64_t processed = __atomic_load_n(&worker->processed, __ATOMIC_SEQ_CST);
+            if (processed < __atomic_load_n(&worker->submitted, __ATOMIC_SEQ_CST)) {
+                // command is being pushed right now, it will become visible shortly
+                sched_yield();
+                continue;
+            }
+
+            pthread_mutex_lock(&worker->mutex);
+            __atomic_store_n(&worker->sleeping, 1, __ATOMIC_SEQ_CST);
+            while (__atomic_load_n(&worker->processed, __ATOMIC_SEQ_CST) >=
+                   __atomic_load_n(&worker->submitted, __ATOMIC_SEQ_CST))
+            {
+                pthread_cond_wait(&worker->work_available, &worker->mutex);
+            }
+            __atomic_store_n(&worker->sleeping, 0, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&worker->mutex);
+            continue;
+        }
+
+        // command without function is a request to stop
+        const int stop = (NULL == cmd->execute);
+        if (!stop)
+            cmd->execute(cmd);
+
+        __atomic_add_fetch(&worker->processed, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&worker->waiters, __ATOMIC_SEQ_CST) > 0) {
+            pthread_mutex_lock(&worker->mutex);
+            pthread_cond_broadcast(&worker->work_done);
+            pthread_mutex_unlock(&worker->mutex);
+        }
+
+        if (stop)
+            break;
+    }
+
+    return NULL;
+}
+
+GLWorker *
+gl_worker_create(void)
+{
+    GLWorker *worker = calloc(1, sizeof(GLWorker));
+    if (NULL == worker)
+        return NULL;
+
+    worker->head = &worker->stub;
+    worker->tail = &worker->stub;
+    pthread_mutex_init(&worker->mutex, NULL);
+    pthread_cond_init(&worker->work_available, NULL);
+    pthread_cond_init(&worker->work_done, NULL);
+
+    if (0 != pthread_create(&worker->thread, NULL, worker_thread, worker)) {
+        pthread_cond_destroy(&worker->work_done);
+        pthread_cond_destroy(&worker->work_available);
+        pthread_mutex_destroy(&worker->mutex);
+        free(worker);
+        return NULL;
+    }
+
+    return worker;
+}
+
+void
+gl_worker_destroy(GLWorker *worker)
+{
+    GLWorkerCommand stop_cmd = { .next = NULL, .execute = NULL };
+
+    // all commands submitted before stop_cmd get executed
+    gl_worker_submit(worker, &stop_cmd);
+    pthread_join(worker->thread, NULL);
+
+    pthread_cond_destroy(&worker->work_done);
+    pthread_cond_destroy(&worker->work_available);
+    pthread_mutex_destroy(&worker->mutex);
+    free(worker);
+}
+
+void
+gl_worker_submit(GLWorker *worker, GLWorkerCommand *cmd)
+{
+    // Counted before it's pushed, so any sync ticket taken after this covers the command.
+    // Worker sees count ahead of queue contents for a moment, and waits for push to finish.
+    __atomic_add_fetch(&worker->submitted, 1, __ATOMIC_SEQ_CST);
+    queue_push(worker, cmd);
+
+    // Worker sets .sleeping before checking counters, and we check .sleeping after updating
+    // them, so at least one side notices the other.
+    if (__atomic_load_n(&worker->sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&worker->mutex);
+        pthread_cond_signal(&worker->work_available);
+        pthread_mutex_unlock(&worker->mutex);
+    }
+}
+
+/** @brief wait until all commands submitted before the call are executed */
+void
+gl_worker_sync(GLWorker *worker)
+{
+    if (gl_worker_is_current(worker))
+        return;
+
+    const uint64_t ticket = __atomic_load_n(&worker->submitted, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&worker->processed, __ATOMIC_SEQ_CST) >= ticket)
+        return;
+
+    pthread_mutex_lock(&worker->mutex);
+    __atomic_add_fetch(&worker->waiters, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&worker->processed, __ATOMIC_SEQ_CST) < ticket)
+        pthread_cond_wait(&worker->work_done, &worker->mutex);
+    __atomic_sub_fetch(&worker->waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+int
+gl_worker_is_current(GLWorker *worker)
+{
+    return pthread_equal(pthread_self(), worker->thread);
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright 2013  Rinat Ibragimov
+ *
+ * This file is part of libvdpau-va-gl
+ *
+ * libvdpau-va-gl is distributed under the terms of the LGPLv3. See COPYING for details.
+ */
+
+#ifndef __GL_WORKER_H
+#define __GL_WORKER_H
+
+#include <stdint.h>
+
+/** @brief deferred command header. Commands embed it as the first member */
+typedef struct GLWorkerCommand {
+    struct GLWorkerCommand *next;                   ///< queue link, owned by worker
+    void (*execute)(struct GLWorkerCommand *cmd);   ///< runs on worker thread, frees command
+} GLWorkerCommand;
+
+typedef struct GLWorker GLWorker;
+
+GLWorker   *gl_worker_create(void);
+void        gl_worker_destroy(GLWorker *worker);
+void        gl_worker_submit(GLWorker *worker, GLWorkerCommand *cmd);
+void        gl_worker_sync(GLWorker *worker);
+int         gl_worker_is_current(GLWorker *worker);
+
+#endif /* __GL_WORKER_H */
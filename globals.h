@@ -26,7 +26,22 @@ struct global_data {
         int log_timestamp;          ///< display timestamps
         int avoid_va;               ///< do not use VA-API video decoding acceleration even if
                                     ///< available
+        int lock_spin;              ///< spin for a while on contended object lock before
+                                    ///< going to sleep
+        int lock_profile;           ///< collect lock wait and hold time statistics
+        int sticky_context;         ///< leave driver's GL context current after API call
+        int gl_thread;              ///< execute rendering commands on per-device GL thread
+        int egl;                    ///< use surfaceless EGL contexts instead of GLX ones
+        int sync_gl_errors;         ///< check GL errors with glGetError after each call
     } quirks;
+
+    /** @brief GL capabilities, detected on device creation */
+    struct {
+        int arb_sync;               ///< GL_ARB_sync, fence objects
+        int arb_pixel_buffer_object;    ///< GL_ARB_pixel_buffer_object, async readback
+        int arb_buffer_storage;     ///< GL_ARB_buffer_storage, persistently mapped buffers
+        int khr_debug;              ///< GL_KHR_debug, debug output callback
+    } gl_caps;
 };
 
 extern struct global_data global;
@@ -8,146 +8,584 @@
 
 #define _XOPEN_SOURCE   500
 #include "handle-storage.h"
+#include "globals.h"
+#include "lock-profiler.h"
 #include <pthread.h>
 #include <glib.h>
-#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
 
-GPtrArray *vdpHandles;
 GHashTable *xdpy_copies;            //< Copies of X Display connections
 GHashTable *xdpy_copies_refcount;   //< Reference count of X Display connection copy
 
+/** @brief Handle table slot.
+
+    Slots live in fixed-size chunks which are never moved or freed while storage exists,
+    so a reader may hold a pointer to a slot without any lock.
+*/
+typedef struct {
+    VdpGenericHandle   *data;       ///< object, or NULL if slot is vacant
+    int                 pins;       ///< number of readers currently resolving this slot
+    uint32_t            generation; ///< generation of current (or next) object in slot
+    int                 next_free;  ///< next slot in free list
+    uint64_t            locked_at;  ///< when object was locked, for lock profiler
+    HandleChildList    *children;   ///< list of parent's children this slot is linked in
+    int                 child_prev; ///< previous sibling of the same type, 0 if none
+    int                 child_next; ///< next sibling of the same type, 0 if none
+} HandleSlot;
+
+#define SLOT_CHUNK_SHIFT    8
+#define SLOT_CHUNK_SIZE     (1 << SLOT_CHUNK_SHIFT)
+#define SLOT_CHUNK_MASK     (SLOT_CHUNK_SIZE - 1)
+
+/** @brief Directory of slot chunks.
+
+    Directory is replaced with a larger copy when full. Readers may still look at the old
+    one, so retired directories are kept on a list and freed with the storage itself.
+    Their total size never exceeds the size of the current one.
+*/
+typedef struct SlotDirectory {
+    int                     capacity;   ///< number of chunk pointers
+    struct SlotDirectory   *retired;    ///< previously used directory
+    HandleSlot             *chunks[];
+} SlotDirectory;
+
+static SlotDirectory *slot_dir = NULL;  ///< published directory
+static int slot_count = 0;              ///< number of slots ever used, published
+static int free_head = 0;               ///< oldest vacant slot, 0 if none
+static int free_tail = 0;               ///< most recently vacated slot
+static int free_count = 0;              ///< length of free list
+
+// Slots are recycled in FIFO order, and only when there are enough of them. That way
+// a generation of any particular slot advances slowly. Slot which has used up all its
+// generations is retired instead of being recycled, so stale handle never aliases live one.
+#define SLOT_RECYCLE_THRESHOLD  64
+
+static inline
+uint32_t
+_make_handle(int idx, uint32_t generation, HandleType type)
+{
+    return (type << HANDLE_TYPE_SHIFT) |
+           ((generation & HANDLE_GENERATION_MASK) << HANDLE_GENERATION_SHIFT) |
+           (uint32_t)idx;
+}
+
+// handle_expunge() sleeps here until readers unpin the slot. Readers take the mutex only
+// when they drop the last pin while someone is waiting.
+static pthread_mutex_t pin_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pins_released = PTHREAD_COND_INITIALIZER;
+static int pin_waiters = 0;     ///< threads waiting on pins_released (atomic)
+
+// writers (insert, expunge, xdpy copies) serialize on this lock. Readers never take it.
 static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t lock_acquired_at;   ///< for lock profiler, accessed by lock holder only
+
+static inline
+void
+_storage_lock(void)
+{
+    uint64_t acquired_at = lockprof_mutex_lock(&lock, LOCK_CLASS_HANDLE_STORAGE);
+    lock_acquired_at = acquired_at;
+}
+
+static inline
+void
+_storage_unlock(void)
+{
+    lockprof_mutex_unlock(&lock, LOCK_CLASS_HANDLE_STORAGE, lock_acquired_at);
+}
 
 void
 handle_initialize_storage(void)
 {
-    pthread_mutex_lock(&lock);
-    vdpHandles = g_ptr_array_new();
-    // adding dummy element to ensure all handles start from 1
-    g_ptr_array_add(vdpHandles, NULL);
+    _storage_lock();
+    slot_dir = NULL;
+    // skipping slot 0 to ensure all handles start from 1
+    slot_count = 1;
+    free_head = free_tail = free_count = 0;
+    SlotDirectory *dir = calloc(1, sizeof(SlotDirectory) + 16 * sizeof(HandleSlot *));
+    HandleSlot *chunk = calloc(SLOT_CHUNK_SIZE, sizeof(HandleSlot));
+    if (dir && chunk) {
+        dir->capacity = 16;
+        dir->chunks[0] = chunk;
+        __atomic_store_n(&slot_dir, dir, __ATOMIC_RELEASE);
+    } else {
+        free(dir);
+        free(chunk);
+        slot_count = 0;
+    }
 
     xdpy_copies = g_hash_table_new(g_direct_hash, g_direct_equal);
     xdpy_copies_refcount = g_hash_table_new(g_direct_hash, g_direct_equal);
-    pthread_mutex_unlock(&lock);
+    _storage_unlock();
 }
 
-int
-handle_insert(void *data)
+// number of trylock attempts made before sleeping, when LockSpin quirk is enabled
+#define LOCK_SPIN_COUNT     1000
+
+static inline
+void
+_cpu_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__("pause" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+// Locks object mutex. Waiting threads sleep on mutex's futex and are woken by
+// handle_release(). With LockSpin quirk short hand-offs are caught by spinning first.
+static
+void
+_lock_object_wait(VdpGenericHandle *gh)
+{
+    if (global.quirks.lock_spin) {
+        for (int k = 0; k < LOCK_SPIN_COUNT; k ++) {
+            if (pthread_mutex_trylock(&gh->lock) == 0)
+                return;
+            _cpu_relax();
+        }
+    }
+    pthread_mutex_lock(&gh->lock);
+}
+
+// returns time object was locked at if lock profiler is enabled, 0 otherwise
+static inline
+uint64_t
+_lock_object(VdpGenericHandle *gh)
 {
-    pthread_mutex_lock(&lock);
-    g_ptr_array_add(vdpHandles, data);
-    int id = vdpHandles->len - 1;
-    pthread_mutex_unlock(&lock);
-    return id;
+    if (!global.quirks.lock_profile) {
+        _lock_object_wait(gh);
+        return 0;
+    }
+    const uint64_t started_at = lockprof_now();
+    _lock_object_wait(gh);
+    lockprof_record_wait(LOCK_CLASS_HANDLE, started_at);
+    return lockprof_now();
+}
+
+static inline
+void
+_unlock_object(VdpGenericHandle *gh, HandleSlot *slot)
+{
+    if (slot->locked_at) {
+        lockprof_record_hold(LOCK_CLASS_HANDLE, slot->locked_at);
+        slot->locked_at = 0;
+    }
+    pthread_mutex_unlock(&gh->lock);
 }
 
-// lock unsafe function
+// lock-free. Returns slot with given index or NULL if it was never allocated
+static
+HandleSlot *
+_get_slot(int idx)
+{
+    if (idx < 1 || idx >= __atomic_load_n(&slot_count, __ATOMIC_ACQUIRE))
+        return NULL;
+    // directory is published before slot_count grows, so it always covers the index
+    SlotDirectory *dir = __atomic_load_n(&slot_dir, __ATOMIC_ACQUIRE);
+    HandleSlot *chunk = __atomic_load_n(&dir->chunks[idx >> SLOT_CHUNK_SHIFT], __ATOMIC_ACQUIRE);
+    return &chunk[idx & SLOT_CHUNK_MASK];
+}
+
+// drops reader's pin, waking up expunging thread if it was the last one
+static
+void
+_unpin_slot(HandleSlot *slot)
+{
+    // Waiter registers before checking pins, and we check waiters after dropping pin,
+    // so at least one side notices the other.
+    if (0 == __atomic_sub_fetch(&slot->pins, 1, __ATOMIC_SEQ_CST) &&
+        __atomic_load_n(&pin_waiters, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_mutex_lock(&pin_mutex);
+        pthread_cond_broadcast(&pins_released);
+        pthread_mutex_unlock(&pin_mutex);
+    }
+}
+
+// lock-free. Returns slot for given handle if its generation matches, NULL otherwise.
+// Slot memory is never freed, so nothing stale gets dereferenced here.
+static
+HandleSlot *
+_get_slot_checked(uint32_t handle, HandleType type)
+{
+    const HandleType handle_type = handle >> HANDLE_TYPE_SHIFT;
+    if (HANDLETYPE_ANY != type && handle_type != type)
+        return NULL;
+    HandleSlot *slot = _get_slot(handle & HANDLE_INDEX_MASK);
+    if (!slot)
+        return NULL;
+    const uint32_t generation = (handle >> HANDLE_GENERATION_SHIFT) & HANDLE_GENERATION_MASK;
+    if (__atomic_load_n(&slot->generation, __ATOMIC_ACQUIRE) != generation)
+        return NULL;
+    return slot;
+}
+
+// must be called with lock held. Makes sure slot with index slot_count exists
 static
 int
-_is_valid(int handle, HandleType type)
+_grow_storage(void)
 {
-    VdpGenericHandle *gh;
-    // return false if index is out of range
-    if (handle < 1 || handle >= (int)vdpHandles->len)
+    SlotDirectory *dir = slot_dir;
+    if (!dir)
+        return 0;
+    const int chunk_idx = slot_count >> SLOT_CHUNK_SHIFT;
+    if (slot_count > HANDLE_INDEX_MASK)
+        return 0;   // index space exhausted
+    if (0 != (slot_count & SLOT_CHUNK_MASK))
+        return 1;   // current chunk still has room
+
+    if (chunk_idx >= dir->capacity) {
+        const int new_capacity = dir->capacity * 2;
+        SlotDirectory *new_dir = calloc(1, sizeof(SlotDirectory) +
+                                        new_capacity * sizeof(HandleSlot *));
+        if (!new_dir)
+            return 0;
+        new_dir->capacity = new_capacity;
+        new_dir->retired = dir;
+        memcpy(new_dir->chunks, dir->chunks, dir->capacity * sizeof(HandleSlot *));
+        __atomic_store_n(&slot_dir, new_dir, __ATOMIC_RELEASE);
+        dir = new_dir;
+    }
+
+    HandleSlot *chunk = calloc(SLOT_CHUNK_SIZE, sizeof(HandleSlot));
+    if (!chunk)
         return 0;
+    __atomic_store_n(&dir->chunks[chunk_idx], chunk, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// must be called with lock held
+static
+void
+_link_child(HandleChildList *children, int idx, HandleSlot *slot, HandleType type)
+{
+    slot->children = children;
+    slot->child_prev = 0;
+    slot->child_next = children->first[type];
+    if (slot->child_next)
+        _get_slot(slot->child_next)->child_prev = idx;
+    children->first[type] = idx;
+    children->count ++;
+}
 
-    // return false if entry was deleted
-    gh = g_ptr_array_index(vdpHandles, handle);
-    if (!gh)
-         return 0;
+// must be called with lock held
+static
+void
+_unlink_child(HandleSlot *slot, HandleType type)
+{
+    HandleChildList *children = slot->children;
+    if (!children)
+        return;
+    if (slot->child_prev)
+        _get_slot(slot->child_prev)->child_next = slot->child_next;
+    else
+        children->first[type] = slot->child_next;
+    if (slot->child_next)
+        _get_slot(slot->child_next)->child_prev = slot->child_prev;
+    children->count --;
+    slot->children = NULL;
+    slot->child_prev = slot->child_next = 0;
+}
 
-    // return true if caller wants any handle type
-    if (HANDLETYPE_ANY == type)
-        return 1;
+uint32_t
+handle_insert_child(void *data, HandleChildList *children)
+{
+    VdpGenericHandle *gh = data;
+    uint32_t handle = VDP_INVALID_HANDLE;
+    int idx = 0;
+    HandleSlot *slot = NULL;
 
-    // check handle type
-    if (gh->type == type)
-        return 1;
+    if (gh->type >= HANDLETYPE_COUNT)
+        return VDP_INVALID_HANDLE;
 
-    return 0;
+    _storage_lock();
+    if (free_count >= SLOT_RECYCLE_THRESHOLD) {
+        // reuse oldest vacant slot
+        idx = free_head;
+        slot = _get_slot(idx);
+        free_head = slot->next_free;
+        if (0 == free_head)
+            free_tail = 0;
+        free_count --;
+    } else if (_grow_storage()) {
+        idx = slot_count;
+        slot = &slot_dir->chunks[idx >> SLOT_CHUNK_SHIFT][idx & SLOT_CHUNK_MASK];
+    }
+
+    if (slot) {
+        if (children)
+            _link_child(children, idx, slot, gh->type);
+        handle = _make_handle(idx, slot->generation, gh->type);
+        __atomic_store_n(&slot->data, gh, __ATOMIC_RELEASE);
+        if (idx == slot_count)
+            __atomic_store_n(&slot_count, idx + 1, __ATOMIC_RELEASE);
+    }
+    _storage_unlock();
+    return handle;
+}
+
+uint32_t
+handle_insert(void *data)
+{
+    return handle_insert_child(data, NULL);
+}
+
+uint32_t
+handle_first_child(HandleChildList *children, HandleType type)
+{
+    uint32_t handle = 0;
+    if (type >= HANDLETYPE_COUNT)
+        return 0;
+    _storage_lock();
+    const int idx = children->first[type];
+    if (idx)
+        handle = _make_handle(idx, _get_slot(idx)->generation, type);
+    _storage_unlock();
+    return handle;
+}
+
+void
+handle_execute_for_children(HandleChildList *children,
+                            void (*callback)(uint32_t handle, void *p), void *param)
+{
+    // Take a snapshot of handles first, so callback is free to destroy objects.
+    // Handles, unlike pointers, stay safe to use even if objects are gone meanwhile.
+    _storage_lock();
+    const int count = children->count;
+    uint32_t *handles = malloc(count * sizeof(uint32_t));
+    int k = 0;
+    if (handles) {
+        for (HandleType type = 0; type < HANDLETYPE_COUNT; type ++) {
+            for (int idx = children->first[type]; idx != 0 && k < count;) {
+                HandleSlot *slot = _get_slot(idx);
+                handles[k ++] = _make_handle(idx, slot->generation, type);
+                idx = slot->child_next;
+            }
+        }
+    }
+    _storage_unlock();
+
+    for (int j = 0; j < k; j ++)
+        callback(handles[j], param);
+    free(handles);
 }
 
 void *
-handle_acquire(int handle, HandleType type)
+handle_acquire(uint32_t handle, HandleType type)
 {
-    VdpGenericHandle *res = NULL;
+    VdpGenericHandle *res;
+    HandleSlot *slot = _get_slot_checked(handle, type);
+    if (!slot)
+        return NULL;
+    const uint32_t generation = (handle >> HANDLE_GENERATION_SHIFT) & HANDLE_GENERATION_MASK;
 
-    while (1) {
-        pthread_mutex_lock(&lock);
-        if (!_is_valid(handle, type))
-            break;
-        res = g_ptr_array_index(vdpHandles, handle);
-        if (pthread_mutex_trylock(&res->lock) == 0)
-            break;
-        pthread_mutex_unlock(&lock);
-        usleep(1);
+    // Pin slot so handle_expunge() waits before its caller frees the object.
+    // Pin and expunge both use sequentially consistent ordering, so either expunge sees
+    // the pin, or reader sees NULL in the slot.
+    __atomic_add_fetch(&slot->pins, 1, __ATOMIC_SEQ_CST);
+    res = __atomic_load_n(&slot->data, __ATOMIC_SEQ_CST);
+    if (res && (HANDLETYPE_ANY == type || res->type == type)) {
+        const uint64_t locked_at = _lock_object(res);
+        // object could have been expunged (and slot even reused) while we were
+        // waiting for its lock
+        if (__atomic_load_n(&slot->data, __ATOMIC_SEQ_CST) != res ||
+            __atomic_load_n(&slot->generation, __ATOMIC_SEQ_CST) != generation)
+        {
+            pthread_mutex_unlock(&res->lock);
+            res = NULL;
+        } else {
+            slot->locked_at = locked_at;
+        }
+    } else {
+        res = NULL;
     }
+    _unpin_slot(slot);
 
-    pthread_mutex_unlock(&lock);
     return res;
 }
 
+static inline
+uint64_t
+_order_key(uint32_t handle)
+{
+    return ((uint64_t)(handle & HANDLE_INDEX_MASK) << 32) | handle;
+}
+
 void
-handle_release(int handle)
+handle_acquire_many(int count, uint32_t const *handles, HandleType const *types, void **data)
 {
-    pthread_mutex_lock(&lock);
-    if (handle > 0 && handle < (int)vdpHandles->len) {
-        VdpGenericHandle *gh = g_ptr_array_index(vdpHandles, handle);
-        if (gh)
-            pthread_mutex_unlock(&gh->lock);
+    int order[count];
+
+    // sort by slot index, then by whole value to keep equal handles adjacent.
+    // Lists are short, insertion sort is fine
+    for (int k = 0; k < count; k ++) {
+        int j = k;
+        while (j > 0 && _order_key(handles[order[j - 1]]) > _order_key(handles[k])) {
+            order[j] = order[j - 1];
+            j --;
+        }
+        order[j] = k;
+    }
+
+    VdpGenericHandle *locked = NULL;    // object locked for current run of equal handles
+    for (int k = 0; k < count; k ++) {
+        const int pos = order[k];
+        data[pos] = NULL;
+        if (k > 0 && handles[order[k - 1]] == handles[pos]) {
+            if (locked) {
+                // already locked, share result if type fits
+                if (HANDLETYPE_ANY == types[pos] || locked->type == types[pos])
+                    data[pos] = locked;
+                continue;
+            }
+        } else {
+            locked = NULL;
+        }
+        data[pos] = locked = handle_acquire(handles[pos], types[pos]);
     }
-    pthread_mutex_unlock(&lock);
 }
 
 void
-handle_expunge(int handle)
+handle_release_many(int count, uint32_t const *handles, void *const *data)
 {
-    pthread_mutex_lock(&lock);
-    if (_is_valid(handle, HANDLETYPE_ANY)) {
-        VdpGenericHandle *gh = g_ptr_array_index(vdpHandles, handle);
-        if (gh)
-            pthread_mutex_unlock(&gh->lock);
-        g_ptr_array_index(vdpHandles, handle) = NULL;
+    for (int k = 0; k < count; k ++) {
+        if (!data[k])
+            continue;
+        // release each object only once
+        int seen = 0;
+        for (int j = 0; j < k; j ++) {
+            if (data[j] == data[k]) {
+                seen = 1;
+                break;
+            }
+        }
+        if (!seen)
+            handle_release(handles[k]);
     }
-    pthread_mutex_unlock(&lock);
+}
+
+void *
+handle_acquire_shared(uint32_t handle, HandleType type)
+{
+    HandleSlot *slot = _get_slot_checked(handle, type);
+    if (!slot)
+        return NULL;
+    const uint32_t generation = (handle >> HANDLE_GENERATION_SHIFT) & HANDLE_GENERATION_MASK;
+
+    // pin stays until handle_release_shared(), holding off handle_expunge()
+    __atomic_add_fetch(&slot->pins, 1, __ATOMIC_SEQ_CST);
+    VdpGenericHandle *res = __atomic_load_n(&slot->data, __ATOMIC_SEQ_CST);
+    if (!res || (HANDLETYPE_ANY != type && res->type != type) ||
+        __atomic_load_n(&slot->generation, __ATOMIC_SEQ_CST) != generation)
+    {
+        _unpin_slot(slot);
+        return NULL;
+    }
+    return res;
 }
 
 void
-handle_destory_storage(void)
+handle_release_shared(uint32_t handle)
 {
-    pthread_mutex_lock(&lock);
-    g_ptr_array_unref(vdpHandles);
-    g_hash_table_unref(xdpy_copies);
-    g_hash_table_unref(xdpy_copies_refcount);
-    vdpHandles = NULL;
-    xdpy_copies = NULL;
-    xdpy_copies_refcount = NULL;
-    pthread_mutex_unlock(&lock);
+    // generation is not checked: object may be in the middle of expunge, waiting for us
+    HandleSlot *slot = _get_slot(handle & HANDLE_INDEX_MASK);
+    if (slot)
+        _unpin_slot(slot);
 }
 
 void
-handle_execute_for_all(void (*callback)(int idx, void *entry, void *p), void *param)
+handle_release(uint32_t handle)
 {
-    unsigned int k = 0;
+    HandleSlot *slot = _get_slot_checked(handle, HANDLETYPE_ANY);
+    if (!slot)
+        return;
+    // caller holds object lock, so object can't go away under us
+    VdpGenericHandle *gh = __atomic_load_n(&slot->data, __ATOMIC_ACQUIRE);
+    if (gh)
+        _unlock_object(gh, slot);
+}
 
-    pthread_mutex_lock(&lock);
-    while (k < vdpHandles->len) {
-        void *item = g_ptr_array_index(vdpHandles, k);
-        if (item) {
-            pthread_mutex_unlock(&lock);
-            // TODO: race condition. Supply integer handle instead of pointer to fix.
-            callback(k, item, param);
-            pthread_mutex_lock(&lock);
-        }
-        k ++;
+void
+handle_expunge(uint32_t handle)
+{
+    HandleSlot *slot = _get_slot_checked(handle, HANDLETYPE_ANY);
+    if (!slot)
+        return;
+
+    _storage_lock();
+    VdpGenericHandle *gh = slot->data;
+    if (!gh) {
+        _storage_unlock();
+        return;
+    }
+    _unlink_child(slot, gh->type);
+    // invalidate all outstanding copies of the handle
+    const uint32_t next_generation = (slot->generation + 1) & HANDLE_GENERATION_MASK;
+    __atomic_store_n(&slot->generation, next_generation, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&slot->data, NULL, __ATOMIC_SEQ_CST);
+    _storage_unlock();
+
+    _unlock_object(gh, slot);
+    // Wait for readers which have seen the object to leave. They will either fail
+    // to lock it, or lock it and notice it's gone. After that it's safe to free object.
+    if (__atomic_load_n(&slot->pins, __ATOMIC_SEQ_CST) > 0) {
+        __atomic_add_fetch(&pin_waiters, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_lock(&pin_mutex);
+        while (__atomic_load_n(&slot->pins, __ATOMIC_SEQ_CST) > 0)
+            pthread_cond_wait(&pins_released, &pin_mutex);
+        pthread_mutex_unlock(&pin_mutex);
+        __atomic_sub_fetch(&pin_waiters, 1, __ATOMIC_SEQ_CST);
+    }
+
+    // Generation wrapped, next handle would be equal to the very first one issued for the slot.
+    // Slot stays vacant forever then.
+    if (0 == next_generation)
+        return;
+
+    // only now slot can be given to someone else
+    const int idx = handle & HANDLE_INDEX_MASK;
+    _storage_lock();
+    slot->next_free = 0;
+    if (free_tail)
+        _get_slot(free_tail)->next_free = idx;
+    else
+        free_head = idx;
+    free_tail = idx;
+    free_count ++;
+    _storage_unlock();
+}
+
+void
+handle_destory_storage(void)
+{
+    _storage_lock();
+    SlotDirectory *dir = slot_dir;
+    if (dir) {
+        for (int k = 0; k < dir->capacity; k ++)
+            free(dir->chunks[k]);
+    }
+    while (dir) {
+        SlotDirectory *retired = dir->retired;
+        free(dir);
+        dir = retired;
     }
-    pthread_mutex_unlock(&lock);
+    slot_dir = NULL;
+    slot_count = 0;
+    free_head = free_tail = free_count = 0;
+    g_hash_table_unref(xdpy_copies);
+    g_hash_table_unref(xdpy_copies_refcount);
+    xdpy_copies = NULL;
+    xdpy_copies_refcount = NULL;
+    _storage_unlock();
 }
 
 void *
 handle_xdpy_ref(void *dpy_orig)
 {
-    pthread_mutex_lock(&lock);
+    _storage_lock();
     Display *dpy = g_hash_table_lookup(xdpy_copies, dpy_orig);
     if (NULL == dpy) {
         dpy = XOpenDisplay(XDisplayString(dpy_orig));
@@ -160,14 +598,14 @@ handle_xdpy_ref(void *dpy_orig)
         g_hash_table_replace(xdpy_copies_refcount, dpy_orig, GINT_TO_POINTER(refcount+1));
     }
 quit:
-    pthread_mutex_unlock(&lock);
+    _storage_unlock();
     return dpy;
 }
 
 void
 handle_xdpy_unref(void *dpy_orig)
 {
-    pthread_mutex_lock(&lock);
+    _storage_lock();
     int refcount = GPOINTER_TO_INT(g_hash_table_lookup(xdpy_copies_refcount, dpy_orig));
     refcount = refcount - 1;
     if (0 == refcount) {
@@ -180,5 +618,5 @@ handle_xdpy_unref(void *dpy_orig)
         // just update refcount
         g_hash_table_replace(xdpy_copies_refcount, dpy_orig, GINT_TO_POINTER(refcount));
     }
-    pthread_mutex_unlock(&lock);
+    _storage_unlock();
 }
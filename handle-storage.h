@@ -23,6 +23,14 @@ typedef uint32_t    HandleType;
 #define HANDLETYPE_VIDEO_SURFACE               (HandleType)6
 #define HANDLETYPE_BITMAP_SURFACE              (HandleType)7
 #define HANDLETYPE_DECODER                     (HandleType)8
+#define HANDLETYPE_COUNT                       9
+
+// Handle value layout: [ type:4 | generation:12 | slot index:16 ]. Type is never zero
+// for a real object, so neither 0 nor VDP_INVALID_HANDLE can be a valid handle.
+#define HANDLE_INDEX_MASK           0x0000ffffu
+#define HANDLE_GENERATION_SHIFT     16
+#define HANDLE_GENERATION_MASK      0xfffu
+#define HANDLE_TYPE_SHIFT           28
 
 /** @brief Generic handle struct.
 
@@ -35,14 +43,48 @@ typedef struct {
     pthread_mutex_t lock;
 } VdpGenericHandle;
 
-void    handle_initialize_storage(void);
-int     handle_insert(void *data);
-void   *handle_acquire(int handle, HandleType type);
-void    handle_release(int handle);
-void    handle_expunge(int handle);
-void    handle_destory_storage(void);
-void    handle_execute_for_all(void (*callback)(int idx, void *entry, void *p), void *param);
-void   *handle_xdpy_ref(void *dpy_orig);
-void    handle_xdpy_unref(void *dpy_orig);
+/** @brief Intrusive list of child objects.
+
+    Lives inside parent object. Links are kept in handle storage itself, and are updated
+    by handle_insert_child() and handle_expunge() under storage lock.
+*/
+typedef struct {
+    int     first[HANDLETYPE_COUNT];    ///< index of first child of each type, 0 if none
+    int     count;                      ///< total number of children
+} HandleChildList;
+
+void        handle_initialize_storage(void);
+uint32_t    handle_insert(void *data);
+uint32_t    handle_insert_child(void *data, HandleChildList *children);
+uint32_t    handle_first_child(HandleChildList *children, HandleType type);
+void        handle_execute_for_children(HandleChildList *children,
+                                        void (*callback)(uint32_t handle, void *p), void *param);
+void       *handle_acquire(uint32_t handle, HandleType type);
+void        handle_release(uint32_t handle);
+
+/** @brief Acquire object in shared mode.
+
+    Object lock is not taken, so the call never waits for writers. Object is only
+    guaranteed to stay alive until handle_release_shared(). Caller may read only fields
+    which do not change after handle_insert(), or fields accessed atomically.
+    Caller must not destroy object while holding shared reference to it.
+*/
+void       *handle_acquire_shared(uint32_t handle, HandleType type);
+void        handle_release_shared(uint32_t handle);
+
+/** @brief Acquire several objects at once.
+
+    Locks are taken in slot index order, so any two threads acquiring overlapping sets
+    of handles this way can't deadlock each other. Handle repeated several times is locked
+    once, and all its entries in \a data point to the same object. Entries for invalid
+    handles are set to NULL, all others remain locked until handle_release_many().
+*/
+void        handle_acquire_many(int count, uint32_t const *handles, HandleType const *types,
+                                void **data);
+void        handle_release_many(int count, uint32_t const *handles, void *const *data);
+void        handle_expunge(uint32_t handle);
+void        handle_destory_storage(void);
+void       *handle_xdpy_ref(void *dpy_orig);
+void        handle_xdpy_unref(void *dpy_orig);
 
 #endif /* HANDLE_STORAGE_H_ */
@@ -0,0 +1,229 @@
+/*
+ * Copyright 2013  Rinat Ibragimov
+ *
+ * This file is part of libvdpau-va-gl
+ *
+ * libvdpau-va-gl is distributed under the terms of the LGPLv3. See COPYING for details.
+ */
+
+/*
+ *  lock contention profiler. Collects wait and hold time histograms for each lock class,
+ *  split by VDPAU function that was executing at the moment.
+ */
+
+#define _GNU_SOURCE
+#include "lock-profiler.h"
+#include "reverse-constant.h"
+#include "vdpau-trace.h"
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define HIST_BUCKETS        32      ///< bucket k counts durations in [2^(k-1), 2^k) ns
+
+// VdpFuncId values are mapped to slots: core functions map to themselves, then
+// go winsys function, device creation and "outside of any API call" (worker threads)
+#define FUNC_SLOT_WINSYS    (VDP_FUNC_ID_PREEMPTION_CALLBACK_REGISTER + 1)
+#define FUNC_SLOT_CREATE    (FUNC_SLOT_WINSYS + 1)
+#define FUNC_SLOT_NONE      (FUNC_SLOT_CREATE + 1)
+#define FUNC_SLOT_COUNT     (FUNC_SLOT_NONE + 1)
+
+struct lock_stats {
+    uint64_t    wait_count;
+    uint64_t    wait_total;             ///< total wait time, ns
+    uint64_t    wait_max;
+    uint64_t    hold_count;
+    uint64_t    hold_total;             ///< total hold time, ns
+    uint64_t    hold_max;
+    uint64_t    wait_hist[HIST_BUCKETS];
+    uint64_t    hold_hist[HIST_BUCKETS];
+};
+
+static struct lock_stats stats[LOCK_CLASS_COUNT][FUNC_SLOT_COUNT];
+static volatile sig_atomic_t report_requested = 0;
+
+static const char *lock_class_name[LOCK_CLASS_COUNT] = {
+    [LOCK_CLASS_HANDLE_STORAGE] = "handle storage lock",
+    [LOCK_CLASS_HANDLE] =         "object locks",
+    [LOCK_CLASS_GLX_CTX] =        "GLX context mutex",
+    [LOCK_CLASS_VA_DISPLAY] =     "VA display mutex",
+    [LOCK_CLASS_RENDER_BATCH] =   "render batch mutex",
+};
+
+static
+void
+report_signal_handler(int sig)
+{
+    (void)sig;
+    // printing from signal handler is unsafe, report will be printed by next lock operation
+    report_requested = 1;
+}
+
+void
+lockprof_initialize(void)
+{
+    memset(stats, 0, sizeof(stats));
+    if (!global.quirks.lock_profile)
+        return;
+
+    // don't steal SIGUSR2 from application
+    struct sigaction sa, old_sa;
+    if (0 != sigaction(SIGUSR2, NULL, &old_sa))
+        return;
+    if (SIG_DFL != old_sa.sa_handler || (old_sa.sa_flags & SA_SIGINFO)) {
+        traceError("lockprof: SIGUSR2 is in use, report will be printed at exit only\n");
+        return;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = report_signal_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, NULL);
+}
+
+uint64_t
+lockprof_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static inline
+int
+current_func_slot(void)
+{
+    const int func_id = traceGetCurrentFuncId();
+    if (func_id >= 0 && func_id < FUNC_SLOT_WINSYS)
+        return func_id;
+    if (VDP_FUNC_ID_PRESENTATION_QUEUE_TARGET_CREATE_X11 == func_id)
+        return FUNC_SLOT_WINSYS;
+    if (TRACE_FUNC_ID_DEVICE_CREATE == func_id)
+        return FUNC_SLOT_CREATE;
+    return FUNC_SLOT_NONE;
+}
+
+static inline
+int
+hist_bucket(uint64_t duration)
+{
+    if (0 == duration)
+        return 0;
+    const int bucket = 64 - __builtin_clzll(duration);
+    return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
+
+static inline
+void
+update_max(uint64_t *max, uint64_t value)
+{
+    uint64_t old = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while (value > old) {
+        if (__atomic_compare_exchange_n(max, &old, value, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+        {
+            break;
+        }
+    }
+}
+
+static inline
+void
+check_report_request(void)
+{
+    if (report_requested) {
+        report_requested = 0;
+        lockprof_report();
+    }
+}
+
+void
+lockprof_record_wait(LockClass lock_class, uint64_t started_at)
+{
+    const uint64_t duration = lockprof_now() - started_at;
+    struct lock_stats *s = &stats[lock_class][current_func_slot()];
+    __atomic_add_fetch(&s->wait_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->wait_total, duration, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->wait_hist[hist_bucket(duration)], 1, __ATOMIC_RELAXED);
+    update_max(&s->wait_max, duration);
+}
+
+void
+lockprof_record_hold(LockClass lock_class, uint64_t acquired_at)
+{
+    const uint64_t duration = lockprof_now() - acquired_at;
+    struct lock_stats *s = &stats[lock_class][current_func_slot()];
+    __atomic_add_fetch(&s->hold_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->hold_total, duration, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->hold_hist[hist_bucket(duration)], 1, __ATOMIC_RELAXED);
+    update_max(&s->hold_max, duration);
+    check_report_request();
+}
+
+static
+const char *
+func_slot_name(int slot)
+{
+    switch (slot) {
+    case FUNC_SLOT_WINSYS:  return "VDP_FUNC_ID_PRESENTATION_QUEUE_TARGET_CREATE_X11";
+    case FUNC_SLOT_CREATE:  return "vdp_imp_device_create_x11";
+    case FUNC_SLOT_NONE:    return "(worker threads)";
+    default:                return reverse_func_id(slot);
+    }
+}
+
+static
+void
+print_histogram(const char *title, const uint64_t *hist)
+{
+    fprintf(stderr, "        %s:", title);
+    for (int k = 0; k < HIST_BUCKETS; k ++) {
+        if (0 == hist[k])
+            continue;
+        // print upper bound of bucket
+        const uint64_t bound = 1ull << k;
+        if (bound < 1000)
+            fprintf(stderr, " <%dns:%" PRIu64, (int)bound, hist[k]);
+        else if (bound < 1000000)
+            fprintf(stderr, " <%dus:%" PRIu64, (int)(bound / 1000), hist[k]);
+        else
+            fprintf(stderr, " <%dms:%" PRIu64, (int)(bound / 1000000), hist[k]);
+    }
+    fprintf(stderr, "\n");
+}
+
+void
+lockprof_report(void)
+{
+    if (!global.quirks.lock_profile)
+        return;
+
+    fprintf(stderr, "[VS] lock profile, times in microseconds\n");
+    for (int c = 0; c < LOCK_CLASS_COUNT; c ++) {
+        uint64_t wait_total = 0, hold_total = 0, count = 0;
+        for (int f = 0; f < FUNC_SLOT_COUNT; f ++) {
+            wait_total += stats[c][f].wait_total;
+            hold_total += stats[c][f].hold_total;
+            count += stats[c][f].wait_count;
+        }
+        fprintf(stderr, "[VS] %s: %" PRIu64 " acquisitions, waited %.1f, held %.1f\n",
+                lock_class_name[c], count, wait_total / 1e3, hold_total / 1e3);
+
+        for (int f = 0; f < FUNC_SLOT_COUNT; f ++) {
+            struct lock_stats s = stats[c][f];
+            if (0 == s.wait_count && 0 == s.hold_count)
+                continue;
+            fprintf(stderr, "    %s: %" PRIu64 " acquisitions, "
+                    "wait total %.1f avg %.2f max %.1f, hold total %.1f avg %.2f max %.1f\n",
+                    func_slot_name(f), s.wait_count,
+                    s.wait_total / 1e3, s.wait_count ? s.wait_total / 1e3 / s.wait_count : 0.0,
+                    s.wait_max / 1e3,
+                    s.hold_total / 1e3, s.hold_count ? s.hold_total / 1e3 / s.hold_count : 0.0,
+                    s.hold_max / 1e3);
+            print_histogram("wait", s.wait_hist);
+            print_histogram("hold", s.hold_hist);
+        }
+    }
+}
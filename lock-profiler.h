@@ -0,0 +1,60 @@
+/*
+ * Copyright 2013  Rinat Ibragimov
+ *
+ * This file is part of libvdpau-va-gl
+ *
+ * libvdpau-va-gl is distributed under the terms of the LGPLv3. See COPYING for details.
+ */
+
+#ifndef __LOCK_PROFILER_H
+#define __LOCK_PROFILER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "globals.h"
+
+/** @brief lock classes tracked by profiler */
+typedef enum {
+    LOCK_CLASS_HANDLE_STORAGE = 0,  ///< handle storage writer lock
+    LOCK_CLASS_HANDLE,              ///< per-object VdpGenericHandle.lock
+    LOCK_CLASS_GLX_CTX,             ///< global.glx_ctx_stack_mutex
+    LOCK_CLASS_VA_DISPLAY,          ///< per-device VdpDeviceData.va_mutex
+    LOCK_CLASS_RENDER_BATCH,        ///< per-device VdpDeviceData.render_batch.lock
+    LOCK_CLASS_COUNT
+} LockClass;
+
+void        lockprof_initialize(void);
+void        lockprof_report(void);
+uint64_t    lockprof_now(void);
+void        lockprof_record_wait(LockClass lock_class, uint64_t started_at);
+void        lockprof_record_hold(LockClass lock_class, uint64_t acquired_at);
+
+/** @brief lock mutex, recording wait time when LockProfile quirk is enabled
+
+    @return time lock was acquired at, or 0 if profiling is disabled. Pass it to
+        lockprof_mutex_unlock() to record hold time.
+*/
+static inline
+uint64_t
+lockprof_mutex_lock(pthread_mutex_t *mutex, LockClass lock_class)
+{
+    if (!global.quirks.lock_profile) {
+        pthread_mutex_lock(mutex);
+        return 0;
+    }
+    const uint64_t started_at = lockprof_now();
+    pthread_mutex_lock(mutex);
+    lockprof_record_wait(lock_class, started_at);
+    return lockprof_now();
+}
+
+static inline
+void
+lockprof_mutex_unlock(pthread_mutex_t *mutex, LockClass lock_class, uint64_t acquired_at)
+{
+    if (acquired_at)
+        lockprof_record_hold(lock_class, acquired_at);
+    pthread_mutex_unlock(mutex);
+}
+
+#endif /* __LOCK_PROFILER_H */
@@ -0,0 +1,55 @@
+// test-011
+
+// Create and destroy bitmap surfaces many times a row, keeping every destroyed
+// handle. Slots get recycled, but none of the old handles should ever be accepted
+// again, neither should handle of one type be accepted as handle of another.
+
+// TOUCHES: VdpBitmapSurfaceCreate
+// TOUCHES: VdpBitmapSurfaceDestroy
+// TOUCHES: VdpBitmapSurfaceGetParameters
+
+#include "vdpau-init.h"
+#include <stdio.h>
+
+#define ROUNDS  2000
+
+int main(void)
+{
+    VdpDevice device;
+    VdpBitmapSurface stale[ROUNDS];
+    VdpBitmapSurface bmp_surf;
+    VdpOutputSurface out_surf;
+    uint32_t width, height;
+    VdpBool fa;
+    VdpRGBAFormat rgba_f;
+
+    ASSERT_OK(vdpau_init_functions(&device, NULL, 0));
+
+    for (int k = 0; k < ROUNDS; k ++) {
+        ASSERT_OK(vdp_bitmap_surface_create(device, VDP_RGBA_FORMAT_B8G8R8A8, 16, 16, 1,
+                                            &stale[k]));
+        ASSERT_OK(vdp_bitmap_surface_destroy(stale[k]));
+    }
+
+    // table should not grow, but previously issued handles must stay invalid
+    ASSERT_OK(vdp_bitmap_surface_create(device, VDP_RGBA_FORMAT_B8G8R8A8, 16, 16, 1, &bmp_surf));
+    ASSERT_OK(vdp_output_surface_create(device, VDP_RGBA_FORMAT_B8G8R8A8, 16, 16, &out_surf));
+    for (int k = 0; k < ROUNDS; k ++) {
+        assert(stale[k] != bmp_surf);
+        assert(VDP_STATUS_INVALID_HANDLE ==
+                vdp_bitmap_surface_get_parameters(stale[k], &rgba_f, &width, &height, &fa));
+        assert(VDP_STATUS_INVALID_HANDLE == vdp_bitmap_surface_destroy(stale[k]));
+    }
+
+    ASSERT_OK(vdp_bitmap_surface_get_parameters(bmp_surf, &rgba_f, &width, &height, &fa));
+    assert(VDP_STATUS_INVALID_HANDLE ==
+            vdp_bitmap_surface_get_parameters(out_surf, &rgba_f, &width, &height, &fa));
+    assert(VDP_STATUS_INVALID_HANDLE == vdp_output_surface_destroy(bmp_surf));
+
+    ASSERT_OK(vdp_output_surface_destroy(out_surf));
+    ASSERT_OK(vdp_bitmap_surface_destroy(bmp_surf));
+    ASSERT_OK(vdp_device_destroy(device));
+
+    printf("pass\n");
+    return 0;
+}
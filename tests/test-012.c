@@ -0,0 +1,54 @@
+// test-012
+
+// Destroy device while it still has child objects of every kind. Library should
+// destroy them itself, in proper order, and should not touch children of other device.
+
+// TOUCHES: VdpDeviceDestroy
+
+#include "vdpau-init.h"
+#include <stdio.h>
+
+int main(void)
+{
+    VdpDevice device, device2;
+    VdpOutputSurface out_surf[3];
+    VdpBitmapSurface bmp_surf[3];
+    VdpVideoSurface vid_surf[3];
+    VdpVideoMixer mixer;
+    VdpOutputSurface other_surf;
+    VdpRGBAFormat rgba_f;
+    uint32_t width, height;
+
+    ASSERT_OK(vdpau_init_functions(&device, NULL, 0));
+    ASSERT_OK(vdpau_init_functions(&device2, NULL, 0));
+
+    for (int k = 0; k < 3; k ++) {
+        ASSERT_OK(vdp_output_surface_create(device, VDP_RGBA_FORMAT_B8G8R8A8, 32, 32,
+                                            &out_surf[k]));
+        ASSERT_OK(vdp_bitmap_surface_create(device, VDP_RGBA_FORMAT_A8, 32, 32, 1, &bmp_surf[k]));
+        ASSERT_OK(vdp_video_surface_create(device, VDP_CHROMA_TYPE_420, 32, 32, &vid_surf[k]));
+    }
+    ASSERT_OK(vdp_video_mixer_create(device, 0, NULL, 0, NULL, NULL, &mixer));
+    ASSERT_OK(vdp_output_surface_create(device2, VDP_RGBA_FORMAT_B8G8R8A8, 32, 32, &other_surf));
+
+    // destroy one surface by hand, leave others leaked
+    ASSERT_OK(vdp_output_surface_destroy(out_surf[1]));
+
+    ASSERT_OK(vdp_device_destroy(device));
+
+    // children are gone
+    for (int k = 0; k < 3; k ++) {
+        assert(VDP_STATUS_INVALID_HANDLE ==
+                vdp_output_surface_get_parameters(out_surf[k], &rgba_f, &width, &height));
+        assert(VDP_STATUS_INVALID_HANDLE == vdp_bitmap_surface_destroy(bmp_surf[k]));
+        assert(VDP_STATUS_INVALID_HANDLE == vdp_video_surface_destroy(vid_surf[k]));
+    }
+    assert(VDP_STATUS_INVALID_HANDLE == vdp_video_mixer_destroy(mixer));
+
+    // other device's objects are intact
+    ASSERT_OK(vdp_output_surface_get_parameters(other_surf, &rgba_f, &width, &height));
+    ASSERT_OK(vdp_device_destroy(device2));
+
+    printf("pass\n");
+    return 0;
+}
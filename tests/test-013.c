@@ -0,0 +1,186 @@
+// test-013
+
+// Run with GLThread quirk. Rendering calls return before GL work is done, so check that
+// source buffers are copied at call time and that GetBitsNative sees results of all calls
+// made before it. Also check that errors detectable at call time are still reported.
+// Then do the same from several threads at once, sharing one GL thread.
+
+// TOUCHES: VdpOutputSurfacePutBitsNative
+// TOUCHES: VdpOutputSurfaceRenderOutputSurface
+// TOUCHES: VdpOutputSurfaceRenderBitmapSurface
+
+#include "vdpau-init.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIDTH       64
+#define HEIGHT      48
+#define ROUNDS      20
+#define THREADS     4
+
+static VdpOutputSurfaceRenderBlendState blend_state_opaque_copy = {
+    .struct_version = VDP_OUTPUT_SURFACE_RENDER_BLEND_STATE_VERSION,
+    .blend_factor_source_color = VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ONE,
+    .blend_factor_source_alpha = VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ONE,
+    .blend_factor_destination_color = VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ZERO,
+    .blend_factor_destination_alpha = VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ZERO,
+    .blend_equation_color = VDP_OUTPUT_SURFACE_RENDER_BLEND_EQUATION_ADD,
+    .blend_equation_alpha = VDP_OUTPUT_SURFACE_RENDER_BLEND_EQUATION_ADD,
+    .blend_constant = {0, 0, 0, 0}
+};
+
+struct thread_param {
+    VdpDevice   device;
+    int         id;
+    int         failed;
+};
+
+// each thread renders own pattern between its own surfaces, and reads result back right away
+static
+void *
+render_thread(void *p)
+{
+    struct thread_param *param = p;
+    VdpOutputSurface out_src, out_dst;
+    uint32_t src[WIDTH * HEIGHT];
+    uint32_t dst[WIDTH * HEIGHT];
+    const void * const source_data[] = { src };
+    void * const destination_data[] = { dst };
+    uint32_t pitches[] = { 4 * WIDTH };
+
+    param->failed = 1;
+    if (VDP_STATUS_OK != vdp_output_surface_create(param->device, VDP_RGBA_FORMAT_B8G8R8A8,
+                                                   WIDTH, HEIGHT, &out_src))
+        return NULL;
+    if (VDP_STATUS_OK != vdp_output_surface_create(param->device, VDP_RGBA_FORMAT_B8G8R8A8,
+                                                   WIDTH, HEIGHT, &out_dst))
+        return NULL;
+
+    for (int round = 0; round < 10 * ROUNDS; round ++) {
+        for (int k = 0; k < WIDTH * HEIGHT; k ++)
+            src[k] = 0xff000000 | (param->id << 16) | ((k + round) & 0xffff);
+        if (VDP_STATUS_OK != vdp_output_surface_put_bits_native(out_src, source_data, pitches,
+                                                                NULL))
+            return NULL;
+        if (VDP_STATUS_OK != vdp_output_surface_render_output_surface(out_dst, NULL, out_src,
+                NULL, NULL, &blend_state_opaque_copy, VDP_OUTPUT_SURFACE_RENDER_ROTATE_0))
+            return NULL;
+        if (VDP_STATUS_OK != vdp_output_surface_get_bits_native(out_dst, NULL, destination_data,
+                                                                pitches))
+            return NULL;
+        if (memcmp(src, dst, sizeof(src))) {
+            printf("fail / thread %d, round %d\n", param->id, round);
+            return NULL;
+        }
+    }
+
+    if (VDP_STATUS_OK != vdp_output_surface_destroy(out_src) ||
+        VDP_STATUS_OK != vdp_output_surface_destroy(out_dst))
+        return NULL;
+    param->failed = 0;
+    return NULL;
+}
+
+int main(void)
+{
+    VdpDevice device;
+    VdpOutputSurface out_src, out_dst;
+    VdpBitmapSurface bmp_surf;
+    ASSERT_OK(vdpau_init_functions(&device, NULL, 0));
+
+    ASSERT_OK(vdp_output_surface_create(device, VDP_RGBA_FORMAT_B8G8R8A8, WIDTH, HEIGHT, &out_src));
+    ASSERT_OK(vdp_output_surface_create(device, VDP_RGBA_FORMAT_B8G8R8A8, WIDTH, HEIGHT, &out_dst));
+    ASSERT_OK(vdp_bitmap_surface_create(device, VDP_RGBA_FORMAT_B8G8R8A8, WIDTH, HEIGHT, 0,
+                                        &bmp_surf));
+
+    uint32_t *src = malloc(4 * WIDTH * HEIGHT);
+    uint32_t *expected = malloc(4 * WIDTH * HEIGHT);
+    uint32_t *dst = malloc(4 * WIDTH * HEIGHT);
+    if (!src || !expected || !dst) {
+        printf("fail / malloc\n");
+        return 1;
+    }
+
+    const void * const source_data[] = { src };
+    void * const destination_data[] = { dst };
+    uint32_t pitches[] = { 4 * WIDTH };
+
+    for (int round = 0; round < ROUNDS; round ++) {
+        for (int k = 0; k < WIDTH * HEIGHT; k ++)
+            src[k] = 0xff000000 | ((k + round) & 0xff) << 8;
+        memcpy(expected, src, 4 * WIDTH * HEIGHT);
+
+        ASSERT_OK(vdp_output_surface_put_bits_native(out_src, source_data, pitches, NULL));
+        // application is free to reuse buffer as soon as call returns
+        memset(src, 0x55, 4 * WIDTH * HEIGHT);
+
+        ASSERT_OK(vdp_output_surface_render_output_surface(out_dst, NULL, out_src, NULL, NULL,
+                  &blend_state_opaque_copy, VDP_OUTPUT_SURFACE_RENDER_ROTATE_0));
+        ASSERT_OK(vdp_output_surface_get_bits_native(out_dst, NULL, destination_data, pitches));
+        if (memcmp(expected, dst, 4 * WIDTH * HEIGHT)) {
+            printf("fail / render output surface, round %d\n", round);
+            return 2;
+        }
+
+        ASSERT_OK(vdp_bitmap_surface_put_bits_native(bmp_surf, source_data, pitches, NULL));
+        ASSERT_OK(vdp_output_surface_render_bitmap_surface(out_dst, NULL, bmp_surf, NULL, NULL,
+                  &blend_state_opaque_copy, VDP_OUTPUT_SURFACE_RENDER_ROTATE_0));
+        ASSERT_OK(vdp_output_surface_get_bits_native(out_dst, NULL, destination_data, pitches));
+        if (memcmp(src, dst, 4 * WIDTH * HEIGHT)) {
+            printf("fail / render bitmap surface, round %d\n", round);
+            return 3;
+        }
+    }
+
+    // errors that do not need GL should be returned right away
+    VdpOutputSurfaceRenderBlendState bad_blend_state = blend_state_opaque_copy;
+    bad_blend_state.struct_version = VDP_OUTPUT_SURFACE_RENDER_BLEND_STATE_VERSION + 1;
+    if (VDP_STATUS_INVALID_VALUE != vdp_output_surface_render_bitmap_surface(out_dst, NULL,
+            bmp_surf, NULL, NULL, &bad_blend_state, VDP_OUTPUT_SURFACE_RENDER_ROTATE_0))
+    {
+        printf("fail / blend state version\n");
+        return 4;
+    }
+    if (VDP_STATUS_INVALID_HANDLE != vdp_output_surface_put_bits_native(bmp_surf, source_data,
+            pitches, NULL))
+    {
+        printf("fail / handle type\n");
+        return 5;
+    }
+
+    // submissions from different threads interleave, but each thread's readback must still
+    // see all of its own calls made before it
+    pthread_t threads[THREADS];
+    struct thread_param params[THREADS];
+    for (int k = 0; k < THREADS; k ++) {
+        params[k].device = device;
+        params[k].id = k;
+        params[k].failed = 1;
+        if (0 != pthread_create(&threads[k], NULL, render_thread, &params[k])) {
+            printf("fail / pthread_create\n");
+            return 6;
+        }
+    }
+    for (int k = 0; k < THREADS; k ++)
+        pthread_join(threads[k], NULL);
+    for (int k = 0; k < THREADS; k ++) {
+        if (params[k].failed) {
+            printf("fail / thread %d\n", k);
+            return 7;
+        }
+    }
+
+    ASSERT_OK(vdp_output_surface_destroy(out_src));
+    ASSERT_OK(vdp_output_surface_destroy(out_dst));
+    ASSERT_OK(vdp_bitmap_surface_destroy(bmp_surf));
+    ASSERT_OK(vdp_device_destroy(device));
+
+    free(src);
+    free(expected);
+    free(dst);
+
+    printf("pass\n");
+    return 0;
+}
@@ -8,7 +8,6 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include "ctx-stack.h"
 #include "h264-parse.h"
 #include "vdpau-trace.h"
 #include "vdpau-soft.h"
@@ -49,6 +48,8 @@ softVdpDecoderCreate(VdpDevice device, VdpDecoderProfile profile, uint32_t width
     int final_try = 0;
     VdpDecoderProfile next_profile = profile;
 
+    va_display_lock(deviceData);
+
     // Try to create decoder for asked profile. On failure try to create more advanced one
     while (! final_try) {
         profile = next_profile;
@@ -73,7 +74,7 @@ softVdpDecoderCreate(VdpDevice device, VdpDecoderProfile profile, uint32_t width
             traceError("error (softVdpDecoderCreate): decoder %s not implemented\n",
                        reverse_decoder_profile(profile));
             err_code = VDP_STATUS_INVALID_DECODER_PROFILE;
-            goto quit_free_data;
+            goto quit_unlock;
         }
 
         status = vaCreateConfig(va_dpy, va_profile, VAEntrypointVLD, NULL, 0, &data->config_id);
@@ -83,7 +84,7 @@ softVdpDecoderCreate(VdpDevice device, VdpDecoderProfile profile, uint32_t width
 
     if (VA_STATUS_SUCCESS != status) {
         err_code = VDP_STATUS_ERROR;
-        goto quit_free_data;
+        goto quit_unlock;
     }
 
     // Create surfaces. All video surfaces created here, rather than in VdpVideoSurfaceCreate.
@@ -101,22 +102,35 @@ softVdpDecoderCreate(VdpDevice device, VdpDecoderProfile profile, uint32_t width
 #endif
     if (VA_STATUS_SUCCESS != status) {
         err_code = VDP_STATUS_ERROR;
-        goto quit_free_data;
+        goto quit_unlock;
     }
 
     status = vaCreateContext(va_dpy, data->config_id, width, height, VA_PROGRESSIVE,
         data->render_targets, data->num_render_targets, &data->context_id);
+    va_display_unlock(deviceData);
     if (VA_STATUS_SUCCESS != status) {
         err_code = VDP_STATUS_ERROR;
         goto quit_free_data;
     }
 
+    *decoder = handle_insert_child(data, &deviceData->children);
+    if (VDP_INVALID_HANDLE == *decoder) {
+        // out of handles
+        va_display_lock(deviceData);
+        vaDestroyContext(va_dpy, data->context_id);
+        vaDestroySurfaces(va_dpy, data->render_targets, data->num_render_targets);
+        vaDestroyConfig(va_dpy, data->config_id);
+        va_display_unlock(deviceData);
+        err_code = VDP_STATUS_RESOURCES;
+        goto quit_free_data;
+    }
     deviceData->refcount ++;
-    *decoder = handle_insert(data);
 
     err_code = VDP_STATUS_OK;
     goto quit;
 
+quit_unlock:
+    va_display_unlock(deviceData);
 quit_free_data:
     free(data);
 quit:
@@ -134,9 +148,11 @@ softVdpDecoderDestroy(VdpDecoder decoder)
 
     if (deviceData->va_available) {
         VADisplay va_dpy = deviceData->va_dpy;
+        va_display_lock(deviceData);
         vaDestroySurfaces(va_dpy, decoderData->render_targets, decoderData->num_render_targets);
         vaDestroyContext(va_dpy, decoderData->context_id);
         vaDestroyConfig(va_dpy, decoderData->config_id);
+        va_display_unlock(deviceData);
     }
 
     handle_expunge(decoder);
@@ -151,7 +167,7 @@ softVdpDecoderGetParameters(VdpDecoder decoder, VdpDecoderProfile *profile,
 {
     if (!profile || !width || !height)
         return VDP_STATUS_INVALID_HANDLE;
-    VdpDecoderData *decoderData = handle_acquire(decoder, HANDLETYPE_DECODER);
+    VdpDecoderData *decoderData = handle_acquire_shared(decoder, HANDLETYPE_DECODER);
     if (!decoderData)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -159,13 +175,22 @@ softVdpDecoderGetParameters(VdpDecoder decoder, VdpDecoderProfile *profile,
     *width   = decoderData->width;
     *height  = decoderData->height;
 
-    handle_release(decoder);
+    handle_release_shared(decoder);
     return VDP_STATUS_OK;
 }
 
+static inline
+int
+h264_num_ref_frames(const VdpPictureInfoH264 *vdppi)
+{
+    const int max_refs = sizeof(vdppi->referenceFrames)/sizeof(vdppi->referenceFrames[0]);
+    return (vdppi->num_ref_frames < max_refs) ? vdppi->num_ref_frames : max_refs;
+}
+
 static
 VdpStatus
 h264_translate_reference_frames(VdpVideoSurfaceData *dstSurfData, VdpDecoderData *decoderData,
+                                VdpVideoSurfaceData *const *refSurfData,
                                 VAPictureParameterBufferH264 *pic_param,
                                 const VdpPictureInfoH264 *vdppi)
 {
@@ -193,16 +218,15 @@ h264_translate_reference_frames(VdpVideoSurfaceData *dstSurfData, VdpDecoderData
     for (int k = 0; k < 16; k ++)
         reset_va_picture_h264(&pic_param->ReferenceFrames[k]);
 
-    // reference frames
-    for (int k = 0; k < vdppi->num_ref_frames; k ++) {
+    // reference frames. They were acquired by caller along with decoder and target
+    for (int k = 0; k < h264_num_ref_frames(vdppi); k ++) {
         if (VDP_INVALID_HANDLE == vdppi->referenceFrames[k].surface) {
             reset_va_picture_h264(&pic_param->ReferenceFrames[k]);
             continue;
         }
 
         VdpReferenceFrameH264 const *vdp_ref = &(vdppi->referenceFrames[k]);
-        VdpVideoSurfaceData *vdpSurfData =
-            handle_acquire(vdp_ref->surface, HANDLETYPE_VIDEO_SURFACE);
+        VdpVideoSurfaceData *vdpSurfData = refSurfData[k];
         VAPictureH264 *va_ref = &(pic_param->ReferenceFrames[k]);
         if (NULL == vdpSurfData) {
             traceError("error (h264_translate_reference_frames): NULL == vdpSurfData");
@@ -233,7 +257,6 @@ h264_translate_reference_frames(VdpVideoSurfaceData *dstSurfData, VdpDecoderData
 
         va_ref->TopFieldOrderCnt    = vdp_ref->field_order_cnt[0];
         va_ref->BottomFieldOrderCnt = vdp_ref->field_order_cnt[1];
-        handle_release(vdp_ref->surface);
     }
 
     return VDP_STATUS_OK;
@@ -457,6 +480,7 @@ h264_translate_iq_matrix(VAIQMatrixBufferH264 *iq_matrix, const VdpPictureInfoH2
 static
 VdpStatus
 softVdpDecoderRender_h264(VdpDecoderData *decoderData, VdpVideoSurfaceData *dstSurfData,
+                          VdpVideoSurfaceData *const *refSurfData,
                           VdpPictureInfo const *picture_info, uint32_t bitstream_buffer_count,
                           VdpBitstreamBuffer const *bitstream_buffers)
 {
@@ -474,7 +498,8 @@ softVdpDecoderRender_h264(VdpDecoderData *decoderData, VdpVideoSurfaceData *dstS
     VAPictureParameterBufferH264 pic_param;
     VAIQMatrixBufferH264 iq_matrix;
 
-    vs = h264_translate_reference_frames(dstSurfData, decoderData, &pic_param, vdppi);
+    vs = h264_translate_reference_frames(dstSurfData, decoderData, refSurfData, &pic_param,
+                                         vdppi);
     if (VDP_STATUS_OK != vs) {
         if (VDP_STATUS_RESOURCES == vs) {
             traceError("error (softVdpDecoderRender): no surfaces left in buffer\n");
@@ -488,11 +513,11 @@ softVdpDecoderRender_h264(VdpDecoderData *decoderData, VdpVideoSurfaceData *dstS
     h264_translate_pic_param(&pic_param, decoderData->width, decoderData->height, vdppi, level);
     h264_translate_iq_matrix(&iq_matrix, vdppi);
 
-    glx_context_lock();
+    va_display_lock(deviceData);
     status = vaCreateBuffer(va_dpy, decoderData->context_id, VAPictureParameterBufferType,
         sizeof(VAPictureParameterBufferH264), 1, &pic_param, &pic_param_buf);
     if (VA_STATUS_SUCCESS != status) {
-        glx_context_unlock();
+        va_display_unlock(deviceData);
         err_code = VDP_STATUS_ERROR;
         goto quit;
     }
@@ -500,7 +525,7 @@ softVdpDecoderRender_h264(VdpDecoderData *decoderData, VdpVideoSurfaceData *dstS
     status = vaCreateBuffer(va_dpy, decoderData->context_id, VAIQMatrixBufferType,
         sizeof(VAIQMatrixBufferH264), 1, &iq_matrix, &iq_matrix_buf);
     if (VA_STATUS_SUCCESS != status) {
-        glx_context_unlock();
+        va_display_unlock(deviceData);
         err_code = VDP_STATUS_ERROR;
         goto quit;
     }
@@ -508,26 +533,26 @@ softVdpDecoderRender_h264(VdpDecoderData *decoderData, VdpVideoSurfaceData *dstS
     // send data to decoding hardware
     status = vaBeginPicture(va_dpy, decoderData->context_id, dstSurfData->va_surf);
     if (VA_STATUS_SUCCESS != status) {
-        glx_context_unlock();
+        va_display_unlock(deviceData);
         err_code = VDP_STATUS_ERROR;
         goto quit;
     }
     status = vaRenderPicture(va_dpy, decoderData->context_id, &pic_param_buf, 1);
     if (VA_STATUS_SUCCESS != status) {
-        glx_context_unlock();
+        va_display_unlock(deviceData);
         err_code = VDP_STATUS_ERROR;
         goto quit;
     }
     status = vaRenderPicture(va_dpy, decoderData->context_id, &iq_matrix_buf, 1);
     if (VA_STATUS_SUCCESS != status) {
-        glx_context_unlock();
+        va_display_unlock(deviceData);
         err_code = VDP_STATUS_ERROR;
         goto quit;
     }
 
     vaDestroyBuffer(va_dpy, pic_param_buf);
     vaDestroyBuffer(va_dpy, iq_matrix_buf);
-    glx_context_unlock();
+    va_display_unlock(deviceData);
 
     // merge bitstream buffers
     int total_bitstream_bytes = 0;
@@ -589,17 +614,17 @@ softVdpDecoderRender_h264(VdpDecoderData *decoderData, VdpVideoSurfaceData *dstS
                            vdppi->num_ref_idx_l1_active_minus1, &sp_h264);
 
         VABufferID slice_parameters_buf;
-        glx_context_lock();
+        va_display_lock(deviceData);
         status = vaCreateBuffer(va_dpy, decoderData->context_id, VASliceParameterBufferType,
             sizeof(VASliceParameterBufferH264), 1, &sp_h264, &slice_parameters_buf);
         if (VA_STATUS_SUCCESS != status) {
-            glx_context_unlock();
+            va_display_unlock(deviceData);
             err_code = VDP_STATUS_ERROR;
             goto quit;
         }
         status = vaRenderPicture(va_dpy, decoderData->context_id, &slice_parameters_buf, 1);
         if (VA_STATUS_SUCCESS != status) {
-            glx_context_unlock();
+            va_display_unlock(deviceData);
             err_code = VDP_STATUS_ERROR;
             goto quit;
         }
@@ -608,30 +633,30 @@ softVdpDecoderRender_h264(VdpDecoderData *decoderData, VdpVideoSurfaceData *dstS
         status = vaCreateBuffer(va_dpy, decoderData->context_id, VASliceDataBufferType,
             sp_h264.slice_data_size, 1, merged_bitstream + nal_offset, &slice_buf);
         if (VA_STATUS_SUCCESS != status) {
-            glx_context_unlock();
+            va_display_unlock(deviceData);
             err_code = VDP_STATUS_ERROR;
             goto quit;
         }
 
         status = vaRenderPicture(va_dpy, decoderData->context_id, &slice_buf, 1);
         if (VA_STATUS_SUCCESS != status) {
-            glx_context_unlock();
+            va_display_unlock(deviceData);
             err_code = VDP_STATUS_ERROR;
             goto quit;
         }
 
         vaDestroyBuffer(va_dpy, slice_parameters_buf);
         vaDestroyBuffer(va_dpy, slice_buf);
-        glx_context_unlock();
+        va_display_unlock(deviceData);
 
         if (nal_offset_next < 0)        // nal_offset_next equals -1 when there is no slice
             break;                      // start code found. Thus that was the final slice.
         nal_offset = nal_offset_next;
     } while (1);
 
-    glx_context_lock();
+    va_display_lock(deviceData);
     status = vaEndPicture(va_dpy, decoderData->context_id);
-    glx_context_unlock();
+    va_display_unlock(deviceData);
     if (VA_STATUS_SUCCESS != status) {
         err_code = VDP_STATUS_ERROR;
         goto quit;
@@ -651,20 +676,47 @@ softVdpDecoderRender(VdpDecoder decoder, VdpVideoSurface target,
     VdpStatus err_code;
     if (!picture_info || !bitstream_buffers)
         return VDP_STATUS_INVALID_POINTER;
-    VdpDecoderData *decoderData = handle_acquire(decoder, HANDLETYPE_DECODER);
-    VdpVideoSurfaceData *dstSurfData = handle_acquire(target, HANDLETYPE_VIDEO_SURFACE);
+
+    // profile never changes, peek at it to find out which surfaces are involved
+    VdpDecoderData *decoderData = handle_acquire_shared(decoder, HANDLETYPE_DECODER);
+    if (NULL == decoderData)
+        return VDP_STATUS_INVALID_HANDLE;
+    const VdpDecoderProfile profile = decoderData->profile;
+    handle_release_shared(decoder);
+    const int is_h264 = VDP_DECODER_PROFILE_H264_BASELINE == profile ||
+                        VDP_DECODER_PROFILE_H264_MAIN ==     profile ||
+                        VDP_DECODER_PROFILE_H264_HIGH ==     profile;
+
+    // pending mixer commands may still read target's previous contents
+    sync_deferred_gl(target, HANDLETYPE_VIDEO_SURFACE);
+
+    // decoder, target and reference frames are locked together, in one pass
+    uint32_t handles[2 + 16];
+    HandleType types[2 + 16];
+    void *objs[2 + 16];
+    int count = 0;
+    handles[count] = decoder;   types[count ++] = HANDLETYPE_DECODER;
+    handles[count] = target;    types[count ++] = HANDLETYPE_VIDEO_SURFACE;
+    if (is_h264) {
+        VdpPictureInfoH264 const *vdppi = (void *)picture_info;
+        for (int k = 0; k < h264_num_ref_frames(vdppi); k ++) {
+            handles[count] = vdppi->referenceFrames[k].surface;
+            types[count ++] = HANDLETYPE_VIDEO_SURFACE;
+        }
+    }
+    handle_acquire_many(count, handles, types, objs);
+
+    decoderData = objs[0];
+    VdpVideoSurfaceData *dstSurfData = objs[1];
     if (NULL == decoderData || NULL == dstSurfData) {
         err_code = VDP_STATUS_INVALID_HANDLE;
         goto quit;
     }
 
-    if (VDP_DECODER_PROFILE_H264_BASELINE == decoderData->profile ||
-        VDP_DECODER_PROFILE_H264_MAIN ==     decoderData->profile ||
-        VDP_DECODER_PROFILE_H264_HIGH ==     decoderData->profile)
-    {
+    if (is_h264) {
         // TODO: check exit code
-        softVdpDecoderRender_h264(decoderData, dstSurfData, picture_info, bitstream_buffer_count,
-                                  bitstream_buffers);
+        softVdpDecoderRender_h264(decoderData, dstSurfData, (VdpVideoSurfaceData **)&objs[2],
+                                  picture_info, bitstream_buffer_count, bitstream_buffers);
     } else {
         traceError("error (softVdpDecoderRender): no implementation for profile %s\n",
                    reverse_decoder_profile(decoderData->profile));
@@ -674,7 +726,6 @@ softVdpDecoderRender(VdpDecoder decoder, VdpVideoSurface target,
 
     err_code = VDP_STATUS_OK;
 quit:
-    handle_release(decoder);
-    handle_release(target);
+    handle_release_many(count, handles, objs);
     return err_code;
 }
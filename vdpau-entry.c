@@ -17,6 +17,7 @@
 #include "vdpau-soft.h"
 #include "vdpau-trace.h"
 #include "globals.h"
+#include "lock-profiler.h"
 
 #include <sys/syscall.h>
 #include <unistd.h>
@@ -66,6 +67,12 @@ initialize_quirks(void)
     global.quirks.log_pq_delay = 0;
     global.quirks.log_timestamp = 0;
     global.quirks.avoid_va = 0;
+    global.quirks.lock_spin = 0;
+    global.quirks.lock_profile = 0;
+    global.quirks.sticky_context = 0;
+    global.quirks.gl_thread = 0;
+    global.quirks.egl = 0;
+    global.quirks.sync_gl_errors = 0;
 
     const char *value = getenv("VDPAU_QUIRKS");
     if (!value)
@@ -107,6 +114,24 @@ initialize_quirks(void)
             } else
             if (!strcmp("avoidva", item_start)) {
                 global.quirks.avoid_va = 1;
+            } else
+            if (!strcmp("lockspin", item_start)) {
+                global.quirks.lock_spin = 1;
+            } else
+            if (!strcmp("lockprofile", item_start)) {
+                global.quirks.lock_profile = 1;
+            } else
+            if (!strcmp("stickycontext", item_start)) {
+                global.quirks.sticky_context = 1;
+            } else
+            if (!strcmp("glthread", item_start)) {
+                global.quirks.gl_thread = 1;
+            } else
+            if (!strcmp("egl", item_start)) {
+                global.quirks.egl = 1;
+            } else
+            if (!strcmp("syncglerrors", item_start)) {
+                global.quirks.sync_gl_errors = 1;
             }
 
             item_start = ptr + 1;
@@ -129,6 +154,7 @@ library_constructor(void)
     // Initialize global data
     pthread_mutex_init(&global.glx_ctx_stack_mutex, NULL);
     initialize_quirks();
+    lockprof_initialize();
 
     // initialize tracer
     traceSetTarget(stdout);
@@ -163,6 +189,7 @@ static
 void
 library_destructor(void)
 {
+    lockprof_report();
     handle_destory_storage();
 }
 
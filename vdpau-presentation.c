@@ -16,6 +16,8 @@
 #include <vdpau/vdpau.h>
 #include <GL/gl.h>
 #include "ctx-stack.h"
+#include "gl-render.h"
+#include "gl-state.h"
 #include "globals.h"
 #include "handle-storage.h"
 #include "vdpau-soft.h"
@@ -48,26 +50,29 @@ softVdpPresentationQueueBlockUntilSurfaceIdle(VdpPresentationQueue presentation_
     if (!first_presentation_time)
         return VDP_STATUS_INVALID_POINTER;
     VdpPresentationQueueData *pqData =
-        handle_acquire(presentation_queue, HANDLETYPE_PRESENTATION_QUEUE);
+        handle_acquire_shared(presentation_queue, HANDLETYPE_PRESENTATION_QUEUE);
     if (NULL == pqData)
         return VDP_STATUS_INVALID_HANDLE;
-    handle_release(presentation_queue);
+    handle_release_shared(presentation_queue);
 
-    VdpOutputSurfaceData *surfData = handle_acquire(surface, HANDLETYPE_OUTPUT_SURFACE);
+    VdpOutputSurfaceData *surfData = handle_acquire_shared(surface, HANDLETYPE_OUTPUT_SURFACE);
     if (NULL == surfData)
         return VDP_STATUS_INVALID_HANDLE;
 
     // TODO: use locking instead of busy loop
-    while (surfData->status != VDP_PRESENTATION_QUEUE_STATUS_IDLE) {
-        handle_release(surface);
+    while (__atomic_load_n(&surfData->status, __ATOMIC_ACQUIRE) !=
+           VDP_PRESENTATION_QUEUE_STATUS_IDLE)
+    {
+        handle_release_shared(surface);
         usleep(1000);
-        surfData = handle_acquire(surface, HANDLETYPE_OUTPUT_SURFACE);
+        surfData = handle_acquire_shared(surface, HANDLETYPE_OUTPUT_SURFACE);
         if (!surfData)
             return VDP_STATUS_ERROR;
     }
 
-    *first_presentation_time = surfData->first_presentation_time;
-    handle_release(surface);
+    *first_presentation_time = __atomic_load_n(&surfData->first_presentation_time,
+                                               __ATOMIC_RELAXED);
+    handle_release_shared(surface);
     return VDP_STATUS_OK;
 }
 
@@ -79,21 +84,24 @@ softVdpPresentationQueueQuerySurfaceStatus(VdpPresentationQueue presentation_que
 {
     if (!status || !first_presentation_time)
         return VDP_STATUS_INVALID_POINTER;
+    // Only status fields are read, and they are updated atomically, so there is no need
+    // to wait for mixer or presentation thread to finish with the surface.
     VdpPresentationQueueData *pqData =
-        handle_acquire(presentation_queue, HANDLETYPE_PRESENTATION_QUEUE);
+        handle_acquire_shared(presentation_queue, HANDLETYPE_PRESENTATION_QUEUE);
     if (NULL == pqData)
         return VDP_STATUS_INVALID_HANDLE;
-    VdpOutputSurfaceData *surfData = handle_acquire(surface, HANDLETYPE_OUTPUT_SURFACE);
+    VdpOutputSurfaceData *surfData = handle_acquire_shared(surface, HANDLETYPE_OUTPUT_SURFACE);
     if (NULL == surfData) {
-        handle_release(presentation_queue);
+        handle_release_shared(presentation_queue);
         return VDP_STATUS_INVALID_HANDLE;
     }
 
-    *status = surfData->status;
-    *first_presentation_time = surfData->first_presentation_time;
+    *status = __atomic_load_n(&surfData->status, __ATOMIC_ACQUIRE);
+    *first_presentation_time = __atomic_load_n(&surfData->first_presentation_time,
+                                               __ATOMIC_RELAXED);
 
-    handle_release(presentation_queue);
-    handle_release(surface);
+    handle_release_shared(presentation_queue);
+    handle_release_shared(surface);
 
     return VDP_STATUS_OK;
 }
@@ -118,69 +126,58 @@ do_presentation_queue_display(VdpPresentationQueueData *pqData)
     pqData->queue.head = pqData->queue.item[pqData->queue.head].next;
     pthread_mutex_unlock(&pqData->queue_mutex);
 
+    sync_deferred_gl(surface, HANDLETYPE_OUTPUT_SURFACE);
     VdpOutputSurfaceData *surfData = handle_acquire(surface, HANDLETYPE_OUTPUT_SURFACE);
     if (surfData == NULL)
         return;
 
-    glx_context_push_global(deviceData->display, pqData->target->drawable, pqData->target->glc);
+    glx_context_push_target(deviceData, pqData->target);
+    glx_context_fence_wait(&surfData->fence);
 
     const uint32_t target_width  = (clip_width > 0)  ? clip_width  : surfData->width;
     const uint32_t target_height = (clip_height > 0) ? clip_height : surfData->height;
 
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glOrtho(0, target_width, target_height, 0, -1.0, 1.0);
-    glViewport(0, 0, target_width, target_height);
-
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-
-    glMatrixMode(GL_TEXTURE);
-    glLoadIdentity();
-    glScalef(1.0f/surfData->width, 1.0f/surfData->height, 1.0f);
-
-    glEnable(GL_TEXTURE_2D);
-    glDisable(GL_BLEND);
-    glBindTexture(GL_TEXTURE_2D, surfData->tex_id);
-    glColor4f(1, 1, 1, 1);
-    glBegin(GL_QUADS);
-        glTexCoord2i(0, 0);                        glVertex2i(0, 0);
-        glTexCoord2i(target_width, 0);             glVertex2i(target_width, 0);
-        glTexCoord2i(target_width, target_height); glVertex2i(target_width, target_height);
-        glTexCoord2i(0, target_height);            glVertex2i(0, target_height);
-    glEnd();
-
-    if (global.quirks.show_watermark) {
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        glBlendEquation(GL_FUNC_ADD);
-        glBindTexture(GL_TEXTURE_2D, deviceData->watermark_tex_id);
-
-        glMatrixMode(GL_TEXTURE);
-        glLoadIdentity();
-
-        glColor3f(0.8, 0.08, 0.35);
-        glBegin(GL_QUADS);
-            glTexCoord2i(0, 0);
-            glVertex2i(target_width - watermark_width, target_height - watermark_height);
+    gl_render_set_target(target_width, target_height, 1);
+    gl_state_enable_blend(0);
 
-            glTexCoord2i(1, 0);
-            glVertex2i(target_width, target_height - watermark_height);
+    const GLRenderVertex frame[4] = {
+        { 0,            0,             0,            0,             1, 1, 1, 1 },
+        { target_width, 0,             target_width, 0,             1, 1, 1, 1 },
+        { target_width, target_height, target_width, target_height, 1, 1, 1, 1 },
+        { 0,            target_height, 0,            target_height, 1, 1, 1, 1 },
+    };
+    gl_render_set_texture(surfData->tex_id, surfData->width, surfData->height);
+    gl_render_quad(frame);
 
-            glTexCoord2i(1, 1);
-            glVertex2i(target_width, target_height);
-
-            glTexCoord2i(0, 1);
-            glVertex2i(target_width - watermark_width, target_height);
-        glEnd();
+    if (global.quirks.show_watermark) {
+        gl_state_enable_blend(1);
+        gl_state_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
+                            GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        gl_state_blend_equation(GL_FUNC_ADD, GL_FUNC_ADD);
+        glx_context_fence_wait(&deviceData->watermark_fence);
+
+        const float x0 = target_width - watermark_width;
+        const float y0 = target_height - watermark_height;
+        const GLRenderVertex watermark[4] = {
+            { x0,           y0,            0, 0, 0.8, 0.08, 0.35, 1 },
+            { target_width, y0,            1, 0, 0.8, 0.08, 0.35, 1 },
+            { target_width, target_height, 1, 1, 0.8, 0.08, 0.35, 1 },
+            { x0,           target_height, 0, 1, 0.8, 0.08, 0.35, 1 },
+        };
+        // coordinates are normalized already
+        gl_render_set_texture(deviceData->watermark_tex_id, 1, 1);
+        gl_render_quad(watermark);
     }
 
-    glXSwapBuffers(deviceData->display, pqData->target->drawable);
+    // surface may be drawn to as soon as handle is released, make later writers wait for us
+    glx_context_fence_insert(&surfData->fence);
+
+    glx_context_swap_buffers(deviceData, pqData->target);
 
     struct timespec now;
     clock_gettime(CLOCK_REALTIME, &now);
-    surfData->first_presentation_time = timespec2vdptime(now);
-    surfData->status = VDP_PRESENTATION_QUEUE_STATUS_IDLE;
+    __atomic_store_n(&surfData->first_presentation_time, timespec2vdptime(now), __ATOMIC_RELAXED);
+    __atomic_store_n(&surfData->status, VDP_PRESENTATION_QUEUE_STATUS_IDLE, __ATOMIC_RELEASE);
 
     if (global.quirks.log_pq_delay) {
             const int64_t delta = timespec2vdptime(now) - surfData->queued_at;
@@ -189,7 +186,7 @@ do_presentation_queue_display(VdpPresentationQueueData *pqData)
                       delta_ts.tv_sec, delta_ts.tv_nsec);
     }
 
-    GLenum gl_error = glGetError();
+    GLenum gl_error = gl_error_check(VDP_FUNC_ID_PRESENTATION_QUEUE_DISPLAY);
     glx_context_pop();
     handle_release(surface);
 
@@ -295,9 +292,16 @@ softVdpPresentationQueueCreate(VdpDevice device,
     data->bg_color.blue = 0.0;
     data->bg_color.alpha = 0.0;
 
+    *presentation_queue = handle_insert_child(data, &deviceData->children);
+    if (VDP_INVALID_HANDLE == *presentation_queue) {
+        // out of handles
+        free(data);
+        handle_release(device);
+        handle_release(presentation_queue_target);
+        return VDP_STATUS_RESOURCES;
+    }
     deviceData->refcount ++;
     targetData->refcount ++;
-    *presentation_queue = handle_insert(data);
 
     // initialize queue
     data->queue.head = -1;
@@ -332,14 +336,17 @@ softVdpPresentationQueueDestroy(VdpPresentationQueue presentation_queue)
         return VDP_STATUS_INVALID_HANDLE;
 
     pthread_cancel(pqData->worker_thread);
+    // Worker may be sleeping in handle_acquire() waiting for the lock we hold. That's not
+    // a cancellation point, so invalidate handle first: worker will wake up, fail to
+    // acquire queue and quit by itself.
+    handle_expunge(presentation_queue);
 
     if (0 != pthread_join(pqData->worker_thread, NULL)) {
+        // handle is already gone, leak queue data rather than free it under worker's feet
         traceError("VdpPresentationQueueDestroy: failed to stop worker thread");
-        handle_release(presentation_queue);
         return VDP_STATUS_ERROR;
     }
 
-    handle_expunge(presentation_queue);
     pqData->device->refcount --;
     pqData->target->refcount --;
 
@@ -443,8 +450,8 @@ softVdpPresentationQueueDisplay(VdpPresentationQueue presentation_queue, VdpOutp
     pqData->queue.item[new_item].clip_width = clip_width;
     pqData->queue.item[new_item].clip_height = clip_height;
     pqData->queue.item[new_item].surface = surface;
-    surfData->first_presentation_time = 0;
-    surfData->status = VDP_PRESENTATION_QUEUE_STATUS_QUEUED;
+    __atomic_store_n(&surfData->first_presentation_time, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&surfData->status, VDP_PRESENTATION_QUEUE_STATUS_QUEUED, __ATOMIC_RELEASE);
 
     // keep queue sorted
     if (pqData->queue.head == -1 ||
@@ -500,23 +507,24 @@ softVdpPresentationQueueTargetCreateX11(VdpDevice device, Drawable drawable,
     data->drawable = drawable;
     data->refcount = 0;
 
-    pthread_mutex_lock(&global.glx_ctx_stack_mutex);
-    GLint att[] = { GLX_RGBA, GLX_DEPTH_SIZE, 24, GLX_DOUBLEBUFFER, None };
-    XVisualInfo *vi;
-    vi = glXChooseVisual(deviceData->display, deviceData->screen, att);
-    if (NULL == vi) {
-        traceError("error (softVdpPresentationQueueTargetCreateX11): glXChooseVisual failed\n");
+    if (0 != glx_context_create_target(deviceData, data)) {
+        traceError("error (softVdpPresentationQueueTargetCreateX11): can't create GL context\n");
         free(data);
-        pthread_mutex_unlock(&global.glx_ctx_stack_mutex);
         handle_release(device);
         return VDP_STATUS_ERROR;
     }
 
-    // create context for dislaying result (can share display lists with deviceData->glc
-    data->glc = glXCreateContext(deviceData->display, vi, deviceData->root_glc, GL_TRUE);
+    *target = handle_insert_child(data, &deviceData->children);
+    if (VDP_INVALID_HANDLE == *target) {
+        // out of handles
+        glx_context_push_thread_local(deviceData);
+        glx_context_destroy_target(deviceData, data);
+        glx_context_pop();
+        free(data);
+        handle_release(device);
+        return VDP_STATUS_RESOURCES;
+    }
     deviceData->refcount ++;
-    *target = handle_insert(data);
-    pthread_mutex_unlock(&global.glx_ctx_stack_mutex);
 
     handle_release(device);
     return VDP_STATUS_OK;
@@ -540,9 +548,9 @@ softVdpPresentationQueueTargetDestroy(VdpPresentationQueueTarget presentation_qu
 
     // drawable may be destroyed already, so one should activate global context
     glx_context_push_thread_local(deviceData);
-    glXDestroyContext(deviceData->display, pqTargetData->glc);
+    glx_context_destroy_target(deviceData, pqTargetData);
 
-    GLenum gl_error = glGetError();
+    GLenum gl_error = gl_error_check(VDP_FUNC_ID_PRESENTATION_QUEUE_TARGET_DESTROY);
     glx_context_pop();
     if (GL_NO_ERROR != gl_error) {
         traceError("error (VdpPresentationQueueTargetDestroy): gl error %d\n", gl_error);
@@ -21,9 +21,14 @@
 #include <GL/glx.h>
 #include "bitstream.h"
 #include "ctx-stack.h"
+#include "gl-render.h"
+#include "gl-state.h"
+#include "gl-upload.h"
+#include "gl-worker.h"
 #include "h264-parse.h"
 #include "reverse-constant.h"
 #include "handle-storage.h"
+#include "lock-profiler.h"
 #include "vdpau-trace.h"
 #include "watermark.h"
 #include "globals.h"
@@ -91,7 +96,7 @@ softVdpOutputSurfaceQueryCapabilities(VdpDevice device, VdpRGBAFormat surface_rg
     GLint max_texture_size;
     glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
 
-    GLenum gl_error = glGetError();
+    GLenum gl_error = gl_error_check(VDP_FUNC_ID_OUTPUT_SURFACE_QUERY_CAPABILITIES);
     if (GL_NO_ERROR != gl_error) {
         traceError("error (VdpOutputSurfaceQueryCapabilities): gl error %d\n", gl_error);
         err_code = VDP_STATUS_ERROR;
@@ -138,6 +143,100 @@ softVdpOutputSurfaceQueryPutBitsYCbCrCapabilities(VdpDevice device,
     return VDP_STATUS_NO_IMPLEMENTATION;
 }
 
+/** @brief returns device object belongs to, or NULL if handle is invalid
+
+    Object is accessed in shared mode, so that call doesn't wait for object lock.
+*/
+static
+VdpDeviceData *
+handle_get_device_shared(uint32_t handle, HandleType type)
+{
+    VdpGenericHandle *obj = handle_acquire_shared(handle, type);
+    if (NULL == obj)
+        return NULL;
+    VdpDeviceData *deviceData = obj->parent;
+    handle_release_shared(handle);
+    return deviceData;
+}
+
+static
+void
+render_batch_flush_surface(uint32_t handle, HandleType type);
+
+/** @brief waits for GL commands deferred on device of the object
+
+    Batched render calls involving the object are drawn too.
+    Must be called before object lock is taken, as pending commands may need the lock.
+*/
+void
+sync_deferred_gl(uint32_t handle, HandleType type)
+{
+    VdpDeviceData *deviceData = handle_get_device_shared(handle, type);
+    if (deviceData && deviceData->gl_worker)
+        gl_worker_sync(deviceData->gl_worker);
+    if (HANDLETYPE_OUTPUT_SURFACE == type || HANDLETYPE_BITMAP_SURFACE == type)
+        render_batch_flush_surface(handle, type);
+}
+
+/** @brief serializes calls to VA display of the device
+
+    GLX lock is not needed for plain VA-API calls, so decoding doesn't wait for GL rendering.
+    GLX interop calls take GLX lock in addition, always after this one.
+*/
+void
+va_display_lock(VdpDeviceData *deviceData)
+{
+    uint64_t acquired_at = lockprof_mutex_lock(&deviceData->va_mutex, LOCK_CLASS_VA_DISPLAY);
+    deviceData->va_lock_acquired_at = acquired_at;
+}
+
+void
+va_display_unlock(VdpDeviceData *deviceData)
+{
+    lockprof_mutex_unlock(&deviceData->va_mutex, LOCK_CLASS_VA_DISPLAY,
+                          deviceData->va_lock_acquired_at);
+}
+
+/** @brief starts asynchronous readback of whole output surface into its pixel pack buffer
+
+    Must be called with GL context pushed. Leaves surface framebuffer bound.
+*/
+static
+void
+output_surface_start_readback(VdpOutputSurfaceData *surfData)
+{
+    const size_t row_bytes = surfData->width * surfData->bytes_per_pixel;
+
+    gl_state_bind_framebuffer(surfData->fbo_id);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, surfData->readback_pbo);
+    // orphan previous contents, readback shouldn't wait until they are consumed
+    glBufferData(GL_PIXEL_PACK_BUFFER, row_bytes * surfData->height, NULL, GL_STREAM_READ);
+    if (4 != surfData->bytes_per_pixel)
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, surfData->width, surfData->height, surfData->gl_format,
+                 surfData->gl_type, NULL);
+    if (4 != surfData->bytes_per_pixel)
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    surfData->readback_ready = 1;
+}
+
+/** @brief finishes GL write to output surface
+
+    If application reads surface back, starts prefetching new contents. Then places fence,
+    which covers the readback too.
+*/
+static
+void
+output_surface_written(VdpOutputSurfaceData *surfData)
+{
+    surfData->readback_ready = 0;
+    if (surfData->readback_pbo)
+        output_surface_start_readback(surfData);
+    glx_context_fence_insert(&surfData->fence);
+}
+
 VdpStatus
 softVdpOutputSurfaceCreate(VdpDevice device, VdpRGBAFormat rgba_format, uint32_t width,
                            uint32_t height, VdpOutputSurface *surface)
@@ -207,34 +306,44 @@ softVdpOutputSurfaceCreate(VdpDevice device, VdpRGBAFormat rgba_format, uint32_t
     data->rgba_format = rgba_format;
 
     glx_context_push_thread_local(deviceData);
-    glGenTextures(1, &data->tex_id);
-    glBindTexture(GL_TEXTURE_2D, data->tex_id);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // reserve texture
-    glTexImage2D(GL_TEXTURE_2D, 0, data->gl_internal_format, width, height, 0, data->gl_format,
-                 data->gl_type, NULL);
-
-    glGenFramebuffers(1, &data->fbo_id);
-    glBindFramebuffer(GL_FRAMEBUFFER, data->fbo_id);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, data->tex_id, 0);
-    GLenum gl_status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    if (GL_FRAMEBUFFER_COMPLETE != gl_status) {
-        traceError("error (VdpOutputSurfaceCreate): "
-                   "framebuffer not ready, %d, %s\n", gl_status, gluErrorString(gl_status));
-        glx_context_pop();
-        free(data);
-        err_code = VDP_STATUS_ERROR;
-        goto quit;
+    if (gl_fbo_pool_take(deviceData->output_surface_pool, data->gl_internal_format, width,
+                         height, &data->tex_id, &data->fbo_id, &data->fence))
+    {
+        // framebuffer was complete when it was released, and it still is
+        gl_state_bind_framebuffer(data->fbo_id);
+        // previous owner's commands may be still in flight
+        glx_context_fence_wait(&data->fence);
+    } else {
+        glGenTextures(1, &data->tex_id);
+        gl_state_bind_texture(data->tex_id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // reserve texture
+        glTexImage2D(GL_TEXTURE_2D, 0, data->gl_internal_format, width, height, 0,
+                     data->gl_format, data->gl_type, NULL);
+
+        glGenFramebuffers(1, &data->fbo_id);
+        gl_state_bind_framebuffer(data->fbo_id);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                               data->tex_id, 0);
+        GLenum gl_status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (GL_FRAMEBUFFER_COMPLETE != gl_status) {
+            traceError("error (VdpOutputSurfaceCreate): "
+                       "framebuffer not ready, %d, %s\n", gl_status, gluErrorString(gl_status));
+            glx_context_pop();
+            free(data);
+            err_code = VDP_STATUS_ERROR;
+            goto quit;
+        }
     }
 
     glClearColor(0.0, 0.0, 0.0, 0.0);
     glClear(GL_COLOR_BUFFER_BIT);
-    glFinish();
+    glx_context_fence_insert(&data->fence);
 
-    GLenum gl_error = glGetError();
+    GLenum gl_error = gl_error_check(VDP_FUNC_ID_OUTPUT_SURFACE_CREATE);
     glx_context_pop();
     if (GL_NO_ERROR != gl_error) {
         traceError("error (VdpOutputSurfaceCreate): gl error %d\n", gl_error);
@@ -243,8 +352,19 @@ softVdpOutputSurfaceCreate(VdpDevice device, VdpRGBAFormat rgba_format, uint32_t
         goto quit;
     }
 
+    *surface = handle_insert_child(data, &deviceData->children);
+    if (VDP_INVALID_HANDLE == *surface) {
+        // out of handles, texture and framebuffer are still good for someone else
+        glx_context_push_thread_local(deviceData);
+        gl_fbo_pool_put(deviceData->output_surface_pool, data->gl_internal_format, width,
+                        height, (size_t)width * height * 4, data->tex_id, data->fbo_id,
+                        &data->fence);
+        glx_context_pop();
+        free(data);
+        err_code = VDP_STATUS_RESOURCES;
+        goto quit;
+    }
     deviceData->refcount ++;
-    *surface = handle_insert(data);
 
     err_code = VDP_STATUS_OK;
 quit:
@@ -256,23 +376,35 @@ VdpStatus
 softVdpOutputSurfaceDestroy(VdpOutputSurface surface)
 {
     VdpStatus err_code;
+    sync_deferred_gl(surface, HANDLETYPE_OUTPUT_SURFACE);
     VdpOutputSurfaceData *data = handle_acquire(surface, HANDLETYPE_OUTPUT_SURFACE);
     if (NULL == data)
         return VDP_STATUS_INVALID_HANDLE;
     VdpDeviceData *deviceData = data->device;
 
     glx_context_push_thread_local(deviceData);
-    glDeleteTextures(1, &data->tex_id);
-    glDeleteFramebuffers(1, &data->fbo_id);
+    if (data->readback_pbo) {
+        glDeleteBuffers(1, &data->readback_pbo);
+        data->readback_pbo = 0;
+        data->readback_ready = 0;
+    }
 
-    GLenum gl_error = glGetError();
-    glx_context_pop();
+    GLenum gl_error = gl_error_check(VDP_FUNC_ID_OUTPUT_SURFACE_DESTROY);
     if (GL_NO_ERROR != gl_error) {
+        // surface stays alive, so it keeps its texture
+        glx_context_pop();
         traceError("error (VdpOutputSurfaceDestroy): gl error %d\n", gl_error);
         err_code = VDP_STATUS_ERROR;
         goto quit;
     }
 
+    // Texture and framebuffer are kept for next surface of the same format and size. From
+    // here on they belong to the pool, and surface must go away, whatever happens.
+    gl_fbo_pool_put(deviceData->output_surface_pool, data->gl_internal_format, data->width,
+                    data->height, (size_t)data->width * data->height * 4, data->tex_id,
+                    data->fbo_id, &data->fence);
+    glx_context_pop();
+
     handle_expunge(surface);
     deviceData->refcount --;
     free(data);
@@ -289,16 +421,15 @@ softVdpOutputSurfaceGetParameters(VdpOutputSurface surface, VdpRGBAFormat *rgba_
 {
     if (!rgba_format || !width || !height)
         return VDP_STATUS_INVALID_POINTER;
-    VdpOutputSurfaceData *surfData = handle_acquire(surface, HANDLETYPE_OUTPUT_SURFACE);
+    VdpOutputSurfaceData *surfData = handle_acquire_shared(surface, HANDLETYPE_OUTPUT_SURFACE);
     if (NULL == surfData)
         return VDP_STATUS_INVALID_HANDLE;
 
-    // TODO: check surfData validity again
     *rgba_format = surfData->rgba_format;
     *width       = surfData->width;
     *height      = surfData->height;
 
-    handle_release(surface);
+    handle_release_shared(surface);
     return VDP_STATUS_OK;
 }
 
@@ -310,6 +441,7 @@ softVdpOutputSurfaceGetBitsNative(VdpOutputSurface surface, VdpRect const *sourc
     VdpStatus err_code;
     if (!destination_data || !destination_pitches)
         return VDP_STATUS_INVALID_POINTER;
+    sync_deferred_gl(surface, HANDLETYPE_OUTPUT_SURFACE);
     VdpOutputSurfaceData *srcSurfData = handle_acquire(surface, HANDLETYPE_OUTPUT_SURFACE);
     if (NULL == srcSurfData)
         return VDP_STATUS_INVALID_HANDLE;
@@ -319,20 +451,55 @@ softVdpOutputSurfaceGetBitsNative(VdpOutputSurface surface, VdpRect const *sourc
     if (source_rect)
         srcRect = *source_rect;
 
+    // prefetched copy is read by CPU, so rectangle must stay within it
+    const int rect_inside = srcRect.x0 <= srcRect.x1 && srcRect.y0 <= srcRect.y1 &&
+                            srcRect.x1 <= srcSurfData->width && srcRect.y1 <= srcSurfData->height;
+
     glx_context_push_thread_local(deviceData);
-    glBindFramebuffer(GL_FRAMEBUFFER, srcSurfData->fbo_id);
-    glReadBuffer(GL_COLOR_ATTACHMENT0);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, destination_pitches[0] / srcSurfData->bytes_per_pixel);
-    if (4 != srcSurfData->bytes_per_pixel)
-        glPixelStorei(GL_PACK_ALIGNMENT, 1);
-    glReadPixels(srcRect.x0, srcRect.y0, srcRect.x1 - srcRect.x0, srcRect.y1 - srcRect.y0,
-                 srcSurfData->gl_format, srcSurfData->gl_type, destination_data[0]);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    if (4 != srcSurfData->bytes_per_pixel)
-        glPixelStorei(GL_PACK_ALIGNMENT, 4);
-    glFinish();
 
-    GLenum gl_error = glGetError();
+    int done = 0;
+    if (srcSurfData->readback_ready && rect_inside) {
+        // contents were prefetched after last write, copy requested rectangle from there.
+        // Readback may be started in other context, and mapping is not ordered by GPU-side
+        // wait, so wait on CPU side.
+        glx_context_fence_client_wait(&srcSurfData->fence);
+        const size_t bpp = srcSurfData->bytes_per_pixel;
+        const size_t row_bytes = srcSurfData->width * bpp;
+        const size_t bytes_in_line = (srcRect.x1 - srcRect.x0) * bpp;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, srcSurfData->readback_pbo);
+        const uint8_t *pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if (pixels) {
+            for (uint32_t y = srcRect.y0; y < srcRect.y1; y ++) {
+                memcpy((uint8_t *)destination_data[0] + (y - srcRect.y0) * destination_pitches[0],
+                       pixels + y * row_bytes + srcRect.x0 * bpp, bytes_in_line);
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            done = 1;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    if (!done) {
+        glx_context_fence_wait(&srcSurfData->fence);
+        gl_state_bind_framebuffer(srcSurfData->fbo_id);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glPixelStorei(GL_PACK_ROW_LENGTH, destination_pitches[0] / srcSurfData->bytes_per_pixel);
+        if (4 != srcSurfData->bytes_per_pixel)
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(srcRect.x0, srcRect.y0, srcRect.x1 - srcRect.x0, srcRect.y1 - srcRect.y0,
+                     srcSurfData->gl_format, srcSurfData->gl_type, destination_data[0]);
+        glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+        if (4 != srcSurfData->bytes_per_pixel)
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        // glReadPixels to client memory returns with data in place, no need to wait for anything
+
+        // Surface is read back by application, so it probably will be again after next
+        // rendering. Give it buffer to prefetch contents into.
+        if (0 == srcSurfData->readback_pbo && global.gl_caps.arb_pixel_buffer_object)
+            glGenBuffers(1, &srcSurfData->readback_pbo);
+    }
+
+    GLenum gl_error = gl_error_check(VDP_FUNC_ID_OUTPUT_SURFACE_GET_BITS_NATIVE);
     glx_context_pop();
     if (GL_NO_ERROR != gl_error) {
         traceError("error (VdpOutputSurfaceGetBitsNative): gl error %d\n", gl_error);
@@ -346,13 +513,15 @@ quit:
     return err_code;
 }
 
+static
 VdpStatus
-softVdpOutputSurfacePutBitsNative(VdpOutputSurface surface, void const *const *source_data,
+do_output_surface_put_bits_native(VdpOutputSurface surface, void const *const *source_data,
                                   uint32_t const *source_pitches, VdpRect const *destination_rect)
 {
     VdpStatus err_code;
-    if (!source_data || !source_pitches)
-        return VDP_STATUS_INVALID_POINTER;
+    // batched quads must land before new contents. This may run on GL thread, where
+    // sync_deferred_gl() is not an option
+    render_batch_flush_surface(surface, HANDLETYPE_OUTPUT_SURFACE);
     VdpOutputSurfaceData *dstSurfData = handle_acquire(surface, HANDLETYPE_OUTPUT_SURFACE);
     if (NULL == dstSurfData)
         return VDP_STATUS_INVALID_HANDLE;
@@ -363,20 +532,15 @@ softVdpOutputSurfacePutBitsNative(VdpOutputSurface surface, void const *const *s
         dstRect = *destination_rect;
 
     glx_context_push_thread_local(deviceData);
-    glBindTexture(GL_TEXTURE_2D, dstSurfData->tex_id);
-
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, source_pitches[0] / dstSurfData->bytes_per_pixel);
-    if (4 != dstSurfData->bytes_per_pixel)
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, dstRect.x0, dstRect.y0,
-                    dstRect.x1 - dstRect.x0, dstRect.y1 - dstRect.y0,
-                    dstSurfData->gl_format, dstSurfData->gl_type, source_data[0]);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    if (4 != dstSurfData->bytes_per_pixel)
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-    glFinish();
+    glx_context_fence_wait(&dstSurfData->fence);
+    gl_state_bind_texture(dstSurfData->tex_id);
+    gl_upload_tex_sub_image(dstRect.x0, dstRect.y0,
+                            dstRect.x1 - dstRect.x0, dstRect.y1 - dstRect.y0,
+                            dstSurfData->gl_format, dstSurfData->gl_type, source_data[0],
+                            source_pitches[0], dstSurfData->bytes_per_pixel);
+    output_surface_written(dstSurfData);
 
-    GLenum gl_error = glGetError();
+    GLenum gl_error = gl_error_check(VDP_FUNC_ID_OUTPUT_SURFACE_PUT_BITS_NATIVE);
     glx_context_pop();
     if (GL_NO_ERROR != gl_error) {
         traceError("error (VdpOutputSurfacePutBitsNative): gl error %d\n", gl_error);
@@ -390,6 +554,72 @@ quit:
     return err_code;
 }
 
+/** @brief deferred VdpOutputSurfacePutBitsNative call */
+struct put_bits_native_cmd {
+    GLWorkerCommand     base;
+    VdpOutputSurface    surface;
+    VdpRect             destination_rect;
+    uint32_t            source_pitch;
+    char                source_data[];  ///< copy of source image
+};
+
+static
+void
+exec_output_surface_put_bits_native(GLWorkerCommand *base)
+{
+    struct put_bits_native_cmd *cmd = (struct put_bits_native_cmd *)base;
+    void const *const source_data[] = { cmd->source_data };
+
+    VdpStatus err_code = do_output_surface_put_bits_native(cmd->surface, source_data,
+                                                           &cmd->source_pitch,
+                                                           &cmd->destination_rect);
+    if (VDP_STATUS_OK != err_code) {
+        traceError("error (VdpOutputSurfacePutBitsNative): deferred call failed, %s\n",
+                   reverse_status(err_code));
+    }
+    free(cmd);
+}
+
+VdpStatus
+softVdpOutputSurfacePutBitsNative(VdpOutputSurface surface, void const *const *source_data,
+                                  uint32_t const *source_pitches, VdpRect const *destination_rect)
+{
+    if (!source_data || !source_pitches)
+        return VDP_STATUS_INVALID_POINTER;
+    VdpOutputSurfaceData *surfData = handle_acquire_shared(surface, HANDLETYPE_OUTPUT_SURFACE);
+    if (NULL == surfData)
+        return VDP_STATUS_INVALID_HANDLE;
+    GLWorker *worker = surfData->device->gl_worker;
+    VdpRect dstRect = {0, 0, surfData->width, surfData->height};
+    const unsigned int bytes_per_pixel = surfData->bytes_per_pixel;
+    handle_release_shared(surface);
+
+    if (NULL == worker)
+        return do_output_surface_put_bits_native(surface, source_data, source_pitches,
+                                                 destination_rect);
+
+    // source buffer may be reused by application right after return, so copy it
+    if (destination_rect)
+        dstRect = *destination_rect;
+    size_t data_size = 0;
+    if (dstRect.x1 > dstRect.x0 && dstRect.y1 > dstRect.y0) {
+        data_size = (size_t)(dstRect.y1 - dstRect.y0 - 1) * source_pitches[0] +
+                    (dstRect.x1 - dstRect.x0) * bytes_per_pixel;
+    }
+
+    struct put_bits_native_cmd *cmd = malloc(sizeof(struct put_bits_native_cmd) + data_size);
+    if (NULL == cmd)
+        return VDP_STATUS_RESOURCES;
+    cmd->base.execute = exec_output_surface_put_bits_native;
+    cmd->surface = surface;
+    cmd->destination_rect = dstRect;
+    cmd->source_pitch = source_pitches[0];
+    memcpy(cmd->source_data, source_data[0], data_size);
+
+    gl_worker_submit(worker, &cmd->base);
+    return VDP_STATUS_OK;
+}
+
 VdpStatus
 softVdpOutputSurfacePutBitsIndexed(VdpOutputSurface surface, VdpIndexedFormat source_indexed_format,
                                    void const *const *source_data, uint32_t const *source_pitch,
@@ -399,6 +629,7 @@ softVdpOutputSurfacePutBitsIndexed(VdpOutputSurface surface, VdpIndexedFormat so
     VdpStatus err_code;
     if (!source_data || !source_pitch || !color_table)
         return VDP_STATUS_INVALID_POINTER;
+    sync_deferred_gl(surface, HANDLETYPE_OUTPUT_SURFACE);
     VdpOutputSurfaceData *surfData = handle_acquire(surface, HANDLETYPE_OUTPUT_SURFACE);
     if (NULL == surfData)
         return VDP_STATUS_INVALID_HANDLE;
@@ -423,8 +654,17 @@ softVdpOutputSurfacePutBitsIndexed(VdpOutputSurface surface, VdpIndexedFormat so
         do {
             const uint32_t dstRectWidth = dstRect.x1 - dstRect.x0;
             const uint32_t dstRectHeight = dstRect.y1 - dstRect.y0;
-            uint32_t *unpacked_buf = malloc(4 * dstRectWidth * dstRectHeight);
+
+            glx_context_fence_wait(&surfData->fence);
+            gl_state_bind_texture(surfData->tex_id);
+
+            // expand palette right into upload buffer, if there is one
+            GLUploadSlot *slot = NULL;
+            uint32_t *unpacked_buf = gl_upload_map(4 * dstRectWidth * dstRectHeight, &slot);
+            if (NULL == unpacked_buf)
+                unpacked_buf = malloc(4 * dstRectWidth * dstRectHeight);
             if (NULL == unpacked_buf) {
+                glx_context_pop();
                 err_code = VDP_STATUS_RESOURCES;
                 goto quit;
             }
@@ -440,14 +680,18 @@ softVdpOutputSurfacePutBitsIndexed(VdpOutputSurface surface, VdpIndexedFormat so
                 }
             }
 
-            glBindTexture(GL_TEXTURE_2D, surfData->tex_id);
-            glTexSubImage2D(GL_TEXTURE_2D, 0, dstRect.x0, dstRect.y0,
-                            dstRect.x1 - dstRect.x0, dstRect.y1 - dstRect.y0,
-                            GL_BGRA, GL_UNSIGNED_BYTE, unpacked_buf);
-            glFinish();
-            free(unpacked_buf);
+            if (slot) {
+                gl_upload_unmap_to_texture(slot, dstRect.x0, dstRect.y0, dstRectWidth,
+                                           dstRectHeight, GL_BGRA, GL_UNSIGNED_BYTE, 0, 4);
+            } else {
+                glTexSubImage2D(GL_TEXTURE_2D, 0, dstRect.x0, dstRect.y0,
+                                dstRectWidth, dstRectHeight,
+                                GL_BGRA, GL_UNSIGNED_BYTE, unpacked_buf);
+                free(unpacked_buf);
+            }
+            output_surface_written(surfData);
 
-            GLenum gl_error = glGetError();
+            GLenum gl_error = gl_error_check(VDP_FUNC_ID_OUTPUT_SURFACE_PUT_BITS_INDEXED);
             glx_context_pop();
             if (GL_NO_ERROR != gl_error) {
                 traceError("error (VdpOutputSurfacePutBitsIndexed): gl error %d\n", gl_error);
@@ -462,6 +706,7 @@ softVdpOutputSurfacePutBitsIndexed(VdpOutputSurface surface, VdpIndexedFormat so
     default:
         traceError("error (VdpOutputSurfacePutBitsIndexed): unsupported indexed format %s\n",
                    reverse_indexed_format(source_indexed_format));
+        glx_context_pop();
         err_code = VDP_STATUS_INVALID_INDEXED_FORMAT;
         goto quit;
     }
@@ -545,8 +790,14 @@ softVdpVideoMixerCreate(VdpDevice device, uint32_t feature_count,
     data->type = HANDLETYPE_VIDEO_MIXER;
     data->device = deviceData;
 
+    *mixer = handle_insert_child(data, &deviceData->children);
+    if (VDP_INVALID_HANDLE == *mixer) {
+        // out of handles
+        free(data);
+        err_code = VDP_STATUS_RESOURCES;
+        goto quit;
+    }
     deviceData->refcount ++;
-    *mixer = handle_insert(data);
 
     err_code = VDP_STATUS_OK;
 quit:
@@ -620,17 +871,18 @@ softVdpVideoMixerDestroy(VdpVideoMixer mixer)
     return VDP_STATUS_OK;
 }
 
+static
 VdpStatus
-softVdpVideoMixerRender(VdpVideoMixer mixer, VdpOutputSurface background_surface,
-                        VdpRect const *background_source_rect,
-                        VdpVideoMixerPictureStructure current_picture_structure,
-                        uint32_t video_surface_past_count,
-                        VdpVideoSurface const *video_surface_past,
-                        VdpVideoSurface video_surface_current, uint32_t video_surface_future_count,
-                        VdpVideoSurface const *video_surface_future,
-                        VdpRect const *video_source_rect, VdpOutputSurface destination_surface,
-                        VdpRect const *destination_rect, VdpRect const *destination_video_rect,
-                        uint32_t layer_count, VdpLayer const *layers)
+do_video_mixer_render(VdpVideoMixer mixer, VdpOutputSurface background_surface,
+                      VdpRect const *background_source_rect,
+                      VdpVideoMixerPictureStructure current_picture_structure,
+                      uint32_t video_surface_past_count,
+                      VdpVideoSurface const *video_surface_past,
+                      VdpVideoSurface video_surface_current, uint32_t video_surface_future_count,
+                      VdpVideoSurface const *video_surface_future,
+                      VdpRect const *video_source_rect, VdpOutputSurface destination_surface,
+                      VdpRect const *destination_rect, VdpRect const *destination_video_rect,
+                      uint32_t layer_count, VdpLayer const *layers)
 {
     VdpStatus err_code;
     (void)mixer;    // TODO: mixer should be used to get mixing parameters
@@ -644,10 +896,13 @@ softVdpVideoMixerRender(VdpVideoMixer mixer, VdpOutputSurface background_surface
     (void)video_surface_future_count; (void)video_surface_future;
     (void)layer_count; (void)layers;
 
-    VdpVideoSurfaceData *srcSurfData =
-        handle_acquire(video_surface_current, HANDLETYPE_VIDEO_SURFACE);
-    VdpOutputSurfaceData *dstSurfData =
-        handle_acquire(destination_surface, HANDLETYPE_OUTPUT_SURFACE);
+    render_batch_flush_surface(destination_surface, HANDLETYPE_OUTPUT_SURFACE);
+    const uint32_t handles[] = { video_surface_current, destination_surface };
+    const HandleType types[] = { HANDLETYPE_VIDEO_SURFACE, HANDLETYPE_OUTPUT_SURFACE };
+    void *objs[2];
+    handle_acquire_many(2, handles, types, objs);
+    VdpVideoSurfaceData *srcSurfData = objs[0];
+    VdpOutputSurfaceData *dstSurfData = objs[1];
     if (NULL == srcSurfData || NULL == dstSurfData) {
         err_code = VDP_STATUS_INVALID_HANDLE;
         goto quit;
@@ -673,13 +928,21 @@ softVdpVideoMixerRender(VdpVideoMixer mixer, VdpOutputSurface background_surface
     // TODO: dstRect should clip dstVideoRect
 
     glx_context_push_thread_local(deviceData);
+    glx_context_fence_wait(&srcSurfData->fence);
+    glx_context_fence_wait(&dstSurfData->fence);
 
     if (deviceData->va_available) {
         VAStatus status;
+        // GLX interop talks to both libva and GL context, so it needs both locks
+        va_display_lock(deviceData);
+        glx_context_lock();
+        gl_state_unbind_for_foreign_code();
         if (NULL == srcSurfData->va_glx) {
             status = vaCreateSurfaceGLX(deviceData->va_dpy, GL_TEXTURE_2D, srcSurfData->tex_id,
                                         &srcSurfData->va_glx);
             if (VA_STATUS_SUCCESS != status) {
+                glx_context_unlock();
+                va_display_unlock(deviceData);
                 glx_context_pop();
                 err_code = VDP_STATUS_ERROR;
                 goto quit;
@@ -687,49 +950,35 @@ softVdpVideoMixerRender(VdpVideoMixer mixer, VdpOutputSurface background_surface
         }
 
         status = vaCopySurfaceGLX(deviceData->va_dpy, srcSurfData->va_glx, srcSurfData->va_surf, 0);
+        glx_context_unlock();
+        va_display_unlock(deviceData);
         // TODO: check result of previous call
+        // libva does its own rendering and leaves state in whatever condition it likes
+        gl_state_invalidate();
 
-        glBindFramebuffer(GL_FRAMEBUFFER, dstSurfData->fbo_id);
-        glMatrixMode(GL_PROJECTION);
-        glLoadIdentity();
-        glOrtho(0, dstSurfData->width, 0, dstSurfData->height, -1.0f, 1.0f);
-        glViewport(0, 0, dstSurfData->width, dstSurfData->height);
-        glDisable(GL_BLEND);
-
-        glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
-
-        glMatrixMode(GL_TEXTURE);
-        glLoadIdentity();
-        glScalef(1.0f/srcSurfData->width, 1.0f/srcSurfData->height, 1.0f);
+        gl_state_bind_framebuffer(dstSurfData->fbo_id);
+        gl_render_set_target(dstSurfData->width, dstSurfData->height, 0);
+        gl_state_enable_blend(0);
 
         // Clear dstRect area
-        glDisable(GL_TEXTURE_2D);
-        glColor4f(0, 0, 0, 1);
-        glBegin(GL_QUADS);
-            glVertex2f(dstRect.x0, dstRect.y0);
-            glVertex2f(dstRect.x1, dstRect.y0);
-            glVertex2f(dstRect.x1, dstRect.y1);
-            glVertex2f(dstRect.x0, dstRect.y1);
-        glEnd();
+        const GLRenderVertex black[4] = {
+            { dstRect.x0, dstRect.y0, 0, 0, 0, 0, 0, 1 },
+            { dstRect.x1, dstRect.y0, 0, 0, 0, 0, 0, 1 },
+            { dstRect.x1, dstRect.y1, 0, 0, 0, 0, 0, 1 },
+            { dstRect.x0, dstRect.y1, 0, 0, 0, 0, 0, 1 },
+        };
+        gl_render_set_texture(0, 0, 0);
+        gl_render_quad(black);
 
         // Render (maybe scaled) data from video surface
-        glEnable(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, srcSurfData->tex_id);
-        glColor4f(1, 1, 1, 1);
-        glBegin(GL_QUADS);
-            glTexCoord2i(srcVideoRect.x0, srcVideoRect.y0);
-            glVertex2f(dstVideoRect.x0, dstVideoRect.y0);
-
-            glTexCoord2i(srcVideoRect.x1, srcVideoRect.y0);
-            glVertex2f(dstVideoRect.x1, dstVideoRect.y0);
-
-            glTexCoord2i(srcVideoRect.x1, srcVideoRect.y1);
-            glVertex2f(dstVideoRect.x1, dstVideoRect.y1);
-
-            glTexCoord2i(srcVideoRect.x0, srcVideoRect.y1);
-            glVertex2f(dstVideoRect.x0, dstVideoRect.y1);
-        glEnd();
+        const GLRenderVertex video[4] = {
+            { dstVideoRect.x0, dstVideoRect.y0, srcVideoRect.x0, srcVideoRect.y0, 1, 1, 1, 1 },
+            { dstVideoRect.x1, dstVideoRect.y0, srcVideoRect.x1, srcVideoRect.y0, 1, 1, 1, 1 },
+            { dstVideoRect.x1, dstVideoRect.y1, srcVideoRect.x1, srcVideoRect.y1, 1, 1, 1, 1 },
+            { dstVideoRect.x0, dstVideoRect.y1, srcVideoRect.x0, srcVideoRect.y1, 1, 1, 1, 1 },
+        };
+        gl_render_set_texture(srcSurfData->tex_id, srcSurfData->width, srcSurfData->height);
+        gl_render_quad(video);
     } else {
         // fall back to software convertion
         // TODO: make sure not to do scaling in software, only colorspace conversion
@@ -742,6 +991,7 @@ softVdpVideoMixerRender(VdpVideoMixer mixer, VdpOutputSurface background_surface
                                                             : dstVideoWidth;
         uint8_t *img_buf = malloc(dstVideoStride * dstVideoHeight * 4);
         if (NULL == img_buf) {
+            glx_context_pop();
             err_code = VDP_STATUS_RESOURCES;
             goto quit;
         }
@@ -770,7 +1020,7 @@ softVdpVideoMixerRender(VdpVideoMixer mixer, VdpOutputSurface background_surface
 
         // copy converted image to texture
         glPixelStorei(GL_UNPACK_ROW_LENGTH, dstVideoStride);
-        glBindTexture(GL_TEXTURE_2D, dstSurfData->tex_id);
+        gl_state_bind_texture(dstSurfData->tex_id);
         glTexSubImage2D(GL_TEXTURE_2D, 0,
             dstVideoRect.x0, dstVideoRect.y0,
             dstVideoRect.x1 - dstVideoRect.x0, dstVideoRect.y1 - dstVideoRect.y0,
@@ -778,9 +1028,10 @@ softVdpVideoMixerRender(VdpVideoMixer mixer, VdpOutputSurface background_surface
         glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
         free(img_buf);
     }
-    glFinish();
+    glx_context_fence_insert(&srcSurfData->fence);
+    output_surface_written(dstSurfData);
 
-    GLenum gl_error = glGetError();
+    GLenum gl_error = gl_error_check(VDP_FUNC_ID_VIDEO_MIXER_RENDER);
     glx_context_pop();
     if (GL_NO_ERROR != gl_error) {
         traceError("error (VdpVideoMixerRender): gl error %d\n", gl_error);
@@ -790,11 +1041,102 @@ softVdpVideoMixerRender(VdpVideoMixer mixer, VdpOutputSurface background_surface
 
     err_code = VDP_STATUS_OK;
 quit:
-    handle_release(video_surface_current);
-    handle_release(destination_surface);
+    handle_release_many(2, handles, objs);
     return err_code;
 }
 
+/** @brief deferred VdpVideoMixerRender call
+
+    Only arguments current implementation uses are recorded.
+*/
+struct mixer_render_cmd {
+    GLWorkerCommand     base;
+    VdpVideoMixer       mixer;
+    VdpVideoSurface     video_surface_current;
+    VdpOutputSurface    destination_surface;
+    VdpRect             video_source_rect;
+    VdpRect             destination_rect;
+    VdpRect             destination_video_rect;
+    int                 has_video_source_rect;
+    int                 has_destination_rect;
+    int                 has_destination_video_rect;
+};
+
+static
+void
+exec_video_mixer_render(GLWorkerCommand *base)
+{
+    struct mixer_render_cmd *cmd = (struct mixer_render_cmd *)base;
+
+    VdpStatus err_code = do_video_mixer_render(
+        cmd->mixer, VDP_INVALID_HANDLE, NULL, VDP_VIDEO_MIXER_PICTURE_STRUCTURE_FRAME, 0, NULL,
+        cmd->video_surface_current, 0, NULL,
+        cmd->has_video_source_rect ? &cmd->video_source_rect : NULL,
+        cmd->destination_surface,
+        cmd->has_destination_rect ? &cmd->destination_rect : NULL,
+        cmd->has_destination_video_rect ? &cmd->destination_video_rect : NULL,
+        0, NULL);
+    if (VDP_STATUS_OK != err_code) {
+        traceError("error (VdpVideoMixerRender): deferred call failed, %s\n",
+                   reverse_status(err_code));
+    }
+    free(cmd);
+}
+
+VdpStatus
+softVdpVideoMixerRender(VdpVideoMixer mixer, VdpOutputSurface background_surface,
+                        VdpRect const *background_source_rect,
+                        VdpVideoMixerPictureStructure current_picture_structure,
+                        uint32_t video_surface_past_count,
+                        VdpVideoSurface const *video_surface_past,
+                        VdpVideoSurface video_surface_current, uint32_t video_surface_future_count,
+                        VdpVideoSurface const *video_surface_future,
+                        VdpRect const *video_source_rect, VdpOutputSurface destination_surface,
+                        VdpRect const *destination_rect, VdpRect const *destination_video_rect,
+                        uint32_t layer_count, VdpLayer const *layers)
+{
+    VdpDeviceData *deviceData =
+        handle_get_device_shared(destination_surface, HANDLETYPE_OUTPUT_SURFACE);
+    if (NULL == deviceData || NULL == deviceData->gl_worker) {
+        return do_video_mixer_render(mixer, background_surface, background_source_rect,
+                                     current_picture_structure, video_surface_past_count,
+                                     video_surface_past, video_surface_current,
+                                     video_surface_future_count, video_surface_future,
+                                     video_source_rect, destination_surface, destination_rect,
+                                     destination_video_rect, layer_count, layers);
+    }
+
+    VdpDeviceData *srcDeviceData =
+        handle_get_device_shared(video_surface_current, HANDLETYPE_VIDEO_SURFACE);
+    if (NULL == srcDeviceData)
+        return VDP_STATUS_INVALID_HANDLE;
+    if (srcDeviceData != deviceData)
+        return VDP_STATUS_HANDLE_DEVICE_MISMATCH;
+
+    struct mixer_render_cmd *cmd = calloc(1, sizeof(struct mixer_render_cmd));
+    if (NULL == cmd)
+        return VDP_STATUS_RESOURCES;
+    cmd->base.execute = exec_video_mixer_render;
+    cmd->mixer = mixer;
+    cmd->video_surface_current = video_surface_current;
+    cmd->destination_surface = destination_surface;
+    if (video_source_rect) {
+        cmd->video_source_rect = *video_source_rect;
+        cmd->has_video_source_rect = 1;
+    }
+    if (destination_rect) {
+        cmd->destination_rect = *destination_rect;
+        cmd->has_destination_rect = 1;
+    }
+    if (destination_video_rect) {
+        cmd->destination_video_rect = *destination_video_rect;
+        cmd->has_destination_video_rect = 1;
+    }
+
+    gl_worker_submit(deviceData->gl_worker, &cmd->base);
+    return VDP_STATUS_OK;
+}
+
 VdpStatus
 softVdpVideoSurfaceQueryCapabilities(VdpDevice device, VdpChromaType surface_chroma_type,
                                      VdpBool *is_supported, uint32_t *max_width,
@@ -855,16 +1197,16 @@ softVdpVideoSurfaceCreate(VdpDevice device, VdpChromaType chroma_type, uint32_t
 
     glx_context_push_thread_local(deviceData);
     glGenTextures(1, &data->tex_id);
-    glBindTexture(GL_TEXTURE_2D, data->tex_id);
+    gl_state_bind_texture(data->tex_id);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, data->width, data->height, 0,
                  GL_BGRA, GL_UNSIGNED_BYTE, NULL);
-    glFinish();
+    glx_context_fence_insert(&data->fence);
 
-    GLenum gl_error = glGetError();
+    GLenum gl_error = gl_error_check(VDP_FUNC_ID_VIDEO_SURFACE_CREATE);
     glx_context_pop();
     if (GL_NO_ERROR != gl_error) {
         traceError("error (VdpVideoSurfaceCreate): gl error %d\n", gl_error);
@@ -894,8 +1236,21 @@ softVdpVideoSurfaceCreate(VdpDevice device, VdpChromaType chroma_type, uint32_t
         }
     }
 
+    *surface = handle_insert_child(data, &deviceData->children);
+    if (VDP_INVALID_HANDLE == *surface) {
+        // out of handles
+        glx_context_push_thread_local(deviceData);
+        gl_state_delete_texture(data->tex_id);
+        glx_context_fence_release(&data->fence);
+        glx_context_pop();
+        free(data->y_plane);
+        free(data->v_plane);
+        free(data->u_plane);
+        free(data);
+        err_code = VDP_STATUS_RESOURCES;
+        goto quit;
+    }
     deviceData->refcount ++;
-    *surface = handle_insert(data);
 
     err_code = VDP_STATUS_OK;
 quit:
@@ -906,15 +1261,17 @@ quit:
 VdpStatus
 softVdpVideoSurfaceDestroy(VdpVideoSurface surface)
 {
+    sync_deferred_gl(surface, HANDLETYPE_VIDEO_SURFACE);
     VdpVideoSurfaceData *videoSurfData = handle_acquire(surface, HANDLETYPE_VIDEO_SURFACE);
     if (NULL == videoSurfData)
         return VDP_STATUS_INVALID_HANDLE;
     VdpDeviceData *deviceData = videoSurfData->device;
 
     glx_context_push_thread_local(deviceData);
-    glDeleteTextures(1, &videoSurfData->tex_id);
+    gl_state_delete_texture(videoSurfData->tex_id);
+    glx_context_fence_release(&videoSurfData->fence);
 
-    GLenum gl_error = glGetError();
+    GLenum gl_error = gl_error_check(VDP_FUNC_ID_VIDEO_SURFACE_DESTROY);
 
     if (GL_NO_ERROR != gl_error) {
         traceError("error (VdpVideoSurfaceDestroy): gl error %d\n", gl_error);
@@ -924,7 +1281,12 @@ softVdpVideoSurfaceDestroy(VdpVideoSurface surface)
     }
 
     if (videoSurfData->va_glx) {
+        va_display_lock(deviceData);
+        glx_context_lock();
+        gl_state_unbind_for_foreign_code();
         vaDestroySurfaceGLX(deviceData->va_dpy, videoSurfData->va_glx);
+        glx_context_unlock();
+        va_display_unlock(deviceData);
     }
 
     if (deviceData->va_available) {
@@ -948,7 +1310,7 @@ softVdpVideoSurfaceGetParameters(VdpVideoSurface surface, VdpChromaType *chroma_
 {
     if (!chroma_type || !width || !height)
         return VDP_STATUS_INVALID_POINTER;
-    VdpVideoSurfaceData *videoSurf = handle_acquire(surface, HANDLETYPE_VIDEO_SURFACE);
+    VdpVideoSurfaceData *videoSurf = handle_acquire_shared(surface, HANDLETYPE_VIDEO_SURFACE);
     if (NULL == videoSurf)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -956,7 +1318,7 @@ softVdpVideoSurfaceGetParameters(VdpVideoSurface surface, VdpChromaType *chroma_
     *width       = videoSurf->width;
     *height      = videoSurf->height;
 
-    handle_release(surface);
+    handle_release_shared(surface);
     return VDP_STATUS_OK;
 }
 
@@ -975,6 +1337,7 @@ softVdpVideoSurfaceGetBitsYCbCr(VdpVideoSurface surface, VdpYCbCrFormat destinat
 
     if (deviceData->va_available) {
         VAImage q;
+        va_display_lock(deviceData);
         vaDeriveImage(va_dpy, srcSurfData->va_surf, &q);
         if (VA_FOURCC('N', 'V', '1', '2') == q.format.fourcc &&
             VDP_YCBCR_FORMAT_NV12 == destination_ycbcr_format)
@@ -1041,10 +1404,12 @@ softVdpVideoSurfaceGetBitsYCbCr(VdpVideoSurface surface, VdpYCbCrFormat destinat
                        "VA FOURCC %c%c%c%c -> %s\n", *c, *(c+1), *(c+2), *(c+3),
                        reverse_ycbcr_format(destination_ycbcr_format));
             vaDestroyImage(va_dpy, q.image_id);
+            va_display_unlock(deviceData);
             err_code = VDP_STATUS_INVALID_Y_CB_CR_FORMAT;
             goto quit;
         }
         vaDestroyImage(va_dpy, q.image_id);
+        va_display_unlock(deviceData);
     } else {
         // software fallback
         traceError("error (softVdpVideoSurfaceGetBitsYCbCr): not implemented software fallback\n");
@@ -1052,7 +1417,7 @@ softVdpVideoSurfaceGetBitsYCbCr(VdpVideoSurface surface, VdpYCbCrFormat destinat
         goto quit;
     }
 
-    GLenum gl_error = glGetError();
+    GLenum gl_error = gl_error_check(VDP_FUNC_ID_VIDEO_SURFACE_GET_BITS_Y_CB_CR);
     if (GL_NO_ERROR != gl_error) {
         traceError("error (VdpVideoSurfaceGetBitsYCbCr): gl error %d\n", gl_error);
         err_code = VDP_STATUS_ERROR;
@@ -1074,6 +1439,7 @@ softVdpVideoSurfacePutBitsYCbCr(VdpVideoSurface surface, VdpYCbCrFormat source_y
         return VDP_STATUS_INVALID_POINTER;
     //TODO: figure out what to do with other formats
 
+    sync_deferred_gl(surface, HANDLETYPE_VIDEO_SURFACE);
     VdpVideoSurfaceData *dstSurfData = handle_acquire(surface, HANDLETYPE_VIDEO_SURFACE);
     if (NULL == dstSurfData)
         return VDP_STATUS_INVALID_HANDLE;
@@ -1085,19 +1451,11 @@ softVdpVideoSurfacePutBitsYCbCr(VdpVideoSurface surface, VdpYCbCrFormat source_y
         if (VDP_YCBCR_FORMAT_YV12 != source_ycbcr_format) {
             traceError("error (softVdpVideoSurfacePutBitsYCbCr): not supported source_ycbcr_format "
                        "%s\n", reverse_ycbcr_format(source_ycbcr_format));
+            glx_context_pop();
             err_code = VDP_STATUS_INVALID_Y_CB_CR_FORMAT;
             goto quit;
         }
 
-        // libswscale likes aligned data
-        int stride = (dstSurfData->width + 7) & ~0x7;
-        void *bgra_buf = memalign(16, stride * dstSurfData->height * 4);
-        if (NULL == bgra_buf) {
-            traceError("error (softVdpVideoSurfacePutBitsYCbCr): can not allocate memory\n");
-            err_code = VDP_STATUS_RESOURCES;
-            goto quit;
-        }
-
         // TODO: other source formats
         struct SwsContext *sws_ctx =
             sws_getContext(dstSurfData->width, dstSurfData->height, PIX_FMT_YUV420P,
@@ -1105,7 +1463,25 @@ softVdpVideoSurfacePutBitsYCbCr(VdpVideoSurface surface, VdpYCbCrFormat source_y
                            SWS_POINT, NULL, NULL, NULL);
         if (NULL == sws_ctx) {
             traceError("error (softVdpVideoSurfacePutBitsYCbCr): can not create SwsContext\n");
-            free(bgra_buf);
+            glx_context_pop();
+            err_code = VDP_STATUS_RESOURCES;
+            goto quit;
+        }
+
+        glx_context_fence_wait(&dstSurfData->fence);
+        gl_state_bind_texture(dstSurfData->tex_id);
+
+        // libswscale likes aligned data. Upload buffer mapping is aligned, so convert
+        // right into it when possible
+        int stride = (dstSurfData->width + 7) & ~0x7;
+        GLUploadSlot *slot = NULL;
+        void *bgra_buf = gl_upload_map(stride * dstSurfData->height * 4, &slot);
+        if (NULL == bgra_buf)
+            bgra_buf = memalign(16, stride * dstSurfData->height * 4);
+        if (NULL == bgra_buf) {
+            traceError("error (softVdpVideoSurfacePutBitsYCbCr): can not allocate memory\n");
+            sws_freeContext(sws_ctx);
+            glx_context_pop();
             err_code = VDP_STATUS_RESOURCES;
             goto quit;
         }
@@ -1118,23 +1494,33 @@ softVdpVideoSurfacePutBitsYCbCr(VdpVideoSurface surface, VdpYCbCrFormat source_y
         if (res != (int)dstSurfData->height) {
             traceError("error (softVdpVideoSurfacePutBitsYCbCr): sws_scale returned %d while "
                        "%d expected\n", res, dstSurfData->height);
-            free(bgra_buf);
+            if (slot)
+                gl_upload_cancel(slot);
+            else
+                free(bgra_buf);
             sws_freeContext(sws_ctx);
+            glx_context_pop();
             err_code = VDP_STATUS_ERROR;
             goto quit;
         }
         sws_freeContext(sws_ctx);
 
-        glBindTexture(GL_TEXTURE_2D, dstSurfData->tex_id);
-        glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, dstSurfData->width, dstSurfData->height,
-                        GL_BGRA, GL_UNSIGNED_BYTE, bgra_buf);
-        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-        free(bgra_buf);
+        if (slot) {
+            gl_upload_unmap_to_texture(slot, 0, 0, dstSurfData->width, dstSurfData->height,
+                                       GL_BGRA, GL_UNSIGNED_BYTE, stride, 4);
+        } else {
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, dstSurfData->width, dstSurfData->height,
+                            GL_BGRA, GL_UNSIGNED_BYTE, bgra_buf);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            free(bgra_buf);
+        }
+        glx_context_fence_insert(&dstSurfData->fence);
     } else {
         if (VDP_YCBCR_FORMAT_YV12 != source_ycbcr_format) {
             traceError("error (softVdpVideoSurfacePutBitsYCbCr): not supported source_ycbcr_format "
                        "%s\n", reverse_ycbcr_format(source_ycbcr_format));
+            glx_context_pop();
             err_code = VDP_STATUS_INVALID_Y_CB_CR_FORMAT;
             goto quit;
         }
@@ -1163,7 +1549,7 @@ softVdpVideoSurfacePutBitsYCbCr(VdpVideoSurface surface, VdpYCbCrFormat source_y
         }
     }
 
-    GLenum gl_error = glGetError();
+    GLenum gl_error = gl_error_check(VDP_FUNC_ID_VIDEO_SURFACE_PUT_BITS_Y_CB_CR);
     glx_context_pop();
     if (GL_NO_ERROR != gl_error) {
         traceError("error (VdpVideoSurfacePutBitsYCbCr): gl error %d\n", gl_error);
@@ -1209,7 +1595,7 @@ softVdpBitmapSurfaceQueryCapabilities(VdpDevice device, VdpRGBAFormat surface_rg
     GLint max_texture_size;
     glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
 
-    GLenum gl_error = glGetError();
+    GLenum gl_error = gl_error_check(VDP_FUNC_ID_BITMAP_SURFACE_QUERY_CAPABILITIES);
     glx_context_pop();
     if (GL_NO_ERROR != gl_error) {
         traceError("error (VdpBitmapSurfaceQueryCapabilities): gl error %d\n", gl_error);
@@ -1226,6 +1612,37 @@ quit:
     return err_code;
 }
 
+/** @brief frees texture or atlas region of bitmap. Must be called with GL context pushed */
+static
+void
+bitmap_surface_release_texture(VdpBitmapSurfaceData *surfData)
+{
+    if (surfData->atlas) {
+        // region is reused only after GPU is done with it, so atlas takes the fence
+        gl_atlas_free(surfData->atlas, &surfData->atlas_region, &surfData->fence);
+        surfData->atlas = NULL;
+    } else {
+        gl_state_delete_texture(surfData->tex_id);
+    }
+}
+
+/** @brief frees GL objects and memory of bitmap surface. Must be called with GL context pushed */
+static
+void
+bitmap_surface_release_resources(VdpBitmapSurfaceData *surfData)
+{
+    bitmap_surface_release_texture(surfData);
+    if (surfData->bitmap_pbo) {
+        // mapping goes away along with the buffer
+        glDeleteBuffers(1, &surfData->bitmap_pbo);
+        surfData->bitmap_pbo = 0;
+    } else {
+        free(surfData->bitmap_data);
+    }
+    surfData->bitmap_data = NULL;
+    glx_context_fence_release(&surfData->fence);
+}
+
 VdpStatus
 softVdpBitmapSurfaceCreate(VdpDevice device, VdpRGBAFormat rgba_format, uint32_t width,
                            uint32_t height, VdpBool frequently_accessed, VdpBitmapSurface *surface)
@@ -1290,8 +1707,10 @@ softVdpBitmapSurfaceCreate(VdpDevice device, VdpRGBAFormat rgba_format, uint32_t
     data->frequently_accessed = frequently_accessed;
 
     // Frequently accessed bitmaps reside in system memory rather that in GPU texture.
-    data->dirty = 0;
-    if (frequently_accessed) {
+    // If possible, that memory is persistently mapped buffer, created later along with texture.
+    data->dirty_count = 0;
+    data->bitmap_pbo = 0;
+    if (frequently_accessed && !global.gl_caps.arb_buffer_storage) {
         data->bitmap_data = calloc(width * height, data->bytes_per_pixel);
         if (NULL == data->bitmap_data) {
             traceError("error (VdpBitmapSurfaceCreate): calloc returned NULL\n");
@@ -1304,32 +1723,84 @@ softVdpBitmapSurfaceCreate(VdpDevice device, VdpRGBAFormat rgba_format, uint32_t
     }
 
     glx_context_push_thread_local(deviceData);
-    glGenTextures(1, &data->tex_id);
-    glBindTexture(GL_TEXTURE_2D, data->tex_id);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, data->gl_internal_format, width, height, 0,
-                 data->gl_format, data->gl_type, NULL);
-    glFinish();
-    GLuint gl_error = glGetError();
-    if (GL_NO_ERROR != gl_error) {
-        // Requested RGBA format was wrong
-        traceError("error (VdpBitmapSurfaceCreate): texture failure, gl error (%d, %s)\n", gl_error,
-                   gluErrorString(gl_error));
-        free(data);
-        glx_context_pop();
-        err_code = VDP_STATUS_ERROR;
-        goto quit;
+    // small bitmaps, glyphs mostly, share atlas textures instead of having their own
+    if (NULL == deviceData->bitmap_atlas[rgba_format]) {
+        deviceData->bitmap_atlas[rgba_format] =
+            gl_atlas_create(data->gl_internal_format, data->gl_format, data->gl_type,
+                            data->bytes_per_pixel, VDP_RGBA_FORMAT_A8 == rgba_format);
+    }
+    data->atlas = deviceData->bitmap_atlas[rgba_format];
+    if (data->atlas && gl_atlas_alloc(data->atlas, width, height, &data->atlas_region)) {
+        data->tex_id = data->atlas_region.tex_id;
+        data->tex_x = data->atlas_region.x;
+        data->tex_y = data->atlas_region.y;
+        data->tex_width = GL_ATLAS_PAGE_SIZE;
+        data->tex_height = GL_ATLAS_PAGE_SIZE;
+    } else {
+        data->atlas = NULL;
+        data->tex_x = 0;
+        data->tex_y = 0;
+        data->tex_width = width;
+        data->tex_height = height;
+
+        glGenTextures(1, &data->tex_id);
+        gl_state_bind_texture(data->tex_id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // Format check needs immediate answer, so glGetError is used even if errors are checked
+        // through debug output. Flags left unpolled by earlier calls are cleared first.
+        while (GL_NO_ERROR != glGetError()) {}
+        glTexImage2D(GL_TEXTURE_2D, 0, data->gl_internal_format, width, height, 0,
+                     data->gl_format, data->gl_type, NULL);
+        GLuint gl_error = glGetError();
+        if (GL_NO_ERROR != gl_error) {
+            // Requested RGBA format was wrong
+            traceError("error (VdpBitmapSurfaceCreate): texture failure, gl error (%d, %s)\n",
+                       gl_error, gluErrorString(gl_error));
+            bitmap_surface_release_resources(data);
+            glx_context_pop();
+            free(data);
+            err_code = VDP_STATUS_ERROR;
+            goto quit;
+        }
+        if (VDP_RGBA_FORMAT_A8 == rgba_format) {
+            // map red channel to alpha
+            GLint swizzle_mask[] = {GL_ONE, GL_ONE, GL_ONE, GL_RED};
+            glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle_mask);
+        }
     }
-    if (VDP_RGBA_FORMAT_A8 == rgba_format) {
-        // map red channel to alpha
-        GLint swizzle_mask[] = {GL_ONE, GL_ONE, GL_ONE, GL_RED};
-        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle_mask);
+    if (frequently_accessed && global.gl_caps.arb_buffer_storage) {
+        // client writes land right in the buffer texture is updated from
+        const size_t size = width * height * data->bytes_per_pixel;
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &data->bitmap_pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, data->bitmap_pbo);
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+        data->bitmap_data = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (data->bitmap_data) {
+            memset(data->bitmap_data, 0, size);
+        } else {
+            glDeleteBuffers(1, &data->bitmap_pbo);
+            data->bitmap_pbo = 0;
+            data->bitmap_data = calloc(width * height, data->bytes_per_pixel);
+            if (NULL == data->bitmap_data) {
+                traceError("error (VdpBitmapSurfaceCreate): calloc returned NULL\n");
+                bitmap_surface_release_resources(data);
+                glx_context_pop();
+                free(data);
+                err_code = VDP_STATUS_RESOURCES;
+                goto quit;
+            }
+        }
     }
+    glx_context_fence_insert(&data->fence);
 
-    gl_error = glGetError();
+    GLenum gl_error = gl_error_check(VDP_FUNC_ID_BITMAP_SURFACE_CREATE);
+    if (GL_NO_ERROR != gl_error)
+        bitmap_surface_release_resources(data);
     glx_context_pop();
     if (GL_NO_ERROR != gl_error) {
         free(data);
@@ -1338,8 +1809,17 @@ softVdpBitmapSurfaceCreate(VdpDevice device, VdpRGBAFormat rgba_format, uint32_t
         goto quit;
     }
 
+    *surface = handle_insert_child(data, &deviceData->children);
+    if (VDP_INVALID_HANDLE == *surface) {
+        // out of handles
+        glx_context_push_thread_local(deviceData);
+        bitmap_surface_release_resources(data);
+        glx_context_pop();
+        free(data);
+        err_code = VDP_STATUS_RESOURCES;
+        goto quit;
+    }
     deviceData->refcount ++;
-    *surface = handle_insert(data);
 
     err_code = VDP_STATUS_OK;
 quit:
@@ -1350,20 +1830,16 @@ quit:
 VdpStatus
 softVdpBitmapSurfaceDestroy(VdpBitmapSurface surface)
 {
+    sync_deferred_gl(surface, HANDLETYPE_BITMAP_SURFACE);
     VdpBitmapSurfaceData *data = handle_acquire(surface, HANDLETYPE_BITMAP_SURFACE);
     if (NULL == data)
         return VDP_STATUS_INVALID_HANDLE;
     VdpDeviceData *deviceData = data->device;
 
-    if (data->frequently_accessed) {
-        free(data->bitmap_data);
-        data->bitmap_data = NULL;
-    }
-
     glx_context_push_thread_local(deviceData);
-    glDeleteTextures(1, &data->tex_id);
+    bitmap_surface_release_resources(data);
 
-    GLenum gl_error = glGetError();
+    GLenum gl_error = gl_error_check(VDP_FUNC_ID_BITMAP_SURFACE_DESTROY);
     glx_context_pop();
     if (GL_NO_ERROR != gl_error) {
         traceError("error (VdpBitmapSurfaceDestroy): gl error %d\n", gl_error);
@@ -1381,12 +1857,12 @@ VdpStatus
 softVdpBitmapSurfaceGetParameters(VdpBitmapSurface surface, VdpRGBAFormat *rgba_format,
                                   uint32_t *width, uint32_t *height, VdpBool *frequently_accessed)
 {
-    VdpBitmapSurfaceData *srcSurfData = handle_acquire(surface, HANDLETYPE_BITMAP_SURFACE);
+    VdpBitmapSurfaceData *srcSurfData = handle_acquire_shared(surface, HANDLETYPE_BITMAP_SURFACE);
     if (NULL == srcSurfData)
         return VDP_STATUS_INVALID_HANDLE;
 
     if (NULL == rgba_format || NULL == width || NULL == height || NULL == frequently_accessed) {
-        handle_release(surface);
+        handle_release_shared(surface);
         return VDP_STATUS_INVALID_POINTER;
     }
 
@@ -1395,10 +1871,156 @@ softVdpBitmapSurfaceGetParameters(VdpBitmapSurface surface, VdpRGBAFormat *rgba_
     *height = srcSurfData->height;
     *frequently_accessed = srcSurfData->frequently_accessed;
 
-    handle_release(surface);
+    handle_release_shared(surface);
     return VDP_STATUS_OK;
 }
 
+static inline
+uint32_t
+min_u32(uint32_t a, uint32_t b)
+{
+    return (a < b) ? a : b;
+}
+
+static inline
+uint32_t
+max_u32(uint32_t a, uint32_t b)
+{
+    return (a > b) ? a : b;
+}
+
+/** @brief adds area to the list of ones to be uploaded to texture
+
+    When the list is full, or the new area overlaps enough with one already there, the two are
+    replaced with their bounding box. Rectangle which grows the least is chosen for that.
+*/
+static
+void
+bitmap_surface_add_dirty_rect(VdpBitmapSurfaceData *surfData, VdpRect rect)
+{
+    if (rect.x0 >= rect.x1 || rect.y0 >= rect.y1)
+        return;
+
+    int best = -1;
+    int64_t best_waste = INT64_MAX;
+    for (int k = 0; k < surfData->dirty_count; k ++) {
+        const VdpRect *r = &surfData->dirty_rects[k];
+        const int64_t bbox_area = (int64_t)(max_u32(r->x1, rect.x1) - min_u32(r->x0, rect.x0)) *
+                                  (max_u32(r->y1, rect.y1) - min_u32(r->y0, rect.y0));
+        const int64_t waste = bbox_area - (int64_t)(r->x1 - r->x0) * (r->y1 - r->y0) -
+                              (int64_t)(rect.x1 - rect.x0) * (rect.y1 - rect.y0);
+        if (waste < best_waste) {
+            best = k;
+            best_waste = waste;
+        }
+    }
+
+    if (best >= 0 && (best_waste <= 0 || BITMAP_DIRTY_RECT_COUNT == surfData->dirty_count)) {
+        VdpRect *r = &surfData->dirty_rects[best];
+        r->x0 = min_u32(r->x0, rect.x0);
+        r->y0 = min_u32(r->y0, rect.y0);
+        r->x1 = max_u32(r->x1, rect.x1);
+        r->y1 = max_u32(r->y1, rect.y1);
+    } else {
+        surfData->dirty_rects[surfData->dirty_count ++] = rect;
+    }
+}
+
+/** @brief copies edges of just uploaded rectangle into atlas padding around bitmap
+
+    Linear filter near bitmap edge samples padding too. Repeating edge texels there makes
+    it look like clamp-to-edge of dedicated texture. Must be called with GL context pushed
+    and surface texture bound.
+
+    @param data         rectangle contents, as passed to upload
+    @param pitch        distance between rows of data, in bytes
+    @param from_buffer  data is offset into bound pixel unpack buffer, and unpack row length
+                        is set for it already
+*/
+static
+void
+bitmap_surface_upload_padding(VdpBitmapSurfaceData *surfData, VdpRect r, const void *data,
+                              uint32_t pitch, int from_buffer)
+{
+    if (NULL == surfData->atlas || r.x0 == r.x1 || r.y0 == r.y1)
+        return;
+
+    const unsigned int bpp = surfData->bytes_per_pixel;
+    const uint32_t width = r.x1 - r.x0;
+    const uint32_t height = r.y1 - r.y0;
+    // whether rectangle reaches bitmap sides, indexed by offset + 1: left or top, right or bottom
+    const int touches_x[3] = { 0 == r.x0, 1, surfData->width == r.x1 };
+    const int touches_y[3] = { 0 == r.y0, 1, surfData->height == r.y1 };
+
+    for (int dy = -1; dy <= 1; dy ++) {
+        for (int dx = -1; dx <= 1; dx ++) {
+            if ((0 == dx && 0 == dy) || !touches_x[dx + 1] || !touches_y[dy + 1])
+                continue;
+            // sides get edge row or column, corners get corner texel
+            const uint32_t src_x = (1 == dx) ? width - 1 : 0;
+            const uint32_t src_y = (1 == dy) ? height - 1 : 0;
+            const GLsizei w = dx ? 1 : width;
+            const GLsizei h = dy ? 1 : height;
+            const GLint x = surfData->tex_x + ((-1 == dx) ? -1 : (1 == dx) ? (GLint)r.x1 : r.x0);
+            const GLint y = surfData->tex_y + ((-1 == dy) ? -1 : (1 == dy) ? (GLint)r.y1 : r.y0);
+            const uint8_t *src = (const uint8_t *)data + (size_t)src_y * pitch + src_x * bpp;
+            if (from_buffer) {
+                glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, surfData->gl_format,
+                                surfData->gl_type, src);
+            } else {
+                gl_upload_tex_sub_image(x, y, w, h, surfData->gl_format, surfData->gl_type, src,
+                                        pitch, bpp);
+            }
+        }
+    }
+}
+
+/** @brief uploads dirty areas of frequently accessed bitmap to its texture
+
+    Must be called with GL context pushed and surface texture bound.
+*/
+static
+void
+bitmap_surface_upload_dirty(VdpBitmapSurfaceData *surfData)
+{
+    const unsigned int bpp = surfData->bytes_per_pixel;
+
+    if (surfData->bitmap_pbo) {
+        // data is in persistently mapped buffer already, no staging copy needed
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, surfData->bitmap_pbo);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, surfData->width);
+        if (4 != bpp)
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    }
+
+    for (int k = 0; k < surfData->dirty_count; k ++) {
+        const VdpRect r = surfData->dirty_rects[k];
+        const size_t offset = ((size_t)r.y0 * surfData->width + r.x0) * bpp;
+        const GLint x = surfData->tex_x + r.x0;
+        const GLint y = surfData->tex_y + r.y0;
+        if (surfData->bitmap_pbo) {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, r.x1 - r.x0, r.y1 - r.y0,
+                            surfData->gl_format, surfData->gl_type, (const void *)offset);
+            bitmap_surface_upload_padding(surfData, r, (const void *)offset,
+                                          surfData->width * bpp, 1);
+        } else {
+            gl_upload_tex_sub_image(x, y, r.x1 - r.x0, r.y1 - r.y0, surfData->gl_format,
+                                    surfData->gl_type, surfData->bitmap_data + offset,
+                                    surfData->width * bpp, bpp);
+            bitmap_surface_upload_padding(surfData, r, surfData->bitmap_data + offset,
+                                          surfData->width * bpp, 0);
+        }
+    }
+
+    if (surfData->bitmap_pbo) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        if (4 != bpp)
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    surfData->dirty_count = 0;
+}
+
 VdpStatus
 softVdpBitmapSurfacePutBitsNative(VdpBitmapSurface surface, void const *const *source_data,
                                   uint32_t const *source_pitches, VdpRect const *destination_rect)
@@ -1406,6 +2028,7 @@ softVdpBitmapSurfacePutBitsNative(VdpBitmapSurface surface, void const *const *s
     VdpStatus err_code;
     if (!source_data || !source_pitches)
         return VDP_STATUS_INVALID_POINTER;
+    sync_deferred_gl(surface, HANDLETYPE_BITMAP_SURFACE);
     VdpBitmapSurfaceData *dstSurfData = handle_acquire(surface, HANDLETYPE_BITMAP_SURFACE);
     if (NULL == dstSurfData)
         return VDP_STATUS_INVALID_HANDLE;
@@ -1415,7 +2038,21 @@ softVdpBitmapSurfacePutBitsNative(VdpBitmapSurface surface, void const *const *s
     if (destination_rect)
         d_rect = *destination_rect;
 
+    // bitmap may share texture with others, writes outside it would damage them
+    if (d_rect.x0 > d_rect.x1 || d_rect.y0 > d_rect.y1 ||
+        d_rect.x1 > dstSurfData->width || d_rect.y1 > dstSurfData->height)
+    {
+        err_code = VDP_STATUS_INVALID_VALUE;
+        goto quit;
+    }
+
     if (dstSurfData->frequently_accessed) {
+        if (dstSurfData->bitmap_pbo && dstSurfData->fence) {
+            // GPU may still be reading previous contents of the buffer
+            glx_context_push_thread_local(deviceData);
+            glx_context_fence_client_wait(&dstSurfData->fence);
+            glx_context_pop();
+        }
         if (0 == d_rect.x0 && dstSurfData->width == d_rect.x1 && source_pitches[0] == d_rect.x1) {
             // full width
             const int bytes_to_copy =
@@ -1432,23 +2069,20 @@ softVdpBitmapSurfacePutBitsNative(VdpBitmapSurface surface, void const *const *s
                        bytes_in_line);
             }
         }
-        dstSurfData->dirty = 1;
+        bitmap_surface_add_dirty_rect(dstSurfData, d_rect);
     } else {
         glx_context_push_thread_local(deviceData);
+        glx_context_fence_wait(&dstSurfData->fence);
 
-        glBindTexture(GL_TEXTURE_2D, dstSurfData->tex_id);
-        glPixelStorei(GL_UNPACK_ROW_LENGTH, source_pitches[0]/dstSurfData->bytes_per_pixel);
-        if (4 != dstSurfData->bytes_per_pixel)
-            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-        glTexSubImage2D(GL_TEXTURE_2D, 0, d_rect.x0, d_rect.y0,
-            d_rect.x1 - d_rect.x0, d_rect.y1 - d_rect.y0,
-            dstSurfData->gl_format, dstSurfData->gl_type, source_data[0]);
-        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-        if (4 != dstSurfData->bytes_per_pixel)
-            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-        glFinish();
+        gl_state_bind_texture(dstSurfData->tex_id);
+        gl_upload_tex_sub_image(dstSurfData->tex_x + d_rect.x0, dstSurfData->tex_y + d_rect.y0,
+                                d_rect.x1 - d_rect.x0, d_rect.y1 - d_rect.y0,
+                                dstSurfData->gl_format, dstSurfData->gl_type, source_data[0],
+                                source_pitches[0], dstSurfData->bytes_per_pixel);
+        bitmap_surface_upload_padding(dstSurfData, d_rect, source_data[0], source_pitches[0], 0);
+        glx_context_fence_insert(&dstSurfData->fence);
 
-        GLenum gl_error = glGetError();
+        GLenum gl_error = gl_error_check(VDP_FUNC_ID_BITMAP_SURFACE_PUT_BITS_NATIVE);
         glx_context_pop();
         if (GL_NO_ERROR != gl_error) {
             traceError("error (VdpBitmapSurfacePutBitsNative): gl error %d\n", gl_error);
@@ -1463,60 +2097,64 @@ quit:
     return err_code;
 }
 
+static
 void
-print_handle_type(int handle, void *item, void *p)
-{
-    VdpGenericHandle *gh = item;
-    struct {
-        int cnt;
-        int total_cnt;
-        VdpDeviceData *deviceData;
-    } *pp = p;
-    pp->total_cnt ++;
-
-    if (gh) {
-        if (pp->deviceData == gh->parent) {
-            traceError("handle %d type = %d\n", handle, gh->type);
-            pp->cnt ++;
-        }
+print_handle_type(uint32_t handle, void *p)
+{
+    int *cnt = p;
+    traceError("handle %u type = %d\n", handle, handle >> HANDLE_TYPE_SHIFT);
+    (*cnt) ++;
+}
+
+static
+VdpStatus
+destroy_child_object(uint32_t handle, HandleType type)
+{
+    switch (type) {
+    case HANDLETYPE_PRESENTATION_QUEUE_TARGET:
+        return softVdpPresentationQueueTargetDestroy(handle);
+    case HANDLETYPE_PRESENTATION_QUEUE:
+        return softVdpPresentationQueueDestroy(handle);
+    case HANDLETYPE_VIDEO_MIXER:
+        return softVdpVideoMixerDestroy(handle);
+    case HANDLETYPE_OUTPUT_SURFACE:
+        return softVdpOutputSurfaceDestroy(handle);
+    case HANDLETYPE_VIDEO_SURFACE:
+        return softVdpVideoSurfaceDestroy(handle);
+    case HANDLETYPE_BITMAP_SURFACE:
+        return softVdpBitmapSurfaceDestroy(handle);
+    case HANDLETYPE_DECODER:
+        return softVdpDecoderDestroy(handle);
+    default:
+        traceError("warning (destroy_child_object): unknown handle type %d\n", type);
+        return VDP_STATUS_ERROR;
     }
 }
 
 static
 void
-destroy_child_objects(int handle, void *item, void *p)
-{
-    const void *parent = p;
-    VdpGenericHandle *gh = item;
-    if (gh) {
-        if (parent == gh->parent) {
-            switch (gh->type) {
-            case HANDLETYPE_DEVICE:
-                // do nothing
-                break;
-            case HANDLETYPE_PRESENTATION_QUEUE_TARGET:
-                softVdpPresentationQueueDestroy(handle);
-                break;
-            case HANDLETYPE_PRESENTATION_QUEUE:
-                softVdpPresentationQueueDestroy(handle);
-                break;
-            case HANDLETYPE_VIDEO_MIXER:
-                softVdpVideoMixerDestroy(handle);
-                break;
-            case HANDLETYPE_OUTPUT_SURFACE:
-                softVdpOutputSurfaceDestroy(handle);
-                break;
-            case HANDLETYPE_VIDEO_SURFACE:
-                softVdpVideoSurfaceDestroy(handle);
-                break;
-            case HANDLETYPE_BITMAP_SURFACE:
-                softVdpBitmapSurfaceDestroy(handle);
-                break;
-            case HANDLETYPE_DECODER:
-                softVdpDecoderDestroy(handle);
-                break;
-            default:
-                traceError("warning (destroy_child_objects): unknown handle type %d\n", gh->type);
+destroy_child_objects(VdpDeviceData *deviceData)
+{
+    // Users go before objects they use: queues hold targets and output surfaces, mixer
+    // reads video surfaces, and video surfaces share VA surfaces owned by decoders.
+    static const HandleType destroy_order[] = {
+        HANDLETYPE_PRESENTATION_QUEUE,
+        HANDLETYPE_PRESENTATION_QUEUE_TARGET,
+        HANDLETYPE_VIDEO_MIXER,
+        HANDLETYPE_OUTPUT_SURFACE,
+        HANDLETYPE_BITMAP_SURFACE,
+        HANDLETYPE_VIDEO_SURFACE,
+        HANDLETYPE_DECODER,
+    };
+
+    for (unsigned int k = 0; k < sizeof(destroy_order)/sizeof(destroy_order[0]); k ++) {
+        const HandleType type = destroy_order[k];
+        uint32_t child;
+        while ((child = handle_first_child(&deviceData->children, type)) != 0) {
+            if (VDP_STATUS_OK != destroy_child_object(child, type)) {
+                // leave it in list, it will be reported later
+                traceError("warning (destroy_child_objects): failed to destroy handle %u\n",
+                           child);
                 break;
             }
         }
@@ -1536,47 +2174,54 @@ softVdpDeviceDestroy(VdpDevice device)
         // VdpDevice destroys all child object. Let's try to mitigate and prevent leakage.
         traceError("warning (softVdpDeviceDestroy): non-zero reference count (%d). "
                    "Trying to free child objects.\n", data->refcount);
-        void *parent_object = data;
-        handle_execute_for_all(destroy_child_objects, parent_object);
+        destroy_child_objects(data);
     }
 
     if (0 != data->refcount) {
         traceError("error (softVdpDeviceDestroy): still non-zero reference count (%d)\n",
                    data->refcount);
         traceError("Here is the list of objects:\n");
-        struct {
-            int cnt;
-            int total_cnt;
-            VdpDeviceData *deviceData;
-        } state = { .cnt = 0, .total_cnt = 0, .deviceData = data };
-
-        handle_execute_for_all(print_handle_type, &state);
-        traceError("Objects leaked: %d\n", state.cnt);
-        traceError("Objects visited during scan: %d\n", state.total_cnt);
+        int cnt = 0;
+        handle_execute_for_children(&data->children, print_handle_type, &cnt);
+        traceError("Objects leaked: %d\n", cnt);
         err_code = VDP_STATUS_ERROR;
         goto quit;
     }
 
+    // all children are gone, so there are no commands left for GL thread
+    if (data->gl_worker) {
+        gl_worker_destroy(data->gl_worker);
+        data->gl_worker = NULL;
+    }
+
     // cleaup libva
-    if (data->va_available)
+    if (data->va_available) {
+        glx_context_lock();
         vaTerminate(data->va_dpy);
+        glx_context_unlock();
+    }
 
     glx_context_push_thread_local(data);
-    glDeleteTextures(1, &data->watermark_tex_id);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    for (int k = 0; k < BITMAP_ATLAS_COUNT; k ++)
+        gl_atlas_destroy(data->bitmap_atlas[k]);
+    gl_fbo_pool_destroy(data->output_surface_pool);
+    gl_state_delete_texture(data->watermark_tex_id);
+    glx_context_fence_release(&data->watermark_fence);
+    gl_state_bind_framebuffer(0);
     glx_context_pop();
 
-    pthread_mutex_lock(&global.glx_ctx_stack_mutex);
-    glXMakeCurrent(data->display, None, NULL);
-    pthread_mutex_unlock(&global.glx_ctx_stack_mutex);
+    glx_context_release_current(data->display);
 
-    glx_context_unref_glc_hash_table(data->display);
+    glx_context_unref_contexts(data->display);
 
     handle_xdpy_unref(data->display_orig);
     handle_expunge(device);
+    pthread_mutex_destroy(&data->va_mutex);
+    pthread_mutex_destroy(&data->render_batch.lock);
+    free(data->render_batch.vertices);
     free(data);
 
-    GLenum gl_error = glGetError();
+    GLenum gl_error = gl_error_check(VDP_FUNC_ID_DEVICE_DESTROY);
     if (GL_NO_ERROR != gl_error) {
         traceError("error (VdpDeviceDestroy): gl error %d\n", gl_error);
         err_code = VDP_STATUS_ERROR;
@@ -1741,85 +2386,398 @@ vdpBlendStateToGLBlendState(VdpOutputSurfaceRenderBlendState const *blend_state)
     return bs;
 }
 
+/** @brief checks whether blending leaves source values unchanged, so it may be disabled */
 static
-void
-compose_surfaces(struct blend_state_struct bs, VdpRect srcRect, VdpRect dstRect,
-                 VdpColor const *colors, int flags, int has_src_surf)
-{
-    glBlendFuncSeparate(bs.srcFuncRGB, bs.dstFuncRGB, bs.srcFuncAlpha, bs.dstFuncAlpha);
-    glBlendEquationSeparate(bs.modeRGB, bs.modeAlpha);
-
-    glColor4f(1, 1, 1, 1);
-    glBegin(GL_QUADS);
-        if (has_src_surf) {
-            switch (flags & 3) {
-            case VDP_OUTPUT_SURFACE_RENDER_ROTATE_0:
-                glTexCoord2i(srcRect.x0, srcRect.y0); break;
-            case VDP_OUTPUT_SURFACE_RENDER_ROTATE_90:
-                glTexCoord2i(srcRect.x0, srcRect.y1); break;
-            case VDP_OUTPUT_SURFACE_RENDER_ROTATE_180:
-                glTexCoord2i(srcRect.x1, srcRect.y1); break;
-            case VDP_OUTPUT_SURFACE_RENDER_ROTATE_270:
-                glTexCoord2i(srcRect.x1, srcRect.y0); break;
+int
+blend_is_identity(const GLenum blend_func[4], const GLenum blend_eq[2])
+{
+    return GL_ONE == blend_func[0] && GL_ZERO == blend_func[1] &&
+           GL_ONE == blend_func[2] && GL_ZERO == blend_func[3] &&
+           GL_FUNC_ADD == blend_eq[0] && GL_FUNC_ADD == blend_eq[1];
+}
+
+/** @brief render call shapes which have cheaper implementations than a batched quad */
+typedef enum {
+    RENDER_PATH_QUAD = 0,   ///< general case, textured quad goes to the batch
+    RENDER_PATH_FILL,       ///< destination rectangle replaced by solid color, scissored clear
+    RENDER_PATH_COPY,       ///< output surface pixels copied 1:1, framebuffer blit
+} RenderPath;
+
+/** @brief picks render path by call parameters only
+
+    Called before any locks are taken. Surface sizes are not known yet, so chosen copy path
+    may turn out unsuitable later, see render_copy_fits(). Falling back to a quad is always fine.
+
+    @param color    [out] color of the whole quad, for fill path
+*/
+static
+RenderPath
+render_path_select(struct blend_state_struct bs, uint32_t source_surface,
+                   HandleType source_type, VdpColor const *colors, uint32_t flags,
+                   VdpColor *color)
+{
+    const GLenum blend_func[4] = { bs.srcFuncRGB, bs.dstFuncRGB, bs.srcFuncAlpha,
+                                   bs.dstFuncAlpha };
+    const GLenum blend_eq[2] = { bs.modeRGB, bs.modeAlpha };
+    if (!blend_is_identity(blend_func, blend_eq))
+        return RENDER_PATH_QUAD;
+
+    *color = (VdpColor){ 1.0f, 1.0f, 1.0f, 1.0f };
+    if (colors) {
+        *color = colors[0];
+        if (flags & VDP_OUTPUT_SURFACE_RENDER_COLOR_PER_VERTEX) {
+            for (int k = 1; k < 4; k ++) {
+                if (colors[k].red != color->red || colors[k].green != color->green ||
+                    colors[k].blue != color->blue || colors[k].alpha != color->alpha)
+                {
+                    return RENDER_PATH_QUAD;
+                }
             }
         }
-        if (colors)
-            glColor4f(colors[0].red, colors[0].green, colors[0].blue, colors[0].alpha);
-        glVertex2f(dstRect.x0, dstRect.y0);
-
-        if (has_src_surf) {
-            switch (flags & 3) {
-            case VDP_OUTPUT_SURFACE_RENDER_ROTATE_0:
-                glTexCoord2i(srcRect.x1, srcRect.y0); break;
-            case VDP_OUTPUT_SURFACE_RENDER_ROTATE_90:
-                glTexCoord2i(srcRect.x0, srcRect.y0); break;
-            case VDP_OUTPUT_SURFACE_RENDER_ROTATE_180:
-                glTexCoord2i(srcRect.x0, srcRect.y1); break;
-            case VDP_OUTPUT_SURFACE_RENDER_ROTATE_270:
-                glTexCoord2i(srcRect.x1, srcRect.y1); break;
-            }
+    }
+
+    // no source means solid white one, so only color remains
+    if (VDP_INVALID_HANDLE == source_surface)
+        return RENDER_PATH_FILL;
+
+    const int white = (1.0f == color->red && 1.0f == color->green && 1.0f == color->blue &&
+                       1.0f == color->alpha);
+    if (HANDLETYPE_OUTPUT_SURFACE == source_type && white && 0 == (flags & 3))
+        return RENDER_PATH_COPY;
+
+    return RENDER_PATH_QUAD;
+}
+
+/** @brief checks whether rectangles allow plain copy between different surfaces */
+static
+int
+render_copy_fits(VdpOutputSurfaceData *srcSurfData, VdpRect s_rect,
+                 VdpOutputSurfaceData *dstSurfData, VdpRect d_rect)
+{
+    if (NULL == srcSurfData || srcSurfData == dstSurfData)
+        return 0;
+    // mirroring and scaling are left to quads
+    if (s_rect.x0 >= s_rect.x1 || s_rect.y0 >= s_rect.y1)
+        return 0;
+    if (d_rect.x1 - d_rect.x0 != s_rect.x1 - s_rect.x0 ||
+        d_rect.y1 - d_rect.y0 != s_rect.y1 - s_rect.y0)
+    {
+        return 0;
+    }
+    // quads clamp texture coordinates at edges, blit doesn't
+    return s_rect.x1 <= srcSurfData->width && s_rect.y1 <= srcSurfData->height &&
+           d_rect.x1 <= dstSurfData->width && d_rect.y1 <= dstSurfData->height;
+}
+
+/** @brief fills rectangle of output surface with color, as a quad with identity blending would
+
+    Must be called with batch locked, and without quads for the surface in it.
+*/
+static
+void
+output_surface_fill(VdpOutputSurfaceData *dstSurfData, VdpRect d_rect, VdpColor color,
+                    VdpFuncId func_id)
+{
+    const uint32_t x0 = d_rect.x0 < d_rect.x1 ? d_rect.x0 : d_rect.x1;
+    const uint32_t y0 = d_rect.y0 < d_rect.y1 ? d_rect.y0 : d_rect.y1;
+    const uint32_t x1 = d_rect.x0 < d_rect.x1 ? d_rect.x1 : d_rect.x0;
+    const uint32_t y1 = d_rect.y0 < d_rect.y1 ? d_rect.y1 : d_rect.y0;
+    if (x0 == x1 || y0 == y1)
+        return;
+
+    glx_context_push_thread_local(dstSurfData->device);
+    glx_context_fence_wait(&dstSurfData->fence);
+    gl_state_bind_framebuffer(dstSurfData->fbo_id);
+    // quads are drawn with bottom-up target, so no flip here either
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(x0, y0, x1 - x0, y1 - y0);
+    glClearColor(color.red, color.green, color.blue, color.alpha);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDisable(GL_SCISSOR_TEST);
+    output_surface_written(dstSurfData);
+
+    GLenum gl_error = gl_error_check(func_id);
+    glx_context_pop();
+    if (GL_NO_ERROR != gl_error)
+        traceError("error (%s): gl error %d\n", reverse_func_id(func_id), gl_error);
+}
+
+/** @brief copies pixels between output surfaces, see render_copy_fits()
+
+    Must be called with batch locked, and without quads for either surface in it.
+*/
+static
+void
+output_surface_copy(VdpOutputSurfaceData *srcSurfData, VdpRect s_rect,
+                    VdpOutputSurfaceData *dstSurfData, VdpRect d_rect)
+{
+    const VdpFuncId func_id = VDP_FUNC_ID_OUTPUT_SURFACE_RENDER_OUTPUT_SURFACE;
+
+    glx_context_push_thread_local(dstSurfData->device);
+    glx_context_fence_wait(&srcSurfData->fence);
+    glx_context_fence_wait(&dstSurfData->fence);
+    gl_state_bind_framebuffer(dstSurfData->fbo_id);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, srcSurfData->fbo_id);
+    glBlitFramebuffer(s_rect.x0, s_rect.y0, s_rect.x1, s_rect.y1,
+                      d_rect.x0, d_rect.y0, d_rect.x1, d_rect.y1,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    // state cache assumes both bindings are the same
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, dstSurfData->fbo_id);
+    output_surface_written(dstSurfData);
+    glx_context_fence_insert(&srcSurfData->fence);
+
+    GLenum gl_error = gl_error_check(func_id);
+    glx_context_pop();
+    if (GL_NO_ERROR != gl_error)
+        traceError("error (%s): gl error %d\n", reverse_func_id(func_id), gl_error);
+}
+
+static
+void
+render_batch_lock(VdpDeviceData *deviceData)
+{
+    VdpRenderBatch *batch = &deviceData->render_batch;
+    uint64_t acquired_at = lockprof_mutex_lock(&batch->lock, LOCK_CLASS_RENDER_BATCH);
+    batch->lock_acquired_at = acquired_at;
+}
+
+static
+void
+render_batch_unlock(VdpDeviceData *deviceData)
+{
+    VdpRenderBatch *batch = &deviceData->render_batch;
+    lockprof_mutex_unlock(&batch->lock, LOCK_CLASS_RENDER_BATCH, batch->lock_acquired_at);
+}
+
+/** @brief draws all batched quads
+
+    Must be called with batch locked, but without any object locks held, as batched surfaces
+    are acquired here. GL context must not be pushed.
+*/
+static
+void
+render_batch_flush_locked(VdpDeviceData *deviceData)
+{
+    VdpRenderBatch *batch = &deviceData->render_batch;
+    if (0 == batch->quad_count)
+        return;
+
+    const int count = 1 + batch->source_count;
+    uint32_t handles[1 + RENDER_BATCH_MAX_SOURCES];
+    HandleType types[1 + RENDER_BATCH_MAX_SOURCES];
+    void *objs[1 + RENDER_BATCH_MAX_SOURCES];
+    handles[0] = batch->destination;
+    types[0] = HANDLETYPE_OUTPUT_SURFACE;
+    for (int k = 0; k < batch->source_count; k ++) {
+        handles[1 + k] = batch->sources[k];
+        types[1 + k] = batch->source_type;
+    }
+    handle_acquire_many(count, handles, types, objs);
+    VdpOutputSurfaceData *dstSurfData = objs[0];
+    const int from_bitmaps = (HANDLETYPE_BITMAP_SURFACE == batch->source_type);
+    const VdpFuncId func_id = from_bitmaps ? VDP_FUNC_ID_OUTPUT_SURFACE_RENDER_BITMAP_SURFACE
+                                           : VDP_FUNC_ID_OUTPUT_SURFACE_RENDER_OUTPUT_SURFACE;
+
+    // destination is flushed before destruction, but be careful anyway
+    if (NULL == dstSurfData)
+        goto quit;
+
+    glx_context_push_thread_local(deviceData);
+    glx_context_fence_wait(&dstSurfData->fence);
+    gl_state_bind_framebuffer(dstSurfData->fbo_id);
+    gl_render_set_target(dstSurfData->width, dstSurfData->height, 0);
+    if (blend_is_identity(batch->blend_func, batch->blend_eq)) {
+        // quads just overwrite destination, no need to read it
+        gl_state_enable_blend(0);
+    } else {
+        gl_state_enable_blend(1);
+        gl_state_blend_func(batch->blend_func[0], batch->blend_func[1], batch->blend_func[2],
+                            batch->blend_func[3]);
+        gl_state_blend_equation(batch->blend_eq[0], batch->blend_eq[1]);
+    }
+
+    // without source surface, solid white one is used, which leaves just colors
+    gl_render_set_texture(batch->source_tex, batch->source_tex_width, batch->source_tex_height);
+    for (int k = 1; k < count; k ++) {
+        if (NULL == objs[k])
+            continue;
+        if (from_bitmaps) {
+            VdpBitmapSurfaceData *srcSurfData = objs[k];
+            glx_context_fence_wait(&srcSurfData->fence);
+            if (srcSurfData->dirty_count > 0)
+                bitmap_surface_upload_dirty(srcSurfData);
+        } else {
+            VdpOutputSurfaceData *srcSurfData = objs[k];
+            glx_context_fence_wait(&srcSurfData->fence);
         }
-        if (colors && (flags & VDP_OUTPUT_SURFACE_RENDER_COLOR_PER_VERTEX))
-            glColor4f(colors[1].red, colors[1].green, colors[1].blue, colors[1].alpha);
-        glVertex2f(dstRect.x1, dstRect.y0);
-
-        if (has_src_surf) {
-            switch (flags & 3) {
-            case VDP_OUTPUT_SURFACE_RENDER_ROTATE_0:
-                glTexCoord2i(srcRect.x1, srcRect.y1); break;
-            case VDP_OUTPUT_SURFACE_RENDER_ROTATE_90:
-                glTexCoord2i(srcRect.x1, srcRect.y0); break;
-            case VDP_OUTPUT_SURFACE_RENDER_ROTATE_180:
-                glTexCoord2i(srcRect.x0, srcRect.y0); break;
-            case VDP_OUTPUT_SURFACE_RENDER_ROTATE_270:
-                glTexCoord2i(srcRect.x0, srcRect.y1); break;
-            }
+    }
+
+    gl_render_quads(batch->vertices, batch->quad_count);
+    output_surface_written(dstSurfData);
+    for (int k = 1; k < count; k ++) {
+        if (NULL == objs[k])
+            continue;
+        if (from_bitmaps)
+            glx_context_fence_insert(&((VdpBitmapSurfaceData *)objs[k])->fence);
+        else
+            glx_context_fence_insert(&((VdpOutputSurfaceData *)objs[k])->fence);
+    }
+
+    GLenum gl_error = gl_error_check(func_id);
+    glx_context_pop();
+    if (GL_NO_ERROR != gl_error)
+        traceError("error (%s): gl error %d\n", reverse_func_id(func_id), gl_error);
+
+quit:
+    handle_release_many(count, handles, objs);
+    batch->quad_count = 0;
+}
+
+/** @brief draws batched quads if they involve surface with given handle. Batch must be locked */
+static
+void
+render_batch_flush_involving_locked(VdpDeviceData *deviceData, uint32_t handle)
+{
+    VdpRenderBatch *batch = &deviceData->render_batch;
+    int involved = (batch->destination == handle);
+    for (int k = 0; k < batch->source_count; k ++)
+        involved = involved || (batch->sources[k] == handle);
+    if (involved)
+        render_batch_flush_locked(deviceData);
+}
+
+/** @brief draws batched quads if they involve surface with given handle
+
+    Called before surface is accessed in any other way than batched render. Must be called
+    before object lock is taken.
+*/
+static
+void
+render_batch_flush_surface(uint32_t handle, HandleType type)
+{
+    VdpDeviceData *deviceData = handle_get_device_shared(handle, type);
+    if (NULL == deviceData)
+        return;
+
+    render_batch_lock(deviceData);
+    render_batch_flush_involving_locked(deviceData, handle);
+    render_batch_unlock(deviceData);
+}
+
+/** @brief prepares batch to accept quads of render call with given parameters
+
+    Pending quads are drawn first if they were batched with different ones.
+    Must be called with batch locked, but before object locks are taken.
+*/
+static
+void
+render_batch_begin(VdpDeviceData *deviceData, VdpOutputSurface destination, uint32_t source,
+                   HandleType source_type, struct blend_state_struct bs)
+{
+    VdpRenderBatch *batch = &deviceData->render_batch;
+    const GLenum blend_func[4] = { bs.srcFuncRGB, bs.dstFuncRGB, bs.srcFuncAlpha,
+                                   bs.dstFuncAlpha };
+    const GLenum blend_eq[2] = { bs.modeRGB, bs.modeAlpha };
+
+    // Source texture is needed before object locks may be taken. Texture never changes
+    // during object lifetime, so it's safe to peek at it with shared access.
+    GLuint tex_id = 0;
+    uint32_t tex_width = 0;
+    uint32_t tex_height = 0;
+    if (HANDLETYPE_BITMAP_SURFACE == source_type) {
+        VdpBitmapSurfaceData *srcSurfData = handle_acquire_shared(source, source_type);
+        if (srcSurfData) {
+            tex_id = srcSurfData->tex_id;
+            tex_width = srcSurfData->tex_width;
+            tex_height = srcSurfData->tex_height;
+            handle_release_shared(source);
         }
-        if (colors && (flags & VDP_OUTPUT_SURFACE_RENDER_COLOR_PER_VERTEX))
-            glColor4f(colors[2].red, colors[2].green, colors[2].blue, colors[2].alpha);
-        glVertex2f(dstRect.x1, dstRect.y1);
-
-        if (has_src_surf) {
-            switch (flags & 3) {
-            case VDP_OUTPUT_SURFACE_RENDER_ROTATE_0:
-                glTexCoord2i(srcRect.x0, srcRect.y1); break;
-            case VDP_OUTPUT_SURFACE_RENDER_ROTATE_90:
-                glTexCoord2i(srcRect.x1, srcRect.y1); break;
-            case VDP_OUTPUT_SURFACE_RENDER_ROTATE_180:
-                glTexCoord2i(srcRect.x1, srcRect.y0); break;
-            case VDP_OUTPUT_SURFACE_RENDER_ROTATE_270:
-                glTexCoord2i(srcRect.x0, srcRect.y0); break;
-            }
+    } else {
+        VdpOutputSurfaceData *srcSurfData = handle_acquire_shared(source, source_type);
+        if (srcSurfData) {
+            tex_id = srcSurfData->tex_id;
+            tex_width = srcSurfData->width;
+            tex_height = srcSurfData->height;
+            handle_release_shared(source);
         }
-        if (colors && (flags & VDP_OUTPUT_SURFACE_RENDER_COLOR_PER_VERTEX))
-            glColor4f(colors[3].red, colors[3].green, colors[3].blue, colors[3].alpha);
-        glVertex2f(dstRect.x0, dstRect.y1);
-    glEnd();
-    glColor4f(1, 1, 1, 1);
+    }
+
+    // solid color quads have no source to track
+    int source_listed = (0 == tex_id);
+    for (int k = 0; k < batch->source_count; k ++)
+        source_listed = source_listed || (batch->sources[k] == source);
+
+    if (batch->quad_count > 0 && batch->destination == destination &&
+        batch->source_tex == tex_id && batch->source_type == source_type &&
+        0 == memcmp(batch->blend_func, blend_func, sizeof(blend_func)) &&
+        0 == memcmp(batch->blend_eq, blend_eq, sizeof(blend_eq)) &&
+        (source_listed || batch->source_count < RENDER_BATCH_MAX_SOURCES))
+    {
+        if (!source_listed)
+            batch->sources[batch->source_count ++] = source;
+        return;
+    }
+
+    render_batch_flush_locked(deviceData);
+    batch->destination = destination;
+    batch->source_tex = tex_id;
+    batch->source_tex_width = tex_width;
+    batch->source_tex_height = tex_height;
+    batch->source_type = source_type;
+    batch->source_count = 0;
+    if (tex_id)
+        batch->sources[batch->source_count ++] = source;
+    memcpy(batch->blend_func, blend_func, sizeof(blend_func));
+    memcpy(batch->blend_eq, blend_eq, sizeof(blend_eq));
 }
 
+/** @brief adds quad of render call to the batch, see render_batch_begin() */
+static
 VdpStatus
-softVdpOutputSurfaceRenderOutputSurface(VdpOutputSurface destination_surface,
+compose_surfaces(VdpRenderBatch *batch, VdpRect srcRect, VdpRect dstRect, VdpColor const *colors,
+                 int flags)
+{
+    if (batch->quad_count == batch->quad_capacity) {
+        const int new_capacity = batch->quad_capacity ? 2 * batch->quad_capacity : 64;
+        GLRenderVertex *vertices = realloc(batch->vertices,
+                                           new_capacity * 4 * sizeof(GLRenderVertex));
+        if (NULL == vertices)
+            return VDP_STATUS_RESOURCES;
+        batch->vertices = vertices;
+        batch->quad_capacity = new_capacity;
+    }
+
+    // source rectangle corners in the same order as destination ones are listed below
+    const float src_x[4] = { srcRect.x0, srcRect.x1, srcRect.x1, srcRect.x0 };
+    const float src_y[4] = { srcRect.y0, srcRect.y0, srcRect.y1, srcRect.y1 };
+    // each 90 degrees of rotation shift source corners by one position
+    const int rotation = flags & 3;
+
+    GLRenderVertex *v = &batch->vertices[batch->quad_count * 4];
+    v[0] = (GLRenderVertex){ .x = dstRect.x0, .y = dstRect.y0 };
+    v[1] = (GLRenderVertex){ .x = dstRect.x1, .y = dstRect.y0 };
+    v[2] = (GLRenderVertex){ .x = dstRect.x1, .y = dstRect.y1 };
+    v[3] = (GLRenderVertex){ .x = dstRect.x0, .y = dstRect.y1 };
+    for (int k = 0; k < 4; k ++) {
+        const int src_corner = (k + 4 - rotation) % 4;
+        v[k].s = src_x[src_corner];
+        v[k].t = src_y[src_corner];
+
+        VdpColor const *c = NULL;
+        if (colors)
+            c = (flags & VDP_OUTPUT_SURFACE_RENDER_COLOR_PER_VERTEX) ? &colors[k] : &colors[0];
+        v[k].r = c ? c->red : 1.0f;
+        v[k].g = c ? c->green : 1.0f;
+        v[k].b = c ? c->blue : 1.0f;
+        v[k].a = c ? c->alpha : 1.0f;
+    }
+    batch->quad_count ++;
+    return VDP_STATUS_OK;
+}
+
+static
+VdpStatus
+do_output_surface_render_output_surface(VdpOutputSurface destination_surface,
                                         VdpRect const *destination_rect,
                                         VdpOutputSurface source_surface, VdpRect const *source_rect,
                                         VdpColor const *colors,
@@ -1835,9 +2793,45 @@ softVdpOutputSurfaceRenderOutputSurface(VdpOutputSurface destination_surface,
         }
     }
 
-    VdpOutputSurfaceData *dstSurfData =
-        handle_acquire(destination_surface, HANDLETYPE_OUTPUT_SURFACE);
-    VdpOutputSurfaceData *srcSurfData = handle_acquire(source_surface, HANDLETYPE_OUTPUT_SURFACE);
+    // select blend functions
+    struct blend_state_struct bs = vdpBlendStateToGLBlendState(blend_state);
+    if (bs.invalid_func) {
+        err_code = VDP_STATUS_INVALID_BLEND_FACTOR;
+        goto quit_skip_release;
+    }
+    if (bs.invalid_eq) {
+        err_code = VDP_STATUS_INVALID_BLEND_EQUATION;
+        goto quit_skip_release;
+    }
+
+    VdpDeviceData *deviceData =
+        handle_get_device_shared(destination_surface, HANDLETYPE_OUTPUT_SURFACE);
+    if (NULL == deviceData) {
+        err_code = VDP_STATUS_INVALID_HANDLE;
+        goto quit_skip_release;
+    }
+
+    VdpColor fill_color;
+    RenderPath path = render_path_select(bs, source_surface, HANDLETYPE_OUTPUT_SURFACE, colors,
+                                         flags, &fill_color);
+
+    // batch may need to be flushed, which acquires batched surfaces, so lock it first
+    render_batch_lock(deviceData);
+    if (RENDER_PATH_QUAD != path) {
+        // cheap paths go around the batch, so earlier quads on the same surfaces go first
+        render_batch_flush_involving_locked(deviceData, destination_surface);
+        render_batch_flush_involving_locked(deviceData, source_surface);
+    }
+    render_batch_begin(deviceData, destination_surface, source_surface,
+                       HANDLETYPE_OUTPUT_SURFACE, bs);
+
+    // source and destination may be the same surface, acquire_many handles that too
+    const uint32_t handles[] = { destination_surface, source_surface };
+    const HandleType types[] = { HANDLETYPE_OUTPUT_SURFACE, HANDLETYPE_OUTPUT_SURFACE };
+    void *objs[2];
+    handle_acquire_many(2, handles, types, objs);
+    VdpOutputSurfaceData *dstSurfData = objs[0];
+    VdpOutputSurfaceData *srcSurfData = objs[1];
 
     if (NULL == dstSurfData) {
         err_code = VDP_STATUS_INVALID_HANDLE;
@@ -1847,7 +2841,6 @@ softVdpOutputSurfaceRenderOutputSurface(VdpOutputSurface destination_surface,
         err_code = VDP_STATUS_HANDLE_DEVICE_MISMATCH;
         goto quit;
     }
-    VdpDeviceData *deviceData = dstSurfData->device;
 
     VdpRect s_rect = {0, 0, 0, 0};
     VdpRect d_rect = {0, 0, dstSurfData->width, dstSurfData->height};
@@ -1859,58 +2852,35 @@ softVdpOutputSurfaceRenderOutputSurface(VdpOutputSurface destination_surface,
     if (destination_rect)
         d_rect = *destination_rect;
 
-    // select blend functions
-    struct blend_state_struct bs = vdpBlendStateToGLBlendState(blend_state);
-    if (bs.invalid_func) {
-        err_code = VDP_STATUS_INVALID_BLEND_FACTOR;
-        goto quit;
-    }
-    if (bs.invalid_eq) {
-        err_code = VDP_STATUS_INVALID_BLEND_EQUATION;
-        goto quit;
-    }
-
-    glx_context_push_thread_local(deviceData);
-    glBindFramebuffer(GL_FRAMEBUFFER, dstSurfData->fbo_id);
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glOrtho(0, dstSurfData->width, 0, dstSurfData->height, -1.0f, 1.0f);
-    glViewport(0, 0, dstSurfData->width, dstSurfData->height);
-    glEnable(GL_TEXTURE_2D);
-    glEnable(GL_BLEND);
-
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-
-    if (srcSurfData) {
-        glBindTexture(GL_TEXTURE_2D, srcSurfData->tex_id);
-
-        glMatrixMode(GL_TEXTURE);
-        glLoadIdentity();
-        glScalef(1.0f/srcSurfData->width, 1.0f/srcSurfData->height, 1.0f);
-    }
-
-    compose_surfaces(bs, s_rect, d_rect, colors, flags, !!srcSurfData);
-    glFinish();
-
-    GLenum gl_error = glGetError();
-    glx_context_pop();
-    if (GL_NO_ERROR != gl_error) {
-        traceError("error (VdpOutputSurfaceRenderOutputSurface): gl error %d\n", gl_error);
-        err_code = VDP_STATUS_ERROR;
-        goto quit;
-    }
+    if (RENDER_PATH_COPY == path && !render_copy_fits(srcSurfData, s_rect, dstSurfData, d_rect))
+        path = RENDER_PATH_QUAD;
 
     err_code = VDP_STATUS_OK;
+    switch (path) {
+    case RENDER_PATH_FILL:
+        output_surface_fill(dstSurfData, d_rect, fill_color,
+                            VDP_FUNC_ID_OUTPUT_SURFACE_RENDER_OUTPUT_SURFACE);
+        break;
+    case RENDER_PATH_COPY:
+        output_surface_copy(srcSurfData, s_rect, dstSurfData, d_rect);
+        break;
+    default:
+        err_code = compose_surfaces(&deviceData->render_batch, s_rect, d_rect, colors, flags);
+        break;
+    }
 quit:
-    handle_release(source_surface);
-    handle_release(destination_surface);
+    handle_release_many(2, handles, objs);
+    // following quads would read what this one writes, so it can't wait in the batch
+    if (destination_surface == source_surface)
+        render_batch_flush_locked(deviceData);
+    render_batch_unlock(deviceData);
 quit_skip_release:
     return err_code;
 }
 
+static
 VdpStatus
-softVdpOutputSurfaceRenderBitmapSurface(VdpOutputSurface destination_surface,
+do_output_surface_render_bitmap_surface(VdpOutputSurface destination_surface,
                                         VdpRect const *destination_rect,
                                         VdpBitmapSurface source_surface, VdpRect const *source_rect,
                                         VdpColor const *colors,
@@ -1926,9 +2896,42 @@ softVdpOutputSurfaceRenderBitmapSurface(VdpOutputSurface destination_surface,
         }
     }
 
-    VdpOutputSurfaceData *dstSurfData =
-        handle_acquire(destination_surface, HANDLETYPE_OUTPUT_SURFACE);
-    VdpBitmapSurfaceData *srcSurfData = handle_acquire(source_surface, HANDLETYPE_BITMAP_SURFACE);
+    // select blend functions
+    struct blend_state_struct bs = vdpBlendStateToGLBlendState(blend_state);
+    if (bs.invalid_func) {
+        err_code = VDP_STATUS_INVALID_BLEND_FACTOR;
+        goto quit_skip_release;
+    }
+    if (bs.invalid_eq) {
+        err_code = VDP_STATUS_INVALID_BLEND_EQUATION;
+        goto quit_skip_release;
+    }
+
+    VdpDeviceData *deviceData =
+        handle_get_device_shared(destination_surface, HANDLETYPE_OUTPUT_SURFACE);
+    if (NULL == deviceData) {
+        err_code = VDP_STATUS_INVALID_HANDLE;
+        goto quit_skip_release;
+    }
+
+    // bitmaps are never copied directly, their textures may have different format
+    VdpColor fill_color;
+    const RenderPath path = render_path_select(bs, source_surface, HANDLETYPE_BITMAP_SURFACE,
+                                               colors, flags, &fill_color);
+
+    // batch may need to be flushed, which acquires batched surfaces, so lock it first
+    render_batch_lock(deviceData);
+    if (RENDER_PATH_FILL == path)
+        render_batch_flush_involving_locked(deviceData, destination_surface);
+    render_batch_begin(deviceData, destination_surface, source_surface,
+                       HANDLETYPE_BITMAP_SURFACE, bs);
+
+    const uint32_t handles[] = { destination_surface, source_surface };
+    const HandleType types[] = { HANDLETYPE_OUTPUT_SURFACE, HANDLETYPE_BITMAP_SURFACE };
+    void *objs[2];
+    handle_acquire_many(2, handles, types, objs);
+    VdpOutputSurfaceData *dstSurfData = objs[0];
+    VdpBitmapSurfaceData *srcSurfData = objs[1];
     if (NULL == dstSurfData) {
         err_code = VDP_STATUS_INVALID_HANDLE;
         goto quit;
@@ -1937,7 +2940,6 @@ softVdpOutputSurfaceRenderBitmapSurface(VdpOutputSurface destination_surface,
         err_code = VDP_STATUS_HANDLE_DEVICE_MISMATCH;
         goto quit;
     }
-    VdpDeviceData *deviceData = dstSurfData->device;
 
     VdpRect s_rect = {0, 0, 0, 0};
     VdpRect d_rect = {0, 0, dstSurfData->width, dstSurfData->height};
@@ -1949,63 +2951,206 @@ softVdpOutputSurfaceRenderBitmapSurface(VdpOutputSurface destination_surface,
     if (destination_rect)
         d_rect = *destination_rect;
 
-    // select blend functions
-    struct blend_state_struct bs = vdpBlendStateToGLBlendState(blend_state);
-    if (bs.invalid_func) {
-        err_code = VDP_STATUS_INVALID_BLEND_FACTOR;
-        goto quit;
+    if (srcSurfData) {
+        // bitmap may be just a part of atlas page texture, neighbours must not be sampled
+        s_rect.x0 = s_rect.x0 < srcSurfData->width ? s_rect.x0 : srcSurfData->width;
+        s_rect.x1 = s_rect.x1 < srcSurfData->width ? s_rect.x1 : srcSurfData->width;
+        s_rect.y0 = s_rect.y0 < srcSurfData->height ? s_rect.y0 : srcSurfData->height;
+        s_rect.y1 = s_rect.y1 < srcSurfData->height ? s_rect.y1 : srcSurfData->height;
+        s_rect.x0 += srcSurfData->tex_x;
+        s_rect.x1 += srcSurfData->tex_x;
+        s_rect.y0 += srcSurfData->tex_y;
+        s_rect.y1 += srcSurfData->tex_y;
     }
-    if (bs.invalid_eq) {
-        err_code = VDP_STATUS_INVALID_BLEND_EQUATION;
-        goto quit;
+
+    err_code = VDP_STATUS_OK;
+    if (RENDER_PATH_FILL == path) {
+        output_surface_fill(dstSurfData, d_rect, fill_color,
+                            VDP_FUNC_ID_OUTPUT_SURFACE_RENDER_BITMAP_SURFACE);
+    } else {
+        err_code = compose_surfaces(&deviceData->render_batch, s_rect, d_rect, colors, flags);
     }
+quit:
+    handle_release_many(2, handles, objs);
+    render_batch_unlock(deviceData);
+quit_skip_release:
+    return err_code;
+}
 
-    glx_context_push_thread_local(deviceData);
-    glBindFramebuffer(GL_FRAMEBUFFER, dstSurfData->fbo_id);
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glOrtho(0, dstSurfData->width, 0, dstSurfData->height, -1.0f, 1.0f);
-    glViewport(0, 0, dstSurfData->width, dstSurfData->height);
-    glEnable(GL_TEXTURE_2D);
-    glEnable(GL_BLEND);
+/** @brief deferred VdpOutputSurfaceRenderOutputSurface or VdpOutputSurfaceRenderBitmapSurface call
+*/
+struct render_surface_cmd {
+    GLWorkerCommand     base;
+    VdpOutputSurface    destination_surface;
+    uint32_t            source_surface;     ///< output or bitmap surface
+    VdpRect             destination_rect;
+    VdpRect             source_rect;
+    VdpColor            colors[4];
+    VdpOutputSurfaceRenderBlendState    blend_state;
+    uint32_t            flags;
+    int                 has_destination_rect;
+    int                 has_source_rect;
+    int                 has_colors;
+    int                 has_blend_state;
+};
 
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
+/** @brief checks what synchronous render would check, so errors are reported to caller */
+static
+VdpStatus
+check_deferred_render(VdpDeviceData *deviceData, uint32_t source_surface, HandleType source_type,
+                      VdpOutputSurfaceRenderBlendState const *blend_state)
+{
+    if (blend_state) {
+        if (VDP_OUTPUT_SURFACE_RENDER_BLEND_STATE_VERSION != blend_state->struct_version)
+            return VDP_STATUS_INVALID_VALUE;
+    }
 
-    if (srcSurfData) {
-        glBindTexture(GL_TEXTURE_2D, srcSurfData->tex_id);
-        if (srcSurfData->dirty) {
-            if (4 != srcSurfData->bytes_per_pixel)
-                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, srcSurfData->width, srcSurfData->height,
-                            srcSurfData->gl_format, srcSurfData->gl_type, srcSurfData->bitmap_data);
-            if (4 != srcSurfData->bytes_per_pixel)
-                glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-            srcSurfData->dirty = 0;
-        }
+    struct blend_state_struct bs = vdpBlendStateToGLBlendState(blend_state);
+    if (bs.invalid_func)
+        return VDP_STATUS_INVALID_BLEND_FACTOR;
+    if (bs.invalid_eq)
+        return VDP_STATUS_INVALID_BLEND_EQUATION;
 
-        glMatrixMode(GL_TEXTURE);
-        glLoadIdentity();
-        glScalef(1.0f/srcSurfData->width, 1.0f/srcSurfData->height, 1.0f);
-    }
+    // invalid source handle means "no source", render uses colors only
+    VdpDeviceData *srcDeviceData = handle_get_device_shared(source_surface, source_type);
+    if (srcDeviceData && srcDeviceData != deviceData)
+        return VDP_STATUS_HANDLE_DEVICE_MISMATCH;
 
-    compose_surfaces(bs, s_rect, d_rect, colors, flags, !!srcSurfData);
-    glFinish();
+    return VDP_STATUS_OK;
+}
 
-    GLenum gl_error = glGetError();
-    glx_context_pop();
-    if (GL_NO_ERROR != gl_error) {
-        traceError("error (VdpOutputSurfaceRenderBitmapSurface): gl error %d\n", gl_error);
-        err_code = VDP_STATUS_ERROR;
-        goto quit;
+static
+struct render_surface_cmd *
+new_render_surface_cmd(VdpOutputSurface destination_surface, VdpRect const *destination_rect,
+                       uint32_t source_surface, VdpRect const *source_rect,
+                       VdpColor const *colors, VdpOutputSurfaceRenderBlendState const *blend_state,
+                       uint32_t flags)
+{
+    struct render_surface_cmd *cmd = calloc(1, sizeof(struct render_surface_cmd));
+    if (NULL == cmd)
+        return NULL;
+
+    cmd->destination_surface = destination_surface;
+    cmd->source_surface = source_surface;
+    cmd->flags = flags;
+    if (destination_rect) {
+        cmd->destination_rect = *destination_rect;
+        cmd->has_destination_rect = 1;
+    }
+    if (source_rect) {
+        cmd->source_rect = *source_rect;
+        cmd->has_source_rect = 1;
+    }
+    if (colors) {
+        const int color_count = (flags & VDP_OUTPUT_SURFACE_RENDER_COLOR_PER_VERTEX) ? 4 : 1;
+        memcpy(cmd->colors, colors, color_count * sizeof(VdpColor));
+        cmd->has_colors = 1;
+    }
+    if (blend_state) {
+        cmd->blend_state = *blend_state;
+        cmd->has_blend_state = 1;
     }
+    return cmd;
+}
 
-    err_code = VDP_STATUS_OK;
-quit:
-    handle_release(source_surface);
-    handle_release(destination_surface);
-quit_skip_release:
-    return err_code;
+static
+void
+exec_output_surface_render_output_surface(GLWorkerCommand *base)
+{
+    struct render_surface_cmd *cmd = (struct render_surface_cmd *)base;
+
+    VdpStatus err_code = do_output_surface_render_output_surface(
+        cmd->destination_surface, cmd->has_destination_rect ? &cmd->destination_rect : NULL,
+        cmd->source_surface, cmd->has_source_rect ? &cmd->source_rect : NULL,
+        cmd->has_colors ? cmd->colors : NULL, cmd->has_blend_state ? &cmd->blend_state : NULL,
+        cmd->flags);
+    if (VDP_STATUS_OK != err_code) {
+        traceError("error (VdpOutputSurfaceRenderOutputSurface): deferred call failed, %s\n",
+                   reverse_status(err_code));
+    }
+    free(cmd);
+}
+
+static
+void
+exec_output_surface_render_bitmap_surface(GLWorkerCommand *base)
+{
+    struct render_surface_cmd *cmd = (struct render_surface_cmd *)base;
+
+    VdpStatus err_code = do_output_surface_render_bitmap_surface(
+        cmd->destination_surface, cmd->has_destination_rect ? &cmd->destination_rect : NULL,
+        cmd->source_surface, cmd->has_source_rect ? &cmd->source_rect : NULL,
+        cmd->has_colors ? cmd->colors : NULL, cmd->has_blend_state ? &cmd->blend_state : NULL,
+        cmd->flags);
+    if (VDP_STATUS_OK != err_code) {
+        traceError("error (VdpOutputSurfaceRenderBitmapSurface): deferred call failed, %s\n",
+                   reverse_status(err_code));
+    }
+    free(cmd);
+}
+
+VdpStatus
+softVdpOutputSurfaceRenderOutputSurface(VdpOutputSurface destination_surface,
+                                        VdpRect const *destination_rect,
+                                        VdpOutputSurface source_surface, VdpRect const *source_rect,
+                                        VdpColor const *colors,
+                                        VdpOutputSurfaceRenderBlendState const *blend_state,
+                                        uint32_t flags)
+{
+    VdpDeviceData *deviceData =
+        handle_get_device_shared(destination_surface, HANDLETYPE_OUTPUT_SURFACE);
+    if (NULL == deviceData || NULL == deviceData->gl_worker) {
+        return do_output_surface_render_output_surface(destination_surface, destination_rect,
+                                                       source_surface, source_rect, colors,
+                                                       blend_state, flags);
+    }
+
+    VdpStatus err_code = check_deferred_render(deviceData, source_surface,
+                                               HANDLETYPE_OUTPUT_SURFACE, blend_state);
+    if (VDP_STATUS_OK != err_code)
+        return err_code;
+
+    struct render_surface_cmd *cmd = new_render_surface_cmd(destination_surface, destination_rect,
+                                                            source_surface, source_rect, colors,
+                                                            blend_state, flags);
+    if (NULL == cmd)
+        return VDP_STATUS_RESOURCES;
+    cmd->base.execute = exec_output_surface_render_output_surface;
+
+    gl_worker_submit(deviceData->gl_worker, &cmd->base);
+    return VDP_STATUS_OK;
+}
+
+VdpStatus
+softVdpOutputSurfaceRenderBitmapSurface(VdpOutputSurface destination_surface,
+                                        VdpRect const *destination_rect,
+                                        VdpBitmapSurface source_surface, VdpRect const *source_rect,
+                                        VdpColor const *colors,
+                                        VdpOutputSurfaceRenderBlendState const *blend_state,
+                                        uint32_t flags)
+{
+    VdpDeviceData *deviceData =
+        handle_get_device_shared(destination_surface, HANDLETYPE_OUTPUT_SURFACE);
+    if (NULL == deviceData || NULL == deviceData->gl_worker) {
+        return do_output_surface_render_bitmap_surface(destination_surface, destination_rect,
+                                                       source_surface, source_rect, colors,
+                                                       blend_state, flags);
+    }
+
+    VdpStatus err_code = check_deferred_render(deviceData, source_surface,
+                                               HANDLETYPE_BITMAP_SURFACE, blend_state);
+    if (VDP_STATUS_OK != err_code)
+        return err_code;
+
+    struct render_surface_cmd *cmd = new_render_surface_cmd(destination_surface, destination_rect,
+                                                            source_surface, source_rect, colors,
+                                                            blend_state, flags);
+    if (NULL == cmd)
+        return VDP_STATUS_RESOURCES;
+    cmd->base.execute = exec_output_surface_render_bitmap_surface;
+
+    gl_worker_submit(deviceData->gl_worker, &cmd->base);
+    return VDP_STATUS_OK;
 }
 
 VdpStatus
@@ -2249,31 +3394,55 @@ softVdpDeviceCreateX11(Display *display_orig, int screen, VdpDevice *device,
     data->screen = screen;
     data->refcount = 0;
     data->root = DefaultRootWindow(display);
+    pthread_mutex_init(&data->va_mutex, NULL);
+    pthread_mutex_init(&data->render_batch.lock, NULL);
+    data->render_batch.destination = VDP_INVALID_HANDLE;
+    // without pool, surface objects are just deleted on release
+    data->output_surface_pool = gl_fbo_pool_create(OUTPUT_SURFACE_POOL_MAX_COUNT,
+                                                   OUTPUT_SURFACE_POOL_MAX_BYTES);
 
     // create master GLX context to share data between further created ones
-    glx_context_ref_glc_hash_table(display, screen);
+    glx_context_ref_contexts(display, screen);
     data->root_glc = glx_context_get_root_context();
 
     glx_context_push_thread_local(data);
+    glx_context_detect_caps();
 
-    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
+    // all drawing goes through shaders, there is no other way to render anything
+    if (!gl_render_init()) {
+        traceError("error (VdpDeviceCreateX11): can't build shader programs, "
+                   "GLSL 1.30 is required\n");
+        glx_context_pop();
+        glx_context_release_current(display);
+        glx_context_unref_contexts(display);
+        handle_xdpy_unref(display_orig);
+        gl_fbo_pool_destroy(data->output_surface_pool);
+        pthread_mutex_destroy(&data->va_mutex);
+        pthread_mutex_destroy(&data->render_batch.lock);
+        free(data);
+        return VDP_STATUS_ERROR;
+    }
 
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 
     // initialize VAAPI
     if (global.quirks.avoid_va) {
         // pretend there is no VA-API available
         data->va_available = 0;
+    } else if (glx_context_uses_egl()) {
+        // VA-API delivers decoded frames to textures through GLX only
+        traceInfo("warning: VA-API is not used with EGL contexts. "
+                  "No video decode acceleration available.\n");
+        data->va_available = 0;
     } else {
+        glx_context_lock();
+        gl_state_unbind_for_foreign_code();
         data->va_dpy = vaGetDisplayGLX(display);
         data->va_available = 0;
 
         VAStatus status = vaInitialize(data->va_dpy, &data->va_version_major,
                                        &data->va_version_minor);
+        glx_context_unlock();
         if (VA_STATUS_SUCCESS == status) {
             data->va_available = 1;
             traceInfo("libva (version %d.%d) library initialized\n",
@@ -2286,7 +3455,7 @@ softVdpDeviceCreateX11(Display *display_orig, int screen, VdpDevice *device,
     }
 
     glGenTextures(1, &data->watermark_tex_id);
-    glBindTexture(GL_TEXTURE_2D, data->watermark_tex_id);
+    gl_state_bind_texture(data->watermark_tex_id);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -2301,9 +3470,42 @@ softVdpDeviceCreateX11(Display *display_orig, int screen, VdpDevice *device,
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, watermark_width, watermark_height, 0, GL_RED,
                  GL_UNSIGNED_BYTE, watermark_data);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-    glFinish();
+    // watermark is drawn in presentation target context, which waits for this fence
+    glx_context_fence_insert(&data->watermark_fence);
+
+    data->gl_worker = NULL;
+    if (global.quirks.gl_thread) {
+        data->gl_worker = gl_worker_create();
+        if (NULL == data->gl_worker) {
+            traceError("warning (VdpDeviceCreateX11): failed to start GL thread, "
+                       "rendering will be synchronous\n");
+        }
+    }
 
     *device = handle_insert(data);
+    if (VDP_INVALID_HANDLE == *device) {
+        // out of handles
+        traceError("error (VdpDeviceCreateX11): can't allocate handle\n");
+        gl_state_delete_texture(data->watermark_tex_id);
+        glx_context_fence_release(&data->watermark_fence);
+        gl_fbo_pool_destroy(data->output_surface_pool);
+        gl_state_bind_framebuffer(0);
+        glx_context_pop();
+        if (data->gl_worker)
+            gl_worker_destroy(data->gl_worker);
+        if (data->va_available) {
+            glx_context_lock();
+            vaTerminate(data->va_dpy);
+            glx_context_unlock();
+        }
+        glx_context_release_current(display);
+        glx_context_unref_contexts(display);
+        handle_xdpy_unref(display_orig);
+        pthread_mutex_destroy(&data->va_mutex);
+        pthread_mutex_destroy(&data->render_batch.lock);
+        free(data);
+        return VDP_STATUS_RESOURCES;
+    }
     *get_proc_address = &softVdpGetProcAddress;
 
     GLenum gl_error = glGetError();
@@ -9,10 +9,17 @@
 #ifndef VDPAU_SOFT_H_
 #define VDPAU_SOFT_H_
 
+#include <EGL/egl.h>
 #include <GL/glx.h>
 #include <pthread.h>
 #include <vdpau/vdpau.h>
 #include <va/va.h>
+#include "gl-atlas.h"
+#include "gl-error.h"
+#include "gl-fbo-pool.h"
+#include "gl-render.h"
+#include "gl-state.h"
+#include "gl-worker.h"
 #include "handle-storage.h"
 
 #define MAX_RENDER_TARGETS          21
@@ -20,22 +27,59 @@
 
 #define PRESENTATION_QUEUE_LENGTH   10
 
+#define RENDER_BATCH_MAX_SOURCES    32
+#define BITMAP_ATLAS_COUNT          (VDP_RGBA_FORMAT_A8 + 1)    ///< one for each VdpRGBAFormat
+#define OUTPUT_SURFACE_POOL_MAX_COUNT   16
+#define OUTPUT_SURFACE_POOL_MAX_BYTES   (64 * 1024 * 1024)
+
+/** @brief output surface render calls accumulated to be drawn at once
+
+    Consecutive calls with the same destination, source texture and blend state differ only
+    in vertices, so they are collected here and drawn with a single call. Bitmaps from the
+    same atlas page share texture, so there may be several sources. Batch is flushed when
+    any of that changes, or when destination or any source is accessed otherwise.
+*/
+typedef struct {
+    pthread_mutex_t     lock;
+    uint64_t            lock_acquired_at;   ///< for lock profiler, accessed by lock holder only
+    VdpOutputSurface    destination;
+    GLuint              source_tex;     ///< texture quads sample, 0 for solid color ones
+    uint32_t            source_tex_width;
+    uint32_t            source_tex_height;
+    HandleType          source_type;    ///< output or bitmap surface
+    uint32_t            sources[RENDER_BATCH_MAX_SOURCES];  ///< surfaces quads come from
+    int                 source_count;
+    GLenum              blend_func[4];  ///< source and destination RGB, then alpha factors
+    GLenum              blend_eq[2];    ///< RGB and alpha equations
+    GLRenderVertex     *vertices;       ///< four per quad, texture coordinates in texels
+    int                 quad_count;
+    int                 quad_capacity;
+} VdpRenderBatch;
+
 /** @brief VdpDevice object parameters */
 typedef struct {
     HandleType      type;           ///< common type field
     void           *self;           ///< link to device. For VdpDeviceData this is link to itself
     pthread_mutex_t lock;
     int             refcount;
+    HandleChildList children;       ///< objects created on this device
     Display        *display;        ///< own X display connection
     Display        *display_orig;   ///< supplied X display connection
     int             screen;         ///< X screen
-    GLXContext      root_glc;       ///< master GL context
+    GLXContext      root_glc;       ///< master GL context, NULL with EGL backend
     Window          root;           ///< X drawable (root window) used for offscreen drawing
     VADisplay       va_dpy;         ///< VA display
+    pthread_mutex_t va_mutex;       ///< serializes calls to va_dpy
+    uint64_t        va_lock_acquired_at;    ///< for lock profiler, accessed by lock holder only
     int             va_available;   ///< 1 if VA-API available
     int             va_version_major;
     int             va_version_minor;
     GLuint          watermark_tex_id;   ///< GL texture id for watermark
+    GLsync          watermark_fence;    ///< fence placed after watermark texture upload
+    GLWorker       *gl_worker;      ///< GL command thread, NULL if commands run synchronously
+    VdpRenderBatch  render_batch;   ///< pending output surface render calls
+    GLAtlas        *bitmap_atlas[BITMAP_ATLAS_COUNT];   ///< small bitmaps, by format
+    GLFboPool      *output_surface_pool;    ///< released output surface textures, or NULL
 } VdpDeviceData;
 
 /** @brief VdpVideoMixer object parameters */
@@ -59,9 +103,12 @@ typedef struct {
     GLuint          gl_format;          ///< GL texture format: preferred external format
     GLuint          gl_type;            ///< GL texture format: pixel type
     unsigned int    bytes_per_pixel;    ///< number of bytes per pixel
-    VdpTime         first_presentation_time;    ///< first displayed time in queue
-    VdpPresentationQueueStatus  status; ///< status in presentation queue
+    VdpTime         first_presentation_time;    ///< first displayed time in queue (atomic)
+    VdpPresentationQueueStatus  status; ///< status in presentation queue (atomic)
     VdpTime         queued_at;
+    GLsync          fence;              ///< fence placed after last GL access to the surface
+    GLuint          readback_pbo;       ///< pixel pack buffer contents are prefetched to, or 0
+    int             readback_ready;     ///< readback_pbo holds current contents
 } VdpOutputSurfaceData;
 
 /** @brief VdpPresentationQueueTarget object parameters */
@@ -72,6 +119,10 @@ typedef struct {
     int             refcount;
     Drawable        drawable;       ///< X drawable to output to
     GLXContext      glc;            ///< GL context used for output
+    EGLSurface      egl_surface;    ///< window surface for drawable, EGL backend only
+    EGLContext      egl_ctx;        ///< GL context used for output, EGL backend only
+    GLState         gl_state;       ///< shadow copy of output context state
+    GLErrorLog      error_log;      ///< errors reported by output context debug output
 } VdpPresentationQueueTargetData;
 
 /** @brief VdpPresentationQueue object parameters */
@@ -117,15 +168,24 @@ typedef struct {
     VASurfaceID     va_surf;        ///< VA-API surface
     void           *va_glx;         ///< handle for VA-API/GLX interaction
     GLuint          tex_id;         ///< GL texture id (RGBA)
+    GLsync          fence;          ///< fence placed after last GL access to the texture
 } VdpVideoSurfaceData;
 
+#define BITMAP_DIRTY_RECT_COUNT     4
+
 /** @brief VdpBitmapSurface object parameters */
 typedef struct {
     HandleType      type;               ///< handle type
     VdpDeviceData  *device;             ///< link to parent
     pthread_mutex_t lock;
     VdpRGBAFormat   rgba_format;        ///< RGBA format of data stored
-    GLuint          tex_id;             ///< GL texture id
+    GLuint          tex_id;             ///< GL texture id, own or of atlas page
+    uint32_t        tex_x;              ///< position of bitmap in texture
+    uint32_t        tex_y;
+    uint32_t        tex_width;          ///< texture size
+    uint32_t        tex_height;
+    GLAtlas        *atlas;              ///< atlas bitmap is placed in, or NULL
+    GLAtlasRegion   atlas_region;
     uint32_t        width;
     uint32_t        height;
     VdpBool         frequently_accessed;///< 1 if surface should be optimized for frequent access
@@ -134,8 +194,11 @@ typedef struct {
     GLuint          gl_format;          ///< GL texture format: preferred external format
     GLuint          gl_type;            ///< GL texture format: pixel type
     char           *bitmap_data;        ///< system-memory buffer for frequently accessed bitmaps
-    int             dirty;              ///< dirty flag. True if system-memory buffer contains data
-                                        ///< newer than GPU texture contents
+    GLuint          bitmap_pbo;         ///< persistently mapped buffer bitmap_data points to, or 0
+    VdpRect         dirty_rects[BITMAP_DIRTY_RECT_COUNT];   ///< areas of system-memory buffer
+                                        ///< containing data newer than GPU texture contents
+    int             dirty_count;        ///< number of dirty_rects in use
+    GLsync          fence;              ///< fence placed after last GL access to the surface
 } VdpBitmapSurfaceData;
 
 /** @brief VdpDecoder object parameters */
@@ -155,6 +218,15 @@ typedef struct {
 } VdpDecoderData;
 
 
+void
+sync_deferred_gl(uint32_t handle, HandleType type);
+
+void
+va_display_lock(VdpDeviceData *deviceData);
+
+void
+va_display_unlock(VdpDeviceData *deviceData);
+
 VdpStatus
 softVdpDeviceCreateX11(Display *display, int screen, VdpDevice *device,
                        VdpGetProcAddress **get_proc_address);
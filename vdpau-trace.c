@@ -19,6 +19,7 @@ static const char *trace_header_blank = "     ";
 static int trace_enabled = 1;
 static void (*trace_hook)(void *, void *, int, int);
 static void *trace_hook_longterm_param = NULL;
+static __thread int current_func_id = TRACE_FUNC_ID_NONE;  ///< function being executed
 
 void
 traceEnableTracing(int flag)
@@ -48,12 +49,21 @@ traceSetHook(void (*hook)(void *param1, void *param2, int origin, int after), vo
 void
 traceCallHook(int origin, int after, void *shortterm_param)
 {
+    // traceInfo() calls come from inside of API functions, don't let them reset caller
+    if (TRACE_FUNC_ID_INFO != origin)
+        current_func_id = after ? TRACE_FUNC_ID_NONE : origin;
     if (!trace_enabled)
         return;
     if (trace_hook)
         trace_hook(trace_hook_longterm_param, shortterm_param, origin, after);
 }
 
+int
+traceGetCurrentFuncId(void)
+{
+    return current_func_id;
+}
+
 void
 traceSetHeader(const char *header, const char *header_blank)
 {
@@ -67,7 +77,7 @@ traceInfo(const char *fmt, ...)
     if (!trace_enabled)
         return;
     va_list args;
-    traceCallHook(-2, 0, NULL);
+    traceCallHook(TRACE_FUNC_ID_INFO, 0, NULL);
     fprintf(tlog, "%s", trace_header);
     va_start(args, fmt);
     vfprintf(tlog, fmt, args);
@@ -105,9 +115,9 @@ VdpStatus
 traceVdpGetApiVersion(uint32_t *api_version)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_GET_API_VERSION, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_GET_API_VERSION, 0, NULL);
     fprintf(tlog, "%s%s VdpGetApiVersion\n", trace_header, impl_state);
 skip:;
     VdpStatus ret = softVdpGetApiVersion(api_version);
@@ -122,9 +132,9 @@ traceVdpDecoderQueryCapabilities(VdpDevice device,
                                  uint32_t *max_width, uint32_t *max_height)
 {
     const char *impl_state = "{part}";
+    traceCallHook(VDP_FUNC_ID_DECODER_QUERY_CAPABILITIES, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_DECODER_QUERY_CAPABILITIES, 0, NULL);
     fprintf(tlog, "%s%s VdpDecoderQueryCapabilities device=%d, profile=%s\n",
         trace_header, impl_state, device, reverse_decoder_profile(profile));
 skip:;
@@ -139,9 +149,9 @@ traceVdpDecoderCreate(VdpDevice device, VdpDecoderProfile profile,
                       uint32_t width, uint32_t height, uint32_t max_references, VdpDecoder *decoder)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_DECODER_CREATE, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_DECODER_CREATE, 0, NULL);
     fprintf(tlog, "%s%s VdpDecoderCreate device=%d, profile=%s, width=%d, height=%d, "
         "max_references=%d\n", trace_header, impl_state, device, reverse_decoder_profile(profile),
         width, height, max_references);
@@ -155,9 +165,9 @@ VdpStatus
 traceVdpDecoderDestroy(VdpDecoder decoder)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_DECODER_DESTROY, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_DECODER_DESTROY, 0, NULL);
     fprintf(tlog, "%s%s VdpDecoderDestroy decoder=%d\n", trace_header, impl_state, decoder);
 skip:;
     VdpStatus ret = softVdpDecoderDestroy(decoder);
@@ -170,9 +180,9 @@ traceVdpDecoderGetParameters(VdpDecoder decoder,
                              VdpDecoderProfile *profile, uint32_t *width, uint32_t *height)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_DECODER_GET_PARAMETERS, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_DECODER_GET_PARAMETERS, 0, NULL);
     fprintf(tlog, "%s%s VdpDecoderGetParameters decoder=%d\n", trace_header, impl_state, decoder);
 skip:;
     VdpStatus ret = softVdpDecoderGetParameters(decoder, profile, width, height);
@@ -186,9 +196,9 @@ traceVdpDecoderRender(VdpDecoder decoder, VdpVideoSurface target,
                       VdpBitstreamBuffer const *bitstream_buffers)
 {
     const char *impl_state = "{part}";
+    traceCallHook(VDP_FUNC_ID_DECODER_RENDER, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_DECODER_RENDER, 0, NULL);
     fprintf(tlog, "%s%s VdpDecoderRender decoder=%d, target=%d, picture_info=%p, "
         "bitstream_buffer_count=%d\n", trace_header, impl_state, decoder, target, picture_info,
         bitstream_buffer_count);
@@ -205,9 +215,9 @@ traceVdpOutputSurfaceQueryCapabilities(VdpDevice device,
                                        uint32_t *max_width, uint32_t *max_height)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_QUERY_CAPABILITIES, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_QUERY_CAPABILITIES, 0, NULL);
     fprintf(tlog, "%s%s VdpOutputSurfaceQueryCapabilities device=%d, surface_rgba_format=%s\n",
         trace_header, impl_state, device, reverse_rgba_format(surface_rgba_format));
 skip:;
@@ -223,9 +233,9 @@ traceVdpOutputSurfaceQueryGetPutBitsNativeCapabilities(VdpDevice device,
                                                        VdpBool *is_supported)
 {
     const char *impl_state = "{zilch}";
+    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_QUERY_GET_PUT_BITS_NATIVE_CAPABILITIES, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_QUERY_GET_PUT_BITS_NATIVE_CAPABILITIES, 0, NULL);
     fprintf(tlog, "%s%s VdpOutputSurfaceQueryGetPutBitsNativeCapabilities device=%d, "
         "surface_rgba_format=%s\n", trace_header, impl_state, device,
         reverse_rgba_format(surface_rgba_format));
@@ -245,9 +255,9 @@ traceVdpOutputSurfaceQueryPutBitsIndexedCapabilities(VdpDevice device,
                                                      VdpBool *is_supported)
 {
     const char *impl_state = "{zilch}";
+    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_QUERY_PUT_BITS_INDEXED_CAPABILITIES, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_QUERY_PUT_BITS_INDEXED_CAPABILITIES, 0, NULL);
     fprintf(tlog, "%s%s VdpOutputSurfaceQueryPutBitsIndexedCapabilities device=%d, "
         "surface_rgba_format=%s, bits_indexed_format=%s, color_table_format=%s\n",
         trace_header, impl_state, device, reverse_rgba_format(surface_rgba_format),
@@ -267,9 +277,9 @@ traceVdpOutputSurfaceQueryPutBitsYCbCrCapabilities(VdpDevice device,
                                                    VdpBool *is_supported)
 {
     const char *impl_state = "{zilch}";
+    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_QUERY_PUT_BITS_Y_CB_CR_CAPABILITIES, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_QUERY_PUT_BITS_Y_CB_CR_CAPABILITIES, 0, NULL);
     fprintf(tlog, "%s%s VdpOutputSurfaceQueryPutBitsYCbCrCapabilities device=%d, "
         "surface_rgba_format=%s, bits_ycbcr_format=%s\n", trace_header, impl_state,
         device, reverse_rgba_format(surface_rgba_format), reverse_ycbcr_format(bits_ycbcr_format));
@@ -285,9 +295,9 @@ traceVdpOutputSurfaceCreate(VdpDevice device, VdpRGBAFormat rgba_format,
                             uint32_t width, uint32_t height, VdpOutputSurface *surface)
 {
     const char *impl_state = "{part}";
+    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_CREATE, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_CREATE, 0, NULL);
     fprintf(tlog, "%s%s VdpOutputSurfaceCreate device=%d, rgba_format=%s, width=%d, height=%d\n",
         trace_header, impl_state, device, reverse_rgba_format(rgba_format), width, height);
 skip:;
@@ -300,9 +310,9 @@ VdpStatus
 traceVdpOutputSurfaceDestroy(VdpOutputSurface surface)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_DESTROY, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_DESTROY, 0, NULL);
     fprintf(tlog, "%s%s VdpOutputSurfaceDestroy surface=%d\n", trace_header, impl_state, surface);
 skip:;
     VdpStatus ret = softVdpOutputSurfaceDestroy(surface);
@@ -315,9 +325,9 @@ traceVdpOutputSurfaceGetParameters(VdpOutputSurface surface,
                                    VdpRGBAFormat *rgba_format, uint32_t *width, uint32_t *height)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_GET_PARAMETERS, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_GET_PARAMETERS, 0, NULL);
     fprintf(tlog, "%s%s VdpOutputSurfaceGetParameters surface=%d\n", trace_header, impl_state,
         surface);
 skip:;
@@ -332,9 +342,9 @@ traceVdpOutputSurfaceGetBitsNative(VdpOutputSurface surface,
                                    uint32_t const *destination_pitches)
 {
     const char *impl_state = "{part}";
+    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_GET_BITS_NATIVE, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_GET_BITS_NATIVE, 0, NULL);
     fprintf(tlog, "%s%s VdpOutputSurfaceGetBitsNative surface=%d, source_rect=%s\n",
         trace_header, impl_state, surface, rect2string(source_rect));
 skip:;
@@ -350,9 +360,9 @@ traceVdpOutputSurfacePutBitsNative(VdpOutputSurface surface,
                                    VdpRect const *destination_rect)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_PUT_BITS_NATIVE, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_PUT_BITS_NATIVE, 0, NULL);
     fprintf(tlog, "%s%s VdpOutputSurfacePutBitsNative surface=%d, destination_rect=%s\n",
         trace_header, impl_state, surface, rect2string(destination_rect));
 skip:;
@@ -370,9 +380,9 @@ traceVdpOutputSurfacePutBitsIndexed(VdpOutputSurface surface,
                                     VdpColorTableFormat color_table_format, void const *color_table)
 {
     const char *impl_state = "{part}";
+    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_PUT_BITS_INDEXED, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_PUT_BITS_INDEXED, 0, NULL);
     fprintf(tlog, "%s%s VdpOutputSurfacePutBitsIndexed surface=%d, source_indexed_format=%s, "
         "destination_rect=%s, color_table_format=%s\n", trace_header, impl_state, surface,
         reverse_indexed_format(source_indexed_format), rect2string(destination_rect),
@@ -391,9 +401,9 @@ traceVdpOutputSurfacePutBitsYCbCr(VdpOutputSurface surface,
                                   VdpRect const *destination_rect, VdpCSCMatrix const *csc_matrix)
 {
     const char *impl_state = "{zilch}";
+    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_PUT_BITS_Y_CB_CR, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_PUT_BITS_Y_CB_CR, 0, NULL);
     fprintf(tlog, "%s%s VdpOutputSurfacePutBitsYCbCr surface=%d, source_ycbcr_format=%s, "
         "destination_rect=%s, csc_matrix=%p\n", trace_header, impl_state, surface,
         reverse_ycbcr_format(source_ycbcr_format), rect2string(destination_rect), csc_matrix);
@@ -409,9 +419,9 @@ traceVdpVideoMixerQueryFeatureSupport(VdpDevice device,
                                       VdpVideoMixerFeature feature, VdpBool *is_supported)
 {
     const char *impl_state = "{zilch}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_QUERY_FEATURE_SUPPORT, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_QUERY_FEATURE_SUPPORT, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoMixerQueryFeatureSupport device=%d, feature=%s\n",
         trace_header, impl_state, device, reverse_video_mixer_feature(feature));
 skip:;
@@ -426,9 +436,9 @@ traceVdpVideoMixerQueryParameterSupport(VdpDevice device,
                                         VdpBool *is_supported)
 {
     const char *impl_state = "{zilch}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_QUERY_PARAMETER_SUPPORT, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_QUERY_PARAMETER_SUPPORT, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoMixerQueryParameterSupport device=%d, parameter=%s\n",
         trace_header, impl_state, device, reverse_video_mixer_parameter(parameter));
 skip:;
@@ -442,9 +452,9 @@ traceVdpVideoMixerQueryAttributeSupport(VdpDevice device,
                                         VdpVideoMixerAttribute attribute, VdpBool *is_supported)
 {
     const char *impl_state = "{zilch}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_QUERY_ATTRIBUTE_SUPPORT, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_QUERY_ATTRIBUTE_SUPPORT, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoMixerQueryAttributeSupport device=%d, attribute=%s\n",
         trace_header, impl_state, device, reverse_video_mixer_attribute(attribute));
 skip:;
@@ -459,9 +469,9 @@ traceVdpVideoMixerQueryParameterValueRange(VdpDevice device,
                                            void *min_value, void *max_value)
 {
     const char *impl_state = "{zilch}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_QUERY_PARAMETER_VALUE_RANGE, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_QUERY_PARAMETER_VALUE_RANGE, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoMixerQueryParameterValueRange device=%d, parameter=%s\n",
         trace_header, impl_state, device, reverse_video_mixer_parameter(parameter));
 skip:;
@@ -477,9 +487,9 @@ traceVdpVideoMixerQueryAttributeValueRange(VdpDevice device,
                                            void *min_value, void *max_value)
 {
     const char *impl_state = "{zilch}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_QUERY_ATTRIBUTE_VALUE_RANGE, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_QUERY_ATTRIBUTE_VALUE_RANGE, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoMixerQueryAttributeValueRange device=%d, attribute=%s\n",
         trace_header, impl_state, device, reverse_video_mixer_attribute(attribute));
 skip:;
@@ -496,9 +506,9 @@ traceVdpVideoMixerCreate(VdpDevice device, uint32_t feature_count,
                          void const *const *parameter_values, VdpVideoMixer *mixer)
 {
     const char *impl_state = "{part}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_CREATE, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_CREATE, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoMixerCreate device=%d, feature_count=%d, parameter_count=%d\n",
         trace_header, impl_state, device, feature_count, parameter_count);
     for (uint32_t k = 0; k < feature_count; k ++)
@@ -538,9 +548,9 @@ traceVdpVideoMixerSetFeatureEnables(VdpVideoMixer mixer,
                                     VdpBool const *feature_enables)
 {
     const char *impl_state = "{part}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_SET_FEATURE_ENABLES, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_SET_FEATURE_ENABLES, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoMixerSetFeatureEnables mixer=%d, feature_count=%d\n",
         trace_header, impl_state, mixer, feature_count);
     for (uint32_t k = 0; k < feature_count; k ++) {
@@ -562,9 +572,9 @@ traceVdpVideoMixerSetAttributeValues(VdpVideoMixer mixer,
                                      void const *const *attribute_values)
 {
     const char *impl_state = "{part}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_SET_ATTRIBUTE_VALUES, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_SET_ATTRIBUTE_VALUES, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoMixerSetAttributeValues mixer=%d, attribute_count=%d\n",
         trace_header, impl_state, mixer, attribute_count);
     for (uint32_t k = 0; k < attribute_count; k ++) {
@@ -594,9 +604,9 @@ traceVdpVideoMixerGetFeatureSupport(VdpVideoMixer mixer,
                                     VdpBool *feature_supports)
 {
     const char *impl_state = "{zilch}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_GET_FEATURE_SUPPORT, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_GET_FEATURE_SUPPORT, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoMixerGetFeatureSupport mixer=%d, feature_count=%d\n",
         trace_header, impl_state, mixer, feature_count);
     for (unsigned int k = 0; k < feature_count; k ++)
@@ -615,9 +625,9 @@ traceVdpVideoMixerGetFeatureEnables(VdpVideoMixer mixer,
                                     VdpBool *feature_enables)
 {
     const char *impl_state = "{zilch}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_GET_FEATURE_ENABLES, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_GET_FEATURE_ENABLES, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoMixerGetFeatureEnables mixer=%d, feature_count=%d\n",
         trace_header, impl_state, mixer, feature_count);
     for (unsigned int k = 0; k < feature_count; k ++)
@@ -637,9 +647,9 @@ traceVdpVideoMixerGetParameterValues(VdpVideoMixer mixer,
                                      void *const *parameter_values)
 {
     const char *impl_state = "{zilch}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_GET_PARAMETER_VALUES, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_GET_PARAMETER_VALUES, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoMixerGetParameterValues mixer=%d, parameter_count=%d\n",
         trace_header, impl_state, mixer, parameter_count);
     for (unsigned int k = 0; k < parameter_count; k ++)
@@ -659,9 +669,9 @@ traceVdpVideoMixerGetAttributeValues(VdpVideoMixer mixer,
                                      void *const *attribute_values)
 {
     const char *impl_state = "{zilch}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_GET_ATTRIBUTE_VALUES, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_GET_ATTRIBUTE_VALUES, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoMixerGetAttributeValues mixer=%d, attribute_count=%d\n",
         trace_header, impl_state, mixer, attribute_count);
     for (unsigned int k = 0; k < attribute_count; k ++)
@@ -678,9 +688,9 @@ VdpStatus
 traceVdpVideoMixerDestroy(VdpVideoMixer mixer)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_DESTROY, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_DESTROY, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoMixerDestroy mixer=%d\n", trace_header, impl_state, mixer);
 skip:;
     VdpStatus ret = softVdpVideoMixerDestroy(mixer);
@@ -701,9 +711,9 @@ traceVdpVideoMixerRender(VdpVideoMixer mixer,
                          uint32_t layer_count, VdpLayer const *layers)
 {
     const char *impl_state = "{part}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_RENDER, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_MIXER_RENDER, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoMixerRender mixer=%d, background_surface=%d, "
         "background_source_rect=%s,\n", trace_header, impl_state,
         mixer, background_surface, rect2string(background_source_rect));
@@ -741,9 +751,9 @@ VdpStatus
 traceVdpPresentationQueueTargetDestroy(VdpPresentationQueueTarget presentation_queue_target)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_TARGET_DESTROY, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_TARGET_DESTROY, 0, NULL);
     fprintf(tlog, "%s%s VdpPresentationQueueTargetDestroy presentation_queue_target=%d\n",
         trace_header, impl_state, presentation_queue_target);
 skip:;
@@ -758,9 +768,9 @@ traceVdpPresentationQueueCreate(VdpDevice device,
                                 VdpPresentationQueue *presentation_queue)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_CREATE, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_CREATE, 0, NULL);
     fprintf(tlog, "%s%s VdpPresentationQueueCreate device=%d, presentation_queue_target=%d\n",
         trace_header, impl_state, device, presentation_queue_target);
 skip:;
@@ -774,9 +784,9 @@ VdpStatus
 traceVdpPresentationQueueDestroy(VdpPresentationQueue presentation_queue)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_DESTROY, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_DESTROY, 0, NULL);
     fprintf(tlog, "%s%s VdpPresentationQueueDestroy presentation_queue=%d\n",
         trace_header, impl_state, presentation_queue);
 skip:;
@@ -790,9 +800,9 @@ traceVdpPresentationQueueSetBackgroundColor(VdpPresentationQueue presentation_qu
                                             VdpColor *const background_color)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_SET_BACKGROUND_COLOR, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_SET_BACKGROUND_COLOR, 0, NULL);
     fprintf(tlog, "%s%s VdpPresentationQueueSetBackgroundColor presentation_queue=%d, "
             "background_color=", trace_header, impl_state, presentation_queue);
     if (background_color) {
@@ -813,9 +823,9 @@ traceVdpPresentationQueueGetBackgroundColor(VdpPresentationQueue presentation_qu
                                             VdpColor *background_color)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_GET_BACKGROUND_COLOR, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_GET_BACKGROUND_COLOR, 0, NULL);
     fprintf(tlog, "%s%s VdpPresentationQueueGetBackgroundColor  presentation_queue=%d\n",
         trace_header, impl_state, presentation_queue);
 skip:;
@@ -830,9 +840,9 @@ traceVdpPresentationQueueGetTime(VdpPresentationQueue presentation_queue,
                                  VdpTime *current_time)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_GET_TIME, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_GET_TIME, 0, NULL);
     fprintf(tlog, "%s%s VdpPresentationQueueGetTime presentation_queue=%d\n",
         trace_header, impl_state, presentation_queue);
 skip:;
@@ -847,9 +857,9 @@ traceVdpPresentationQueueDisplay(VdpPresentationQueue presentation_queue,
                                  uint32_t clip_height, VdpTime earliest_presentation_time)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_DISPLAY, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_DISPLAY, 0, NULL);
     fprintf(tlog, "%s%s VdpPresentationQueueDisplay presentation_queue=%d, surface=%d, "
         "clip_width=%d, clip_height=%d,\n", trace_header, impl_state, presentation_queue, surface,
         clip_width, clip_height);
@@ -869,9 +879,9 @@ traceVdpPresentationQueueBlockUntilSurfaceIdle(VdpPresentationQueue presentation
 
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_BLOCK_UNTIL_SURFACE_IDLE, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_BLOCK_UNTIL_SURFACE_IDLE, 0, NULL);
     fprintf(tlog, "%s%s VdpPresentationQueueBlockUntilSurfaceIdle presentation_queue=%d, "
         "surface=%d\n", trace_header, impl_state, presentation_queue, surface);
 skip:;
@@ -888,9 +898,9 @@ traceVdpPresentationQueueQuerySurfaceStatus(VdpPresentationQueue presentation_qu
                                             VdpTime *first_presentation_time)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_QUERY_SURFACE_STATUS, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_QUERY_SURFACE_STATUS, 0, NULL);
     fprintf(tlog, "%s%s VdpPresentationQueueQuerySurfaceStatus presentation_queue=%d, "
         "surface=%d\n", trace_header, impl_state, presentation_queue, surface);
 skip:;
@@ -906,9 +916,9 @@ traceVdpVideoSurfaceQueryCapabilities(VdpDevice device,
                                       uint32_t *max_width, uint32_t *max_height)
 {
     const char *impl_state = "{part}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_SURFACE_QUERY_CAPABILITIES, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_SURFACE_QUERY_CAPABILITIES, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoSurfaceQueryCapabilities device=%d, surface_chroma_type=%s\n",
         trace_header, impl_state, device, reverse_chroma_type(surface_chroma_type));
 skip:;
@@ -925,9 +935,9 @@ traceVdpVideoSurfaceQueryGetPutBitsYCbCrCapabilities(VdpDevice device,
                                                      VdpBool *is_supported)
 {
     const char *impl_state = "{part}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_SURFACE_QUERY_GET_PUT_BITS_Y_CB_CR_CAPABILITIES, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_SURFACE_QUERY_GET_PUT_BITS_Y_CB_CR_CAPABILITIES, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoSurfaceQueryGetPutBitsYCbCrCapabilities device=%d, "
         "surface_chroma_type=%s, bits_ycbcr_format=%s\n", trace_header, impl_state,
         device, reverse_chroma_type(surface_chroma_type), reverse_ycbcr_format(bits_ycbcr_format));
@@ -943,9 +953,9 @@ traceVdpVideoSurfaceCreate(VdpDevice device, VdpChromaType chroma_type,
                            uint32_t width, uint32_t height, VdpVideoSurface *surface)
 {
     const char *impl_state = "{part}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_SURFACE_CREATE, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_SURFACE_CREATE, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoSurfaceCreate, device=%d, chroma_type=%s, width=%d, height=%d\n",
         trace_header, impl_state, device, reverse_chroma_type(chroma_type), width, height);
 skip:;
@@ -958,9 +968,9 @@ VdpStatus
 traceVdpVideoSurfaceDestroy(VdpVideoSurface surface)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_SURFACE_DESTROY, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_SURFACE_DESTROY, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoSurfaceDestroy surface=%d\n", trace_header, impl_state, surface);
 skip:;
     VdpStatus ret = softVdpVideoSurfaceDestroy(surface);
@@ -973,9 +983,9 @@ traceVdpVideoSurfaceGetParameters(VdpVideoSurface surface,
                                   VdpChromaType *chroma_type, uint32_t *width, uint32_t *height)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_SURFACE_GET_PARAMETERS, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_SURFACE_GET_PARAMETERS, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoSurfaceGetParameters surface=%d\n", trace_header, impl_state,
         surface);
 skip:;
@@ -990,9 +1000,9 @@ traceVdpVideoSurfaceGetBitsYCbCr(VdpVideoSurface surface,
                                  void *const *destination_data, uint32_t const *destination_pitches)
 {
     const char *impl_state = "{part}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_SURFACE_GET_BITS_Y_CB_CR, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_SURFACE_GET_BITS_Y_CB_CR, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoSurfaceGetBitsYCbCr surface=%d, destination_ycbcr_format=%s\n",
         trace_header, impl_state, surface, reverse_ycbcr_format(destination_ycbcr_format));
 skip:;
@@ -1008,9 +1018,9 @@ traceVdpVideoSurfacePutBitsYCbCr(VdpVideoSurface surface,
                                  uint32_t const *source_pitches)
 {
     const char *impl_state = "{part}";
+    traceCallHook(VDP_FUNC_ID_VIDEO_SURFACE_PUT_BITS_Y_CB_CR, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_VIDEO_SURFACE_PUT_BITS_Y_CB_CR, 0, NULL);
     fprintf(tlog, "%s%s VdpVideoSurfacePutBitsYCbCr surface=%d, source_ycbcr_format=%s\n",
         trace_header, impl_state, surface, reverse_ycbcr_format(source_ycbcr_format));
 skip:;
@@ -1026,9 +1036,9 @@ traceVdpBitmapSurfaceQueryCapabilities(VdpDevice device,
                                        uint32_t *max_width, uint32_t *max_height)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_BITMAP_SURFACE_QUERY_CAPABILITIES, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_BITMAP_SURFACE_QUERY_CAPABILITIES, 0, NULL);
     fprintf(tlog, "%s%s VdpBitmapSurfaceQueryCapabilities device=%d, surface_rgba_format=%s\n",
         trace_header, impl_state, device, reverse_rgba_format(surface_rgba_format));
 skip:;
@@ -1044,9 +1054,9 @@ traceVdpBitmapSurfaceCreate(VdpDevice device, VdpRGBAFormat rgba_format,
                             VdpBitmapSurface *surface)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_BITMAP_SURFACE_CREATE, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_BITMAP_SURFACE_CREATE, 0, NULL);
     fprintf(tlog, "%s%s VdpBitmapSurfaceCreate device=%d, rgba_format=%s, width=%d, height=%d,\n"
         "%s      frequently_accessed=%d\n", trace_header, impl_state, device,
         reverse_rgba_format(rgba_format), width, height, trace_header_blank, frequently_accessed);
@@ -1061,9 +1071,9 @@ VdpStatus
 traceVdpBitmapSurfaceDestroy(VdpBitmapSurface surface)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_BITMAP_SURFACE_DESTROY, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_BITMAP_SURFACE_DESTROY, 0, NULL);
     fprintf(tlog, "%s%s VdpBitmapSurfaceDestroy surface=%d\n", trace_header, impl_state, surface);
 skip:;
     VdpStatus ret = softVdpBitmapSurfaceDestroy(surface);
@@ -1077,9 +1087,9 @@ traceVdpBitmapSurfaceGetParameters(VdpBitmapSurface surface,
                                    VdpBool *frequently_accessed)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_BITMAP_SURFACE_GET_PARAMETERS, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_BITMAP_SURFACE_GET_PARAMETERS, 0, NULL);
     fprintf(tlog, "%s%s VdpBitmapSurfaceGetParameters surface=%d\n",
         trace_header, impl_state, surface);
 skip:;
@@ -1095,9 +1105,9 @@ traceVdpBitmapSurfacePutBitsNative(VdpBitmapSurface surface,
                                    VdpRect const *destination_rect)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_BITMAP_SURFACE_PUT_BITS_NATIVE, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_BITMAP_SURFACE_PUT_BITS_NATIVE, 0, NULL);
     fprintf(tlog, "%s%s VdpBitmapSurfacePutBitsNative surface=%d, destination_rect=%s\n",
         trace_header, impl_state, surface, rect2string(destination_rect));
 skip:;
@@ -1111,9 +1121,9 @@ VdpStatus
 traceVdpDeviceDestroy(VdpDevice device)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_DEVICE_DESTROY, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_DEVICE_DESTROY, 0, NULL);
     fprintf(tlog, "%s%s VdpDeviceDestroy device=%d\n", trace_header, impl_state, device);
 skip:;
     VdpStatus ret = softVdpDeviceDestroy(device);
@@ -1125,9 +1135,9 @@ VdpStatus
 traceVdpGetInformationString(char const **information_string)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_GET_INFORMATION_STRING, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_GET_INFORMATION_STRING, 0, NULL);
     fprintf(tlog, "%s%s VdpGetInformationString\n", trace_header, impl_state);
 skip:;
     VdpStatus ret = softVdpGetInformationString(information_string);
@@ -1140,9 +1150,9 @@ traceVdpGenerateCSCMatrix(VdpProcamp *procamp, VdpColorStandard standard,
                           VdpCSCMatrix *csc_matrix)
 {
     const char *impl_state = "{part}";
+    traceCallHook(VDP_FUNC_ID_GENERATE_CSC_MATRIX, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_GENERATE_CSC_MATRIX, 0, NULL);
     fprintf(tlog, "%s%s VdpGenerateCSCMatrix ", trace_header, impl_state);
     if (procamp) {
         fprintf(tlog, "brightness=%f, contrast=%f, saturation=%f, ", procamp->brightness,
@@ -1164,9 +1174,9 @@ traceVdpOutputSurfaceRenderOutputSurface(VdpOutputSurface destination_surface,
                                          uint32_t flags)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_RENDER_OUTPUT_SURFACE, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_RENDER_OUTPUT_SURFACE, 0, NULL);
     fprintf(tlog, "%s%s VdpOutputSurfaceRenderOutputSurface destination_surface=%d, "
         "destination_rect=%s,\n", trace_header, impl_state,
         destination_surface, rect2string(destination_rect));
@@ -1229,9 +1239,9 @@ traceVdpOutputSurfaceRenderBitmapSurface(VdpOutputSurface destination_surface,
                                          uint32_t flags)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_RENDER_BITMAP_SURFACE, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_OUTPUT_SURFACE_RENDER_BITMAP_SURFACE, 0, NULL);
     fprintf(tlog, "%s%s VdpOutputSurfaceRenderBitmapSurface destination_surface=%d, "
         "destination_rect=%s,\n", trace_header, impl_state,
         destination_surface, rect2string(destination_rect));
@@ -1290,9 +1300,9 @@ traceVdpPreemptionCallbackRegister(VdpDevice device,
                                    VdpPreemptionCallback callback, void *context)
 {
     const char *impl_state = "{zilch/fake success}";
+    traceCallHook(VDP_FUNC_ID_PREEMPTION_CALLBACK_REGISTER, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_PREEMPTION_CALLBACK_REGISTER, 0, NULL);
     fprintf(tlog, "%s%s VdpPreemptionCallbackRegister device=%d, callback=%p, context=%p\n",
         trace_header, impl_state, device, callback, context);
 skip:;
@@ -1306,9 +1316,9 @@ traceVdpPresentationQueueTargetCreateX11(VdpDevice device, Drawable drawable,
                                          VdpPresentationQueueTarget *target)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_TARGET_CREATE_X11, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_PRESENTATION_QUEUE_TARGET_CREATE_X11, 0, NULL);
     fprintf(tlog, "%s%s VdpPresentationQueueTargetCreateX11, device=%d, drawable=%u\n",
         trace_header, impl_state, device, ((unsigned int)drawable));
 skip:;
@@ -1322,9 +1332,9 @@ traceVdpGetProcAddress(VdpDevice device, VdpFuncId function_id,
                        void **function_pointer)
 {
     const char *impl_state = "{full}";
+    traceCallHook(VDP_FUNC_ID_GET_PROC_ADDRESS, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(VDP_FUNC_ID_GET_PROC_ADDRESS, 0, NULL);
     fprintf(tlog, "%s%s VdpGetProcAddress, device=%d, function_id=%s\n",
         trace_header, impl_state, device, reverse_func_id(function_id));
 skip:;
@@ -1338,13 +1348,13 @@ traceVdpDeviceCreateX11(Display *display, int screen, VdpDevice *device,
                         VdpGetProcAddress **get_proc_address)
 {
     const char *impl_state = "{full}";
+    traceCallHook(TRACE_FUNC_ID_DEVICE_CREATE, 0, NULL);
     if (!trace_enabled)
         goto skip;
-    traceCallHook(-1, 0, NULL);
     fprintf(tlog, "%s%s vdp_imp_device_create_x11 display=%p, screen=%d\n", trace_header,
         impl_state, display, screen);
 skip:;
     VdpStatus ret = softVdpDeviceCreateX11(display, screen, device, get_proc_address);
-    traceCallHook(-1, 1, (void*)ret);
+    traceCallHook(TRACE_FUNC_ID_DEVICE_CREATE, 1, (void*)ret);
     return ret;
 }
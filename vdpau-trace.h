@@ -11,6 +11,11 @@
 #include <vdpau/vdpau_x11.h>
 #include "reverse-constant.h"
 
+// pseudo function ids passed to trace hook along with VdpFuncId values
+#define TRACE_FUNC_ID_DEVICE_CREATE     (-1)    ///< vdp_imp_device_create_x11
+#define TRACE_FUNC_ID_INFO              (-2)    ///< traceInfo() call
+#define TRACE_FUNC_ID_NONE              (-3)    ///< not inside of any API call
+
 void
 traceEnableTracing(int flag);
 
@@ -35,6 +40,9 @@ traceSetHook(void (*hook)(void *param1, void *param2, int origin, int after), vo
 void
 traceCallHook(int origin, int after, void *shortterm_param);
 
+int
+traceGetCurrentFuncId(void);
+
 VdpStatus
 traceVdpDeviceCreateX11(Display *display, int screen, VdpDevice *device,
                          VdpGetProcAddress **get_proc_address);